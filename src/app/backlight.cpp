@@ -11,7 +11,7 @@
  
 #include "backlight.h"
 
-#include "LPC8xx.h"
+#include "hal/hal.h"
 #include "util/lcd.h"
 #include "util/mrt_interrupt.h"
 
@@ -40,8 +40,8 @@ void Backlight::On() {
 }
 
 void Backlight::DelayedOff(uint32_t delay_ms) {
-    LPC_MRT->Channel[BACKLIGHT_MRT_TIMER].CTRL    = 0x03;
-    LPC_MRT->Channel[BACKLIGHT_MRT_TIMER].INTVAL  = (FIXED_CLOCK_RATE_HZ / 1000) * delay_ms | (1 << 31);
+    halMrtSetMode(BACKLIGHT_MRT_TIMER, HAL_MRT_ONE_SHOT | HAL_MRT_INTERRUPT);
+    halMrtLoad(BACKLIGHT_MRT_TIMER, (FIXED_CLOCK_RATE_HZ / 1000) * delay_ms);
 }
 
 bool Backlight::IsOn() {
@@ -18,43 +18,164 @@
  
 #include "button_input.h"
 
-#include "LPC8xx.h"
+#include "hal/hal.h"
 #include "util/mcp.h"
 #include "util/timers.h"
+#include "util/power.h"
+#include "latency.h"
+#include "session_log.h"
+
+#if defined(BEEP_ON_INTERRUPT)
+#include "buzzer.h"
+#endif
 
 #define POST_READ_DELAY_MS  8
+#define BUTTON_IRQ_GPIO     1
+#define BUTTON_ALARM        0       // closes a chord window, or times the next auto-repeat
+
+//----------------------------------------------------------------------------------------
+// Auto-repeat phases: the longer buttons are held, the faster and larger the repeats
+//
+
+struct RepeatPhase {
+    uint16_t held_ms;       // phase starts once buttons held for this long
+    uint16_t interval_ms;   // time between repeats in this phase
+    uint8_t  step;          // step size reported for each repeat
+};
+
+static const RepeatPhase repeat_phases[] = {
+    { 0,    1000, 1  },     // 1 per second
+    { 3000, 200,  1  },     // 5 per second
+    { 6000, 500,  10 },     // 10 steps at a time
+};
+
+#define REPEAT_PHASE_COUNT  (sizeof(repeat_phases) / sizeof(repeat_phases[0]))
+
+//----------------------------------------------------------------------------------------
+// Interrupt handling
+//
+
+// Unread interrupts, each with its time, oldest first. Beyond the queue
+// further interrupts aren't counted; the next read sees their changes anyway.
+#define BUTTON_IRQ_QUEUE    4       // power of 2
 
 static volatile int buttonIRQCount = 0;
+static volatile uint8_t buttonIRQFirst = 0;
+static volatile uint32_t buttonIRQTimes[BUTTON_IRQ_QUEUE];
+static uint32_t latencyMaxTicks = 0;
 
 extern "C" void PININT0_IRQHandler(void) {
-    if (LPC_PIN_INT->FALL & 1) {
-        LPC_PIN_INT->FALL = 1;
-        buttonIRQCount++;
+    powerNoteWake(POWER_WAKE_PIN);
+    
+    if (halPinIntTakeFall()) {
+        if (buttonIRQCount < BUTTON_IRQ_QUEUE) {
+            buttonIRQTimes[(buttonIRQFirst + buttonIRQCount) & (BUTTON_IRQ_QUEUE - 1)] = timersNow();
+            buttonIRQCount++;
+        }
+        LATENCY_START();
+#if defined(BEEP_ON_INTERRUPT)
+        // Press or release isn't known until the expander is read, so
+        // beep for either; a release cancels it once read
+        Buzzer::InterruptBeep();
+#endif
     }
 }
 
+//----------------------------------------------------------------------------------------
+// Class implementation
+//
+
 void ButtonInput::Initialise() {
     // Configure pin interrupt for PIO0_1
-    LPC_SYSCON->PINTSEL[0]      = 1;        // Pin interrupt 0 from PIO0_1
-    LPC_PIN_INT->ISEL           = 0;        // Level sensitive (1 bit per pin interrupt)
-    LPC_PIN_INT->IENF           = 1;        // Falling level   (1 bit per pin interrupt)
-    LPC_SYSCON->SYSAHBCLKCTRL  |= 1<<6;     // Turn on clock to pin interrupts block (already 1 after reset)
-    NVIC_EnableIRQ(PININT0_IRQn);           // Enable pin interrupt in NVIC (#24)
+    halPinIntInit(BUTTON_IRQ_GPIO);
 }
 
-ButtonInput::ButtonInput(uint8_t i2c_addr) : i2c_addr_(i2c_addr), button_state_(0) {
+ButtonInput::ButtonInput(uint8_t i2c_addr) : i2c_addr_(i2c_addr), button_state_(0), input_state_(0), chord_presses_(0), discarded_(0), chord_open_(false), release_only_(false), repeat_phase_(0), press_time_(0) {
     mcpWriteRegister(i2c_addr_, MCP23008_IODIR, 0xff);   // 0-7: input
     mcpWriteRegister(i2c_addr_, MCP23008_GPPU, 0xff);    // 0-7: pull-up
     mcpWriteRegister(i2c_addr_, MCP23008_IPOL, 0xff);    // 0-7: invert
     mcpWriteRegister(i2c_addr_, MCP23008_GPINTEN, 0xff); // 0-7: interrupt on change. Interrupt pin is active low
 }
 
-uint8_t ButtonInput::GetButtonStates() {
+bool ButtonInput::ReadButtonStates() {
     if (buttonIRQCount > 0) {
-        __disable_irq();
+        halIrqDisable();
+        uint32_t latency = timersSince(buttonIRQTimes[buttonIRQFirst]);
+        buttonIRQFirst = (buttonIRQFirst + 1) & (BUTTON_IRQ_QUEUE - 1);
         buttonIRQCount--;
-        __enable_irq();
-        button_state_ = mcpReadRegister(i2c_addr_, MCP23008_GPIO);
+        halIrqEnable();
+        
+        if (latency > latencyMaxTicks) {
+            latencyMaxTicks = latency;
+        }
+        
+        uint8_t last_input_state = input_state_;
+        input_state_ = mcpReadRegister(i2c_addr_, MCP23008_GPIO);
+        LATENCY_MARK(LATENCY_READ);
+        
+        if (input_state_ != last_input_state) {
+            SESSION_LOG_RECORD(input_state_);
+        }
+        return true;
+    }
+    
+    return false;
+}
+
+uint8_t ButtonInput::GetButtonStates() {
+    uint8_t last_input_state = input_state_;
+    
+    release_only_ = false;
+    
+    if (ReadButtonStates()) {
+        uint8_t buttons_pressed = input_state_ & ~last_input_state;
+        // A press still in the chord window is yet to be delivered, so its
+        // release isn't release only
+        release_only_ = !buttons_pressed && !chord_presses_;
+        
+        // Nothing reaches the controller for the release of a discarded
+        // press, so nothing would end its trace
+        if (release_only_ && !(last_input_state & ~input_state_ & ~discarded_)) {
+            LATENCY_ABORT();
+        }
+        discarded_ &= input_state_;
+        
+        if (buttons_pressed) {
+            // Gather presses arriving within the chord window, so a chord
+            // split across several reads is delivered as one state change
+            chord_presses_ |= buttons_pressed;
+            
+            if (!chord_open_) {
+                chord_open_ = true;
+                press_time_ = timersNow();
+                timersSetAlarm(BUTTON_ALARM, CHORD_WINDOW_MS);
+            }
+        }
+    }
+    
+    if (chord_open_) {
+        if (timersAlarmExpired(BUTTON_ALARM)) {
+            // Deliver all presses in the window, even those already released;
+            // any release is then delivered as a following state change
+            button_state_   = input_state_ | chord_presses_;
+            chord_presses_  = 0;
+            chord_open_     = false;
+            
+            if (input_state_) {
+                repeat_phase_ = 0;
+                timersSetAlarm(BUTTON_ALARM, repeat_phases[0].interval_ms - CHORD_WINDOW_MS);
+            }
+            else {
+                timersCancelAlarm(BUTTON_ALARM);
+            }
+        }
+    }
+    else {
+        if (!input_state_) {
+            timersCancelAlarm(BUTTON_ALARM);
+        }
+        
+        button_state_ = input_state_;
     }
     
     return button_state_;
@@ -62,10 +183,40 @@ uint8_t ButtonInput::GetButtonStates() {
 
 void ButtonInput::DiscardNextState()
 {
-    GetButtonStates();
+    LATENCY_ABORT();
+    ReadButtonStates();
+    
+    button_state_   = input_state_;
+    discarded_      = input_state_;
+    chord_presses_  = 0;
+    chord_open_     = false;
+    timersCancelAlarm(BUTTON_ALARM);
 }
 
 bool ButtonInput::HasButtonStateChanged() {
-    return buttonIRQCount > 0;
+    if (chord_open_) {
+        return buttonIRQCount > 0 || timersAlarmExpired(BUTTON_ALARM);
+    }
+    
+    return buttonIRQCount > 0 || input_state_ != button_state_;
+}
+
+bool ButtonInput::HasButtonRepeated() {
+    return timersAlarmExpired(BUTTON_ALARM) && !chord_open_;
+}
+
+uint32_t ButtonInput::GetMaxLatencyTicks() {
+    return latencyMaxTicks;
 }
 
+uint8_t ButtonInput::GetRepeatStep() {
+    uint32_t held = timersSince(press_time_);
+    
+    while (repeat_phase_ < REPEAT_PHASE_COUNT - 1 && held >= repeat_phases[repeat_phase_ + 1].held_ms * TIMERS_TICKS_PER_MS) {
+        repeat_phase_++;
+    }
+
+    timersSetAlarm(BUTTON_ALARM, repeat_phases[repeat_phase_].interval_ms);
+    
+    return repeat_phases[repeat_phase_].step;
+}
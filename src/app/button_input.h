@@ -14,6 +14,11 @@
 
 #include "lpc_types.h"
 
+// Presses arriving within this window of the first are treated as one chord
+#if !defined(CHORD_WINDOW_MS)
+#define CHORD_WINDOW_MS     80
+#endif
+
 class ButtonInput {
     public:
 
@@ -24,10 +29,32 @@ class ButtonInput {
         uint8_t GetButtonStates();
         bool HasButtonStateChanged();
         void DiscardNextState();
+        bool IsIdle() { return !chord_open_; }
+        
+        // True when the last GetButtonStates read the buttons and found only
+        // releases, with no press waiting to be delivered
+        bool WasReleaseOnly() { return release_only_; }
+        
+        // Auto-repeat of held buttons: returns the step size for this repeat,
+        // which grows the longer the buttons are held
+        bool HasButtonRepeated();
+        uint8_t GetRepeatStep();
+        
+        // Worst time seen from a button interrupt to the expander being read
+        static uint32_t GetMaxLatencyTicks();
         
     private:
-        uint8_t i2c_addr_;
-        uint8_t button_state_;
+        bool ReadButtonStates();
+        
+        uint8_t     i2c_addr_;
+        uint8_t     button_state_;
+        uint8_t     input_state_;
+        uint8_t     chord_presses_;
+        uint8_t     discarded_;         // buttons still held from a discarded state
+        bool        chord_open_;
+        bool        release_only_;
+        uint8_t     repeat_phase_;
+        uint32_t    press_time_;
 };
 
 #endif
@@ -11,7 +11,10 @@
  
 #include "buzzer.h"
 
-#include "LPC8xx.h"
+#include "hal/hal.h"
+#include "latency.h"
+#include "util/power.h"
+#include "util/event_log.h"
 
 #define BUZZER_CONTINUOUS_TONE
 
@@ -46,6 +49,7 @@ void BuzzerInterruptHandler()
 }
 
 extern "C" void SysTick_Handler () {
+    powerNoteWake(POWER_WAKE_SYSTICK);
     BuzzerInterruptHandler();
 }
 
@@ -54,16 +58,17 @@ extern "C" void SysTick_Handler () {
 //
 
 void Buzzer::Initialise() {
-    //SysTick_Config(SystemCoreClock/INT_RATE);
+    //halSysTickStart(SYSTICK_COUNTER);
 }
 
 Buzzer::Buzzer(uint8_t gpio) : gpio_(gpio){
     flag_   = 0;
     state_  = 0;
+    interrupt_beep_ = false;
     mode_   = OFF;
     delay_  = 0;
 
-    LPC_GPIO_PORT->DIR0 |= 1 << gpio_;
+    halGpioSetOutput(gpio_);
 
     if (buzzer_instance_count < MAX_BUZZER_INSTANCES) {
         buzzer_instances[buzzer_instance_count++] = this;
@@ -84,42 +89,78 @@ void Buzzer::Update() {
             if (!delay_) {
                 flag_ ^= BUZZER_MASK;
                 delay_ = BEEP_DELAY;
+                EVENT_LOG_RECORD(flag_ ? EVENT_BUZZER_ON : EVENT_BUZZER_OFF);
             }
             break;
+            
+        case OFF:
+        case CONTINUOUS:
+            break;
     }
     
 #if defined(BUZZER_CONTINUOUS_TONE)
-    LPC_GPIO_PORT->B0[gpio_] = flag_;
+    halGpioWrite(gpio_, flag_);
 #else
     state_ ^= BUZZER_MASK;
-    LPC_GPIO_PORT->B0[gpio_] = state_ & flag_;
+    halGpioWrite(gpio_, state_ & flag_);
 #endif
 }
 
 void Buzzer::On() {
+    EVENT_LOG_RECORD(EVENT_BUZZER_ON);
     flag_ = BUZZER_MASK;
     mode_ = CONTINUOUS;
-    SysTick_Config(SYSTICK_COUNTER);
+    halSysTickStart(SYSTICK_COUNTER);
 }
 
 void Buzzer::Off() {
-    SysTick->CTRL = 0;
+    EVENT_LOG_RECORD(EVENT_BUZZER_OFF);
+    halSysTickStop();
     flag_ = 0;
     mode_ = OFF;
-    LPC_GPIO_PORT->B0[gpio_] = 0;
+    interrupt_beep_ = false;
+    halGpioWrite(gpio_, 0);
 }
 
 void Buzzer::Beep() {
+    LATENCY_MARK(LATENCY_BEEP);
+    EVENT_LOG_RECORD(EVENT_BUZZER_ON);
     flag_   = BUZZER_MASK;
     delay_  = BEEP_DELAY;
     mode_   = BEEP;
-    SysTick_Config(SYSTICK_COUNTER);
+    halSysTickStart(SYSTICK_COUNTER);
+}
+
+void Buzzer::KeyBeep() {
+    if (interrupt_beep_) {
+        interrupt_beep_ = false;
+    }
+    else {
+        Beep();
+    }
+}
+
+void Buzzer::CancelKeyBeep() {
+    if (interrupt_beep_) {
+        Off();
+    }
+}
+
+void Buzzer::InterruptBeep() {
+    for (int i = 0; i < buzzer_instance_count; i++) {
+        Buzzer* buzzer = buzzer_instances[i];
+        if (buzzer->mode_ == OFF) {
+            buzzer->Beep();
+            buzzer->interrupt_beep_ = true;
+        }
+    }
 }
 
 void Buzzer::Beeps() {
+    EVENT_LOG_RECORD(EVENT_BUZZER_ON);
     flag_   = BUZZER_MASK;
     delay_  = BEEP_DELAY;
     mode_   = BEEPS;
-    SysTick_Config(SYSTICK_COUNTER);
+    halSysTickStart(SYSTICK_COUNTER);
 }
 
@@ -27,6 +27,14 @@ class Buzzer {
         void Beep();
         void Beeps();
         
+        // Beep for a key press, unless one started from the button
+        // interrupt is still sounding
+        void KeyBeep();
+        void CancelKeyBeep();
+        
+        // Start a key beep on any idle buzzer, from an interrupt handler
+        static void InterruptBeep();
+        
     private:
         enum Mode {
             OFF,
@@ -40,6 +48,7 @@ class Buzzer {
         uint8_t     gpio_;
         uint8_t     flag_;
         uint8_t     state_;
+        bool        interrupt_beep_;
         Mode        mode_;
         uint32_t    delay_;
         
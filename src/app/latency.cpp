@@ -0,0 +1,148 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Input latency tracing implementation
+ *
+ * A trace starts at a button interrupt and records the time to the first
+ * occurrence of each stage, until the display has been flushed after the
+ * state was dispatched. Interrupts during a trace, such as further presses
+ * in a chord, don't restart it. Input that is never dispatched, such as the
+ * press that wakes the timer, aborts its trace.
+ */
+ 
+#include "latency.h"
+
+#if defined(LATENCY_TRACE)
+
+#include "hal/hal.h"
+#include "util/timers.h"
+
+// Histogram bucket n counts latencies below 2^(n + 1 + LATENCY_HIST_SHIFT)
+// ticks, and the last everything longer. At 12MHz the bounds run from 0.68ms
+// to 87ms, so a whole chord window shows up.
+#define LATENCY_HIST_SHIFT      12
+#define LATENCY_HIST_BUCKETS    9
+
+struct LatencyStats {
+    uint32_t    min;
+    uint32_t    max;
+    uint32_t    total;
+    uint16_t    count;
+    uint8_t     histogram[LATENCY_HIST_BUCKETS];    // saturating
+};
+
+static LatencyStats     stats[LATENCY_STAGE_COUNT];
+static volatile bool    tracing = false;
+static volatile uint32_t trace_start;
+static uint8_t          stages_seen;
+
+static void markerToggle() {
+#if defined(LATENCY_MARKER_GPIO)
+    halGpioToggle(LATENCY_MARKER_GPIO);
+#endif
+}
+
+void latencyInit() {
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        stats[i].min = 0xffffffff;
+    }
+    
+#if defined(LATENCY_MARKER_GPIO)
+    halGpioSetOutput(LATENCY_MARKER_GPIO);
+#endif
+}
+
+void latencyStart() {
+    if (!tracing) {
+        trace_start = timersNow();
+        stages_seen = 0;
+        tracing     = true;
+        markerToggle();
+    }
+}
+
+void latencyMark(LatencyStage stage) {
+    if (!tracing || (stages_seen & (1 << stage))) {
+        return;
+    }
+    
+    // A flush only ends the trace once there was something to show
+    if (stage == LATENCY_FLUSHED && !(stages_seen & (1 << LATENCY_DISPATCH))) {
+        return;
+    }
+    
+    uint32_t ticks = timersSince(trace_start);
+    LatencyStats& s = stats[stage];
+    
+    stages_seen |= 1 << stage;
+    markerToggle();
+    
+    if (ticks < s.min) {
+        s.min = ticks;
+    }
+    if (ticks > s.max) {
+        s.max = ticks;
+    }
+    s.total += ticks;
+    s.count++;
+    
+    int bucket = 0;
+    for (uint32_t t = ticks >> (LATENCY_HIST_SHIFT + 1); t && bucket < LATENCY_HIST_BUCKETS - 1; t >>= 1) {
+        bucket++;
+    }
+    if (s.histogram[bucket] < 0xff) {
+        s.histogram[bucket]++;
+    }
+    
+    if (stage == LATENCY_FLUSHED) {
+        tracing = false;
+    }
+}
+
+void latencyAbort() {
+    if (tracing) {
+        tracing = false;
+        markerToggle();
+    }
+}
+
+#if defined(DEBUG)
+#include "stdio.h"
+
+extern void reportValue(const char* msg, uint32_t value);
+
+static const char* const stage_names[LATENCY_STAGE_COUNT] = {
+    "read",
+    "dispatch",
+    "beep",
+    "flushed",
+};
+
+#define TICKS_PER_US    (TIMERS_TICKS_PER_MS / 1000)
+#endif
+
+void latencyReport() {
+#if defined(DEBUG)
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        LatencyStats& s = stats[i];
+        
+        if (s.count) {
+            puts(stage_names[i]);
+            reportValue(" count", s.count);
+            reportValue(" min us", s.min / TICKS_PER_US);
+            reportValue(" avg us", s.total / s.count / TICKS_PER_US);
+            reportValue(" max us", s.max / TICKS_PER_US);
+            for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+                reportValue(" hist", s.histogram[b]);
+            }
+        }
+    }
+#endif
+}
+
+#endif // #if defined(LATENCY_TRACE)
@@ -0,0 +1,52 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Input latency tracing
+ *
+ * Define LATENCY_TRACE in the Makefile to time each stage of the input path
+ * from the button interrupt, keeping min/avg/max and a log2 histogram per
+ * stage. Without it the macros below compile to nothing.
+ *
+ * Define LATENCY_MARKER_GPIO as a spare GPIO to also toggle it at every
+ * stage, for correlation on a scope.
+ */
+ 
+#if !defined(__LATENCY_H__)
+#define __LATENCY_H__
+
+#include "lpc_types.h"
+
+enum LatencyStage {
+    LATENCY_READ,           // expander read complete
+    LATENCY_DISPATCH,       // changed state passed to the controller
+    LATENCY_BEEP,           // beep started
+    LATENCY_FLUSHED,        // display flush complete; ends the trace
+    LATENCY_STAGE_COUNT
+};
+
+#if defined(LATENCY_TRACE)
+#define LATENCY_INIT()          latencyInit()
+#define LATENCY_START()         latencyStart()
+#define LATENCY_MARK(stage)     latencyMark(stage)
+#define LATENCY_ABORT()         latencyAbort()
+#define LATENCY_REPORT()        latencyReport()
+#else
+#define LATENCY_INIT()
+#define LATENCY_START()
+#define LATENCY_MARK(stage)
+#define LATENCY_ABORT()
+#define LATENCY_REPORT()
+#endif
+
+extern void latencyInit();
+extern void latencyStart();                 // from the button interrupt
+extern void latencyMark(LatencyStage stage);
+extern void latencyAbort();                 // drop the trace, e.g. for input that is discarded
+extern void latencyReport();                // over serial, with DEBUG
+
+#endif // #if !defined(__LATENCY_H__)
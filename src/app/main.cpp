@@ -25,38 +25,46 @@
 // Debugging mode means
 //  Switch Buzzer connection to UART TXD
 
-#include "string.h"
-#include "serial.h"
-
-#include "lpc_types.h"
-#include "romapi_8xx.h"
+#include "stdio.h"
 
+#include "hal/hal.h"
 #include "util/timers.h"
 #include "util/lcd.h"
 #include "util/mrt_interrupt.h"
+#include "util/power.h"
+#include "util/event_log.h"
+#include "util/profile.h"
 
 #include "timer_controller.h"
 #include "buzzer.h"
 #include "backlight.h"
 #include "button_input.h"
+#include "latency.h"
+#include "session_log.h"
+
+
+// Define DEBUG in the Makefile to add debugging aids in code, and configure
+// UART output to replace buzzer control
 
+// Define BEEP_ON_INTERRUPT in the Makefile to start key beeps from the button
+// interrupt, ahead of waking up and reading the buttons over I2C
 
-// Set this define to add debugging aids in code, and configure UART
-// output to replace buzzer control
-//#define DEBUG
+// Define LCD_OFF_WHILE_RUNNING in the Makefile to power the LCD down once the
+// backlight times out, even while timers are running; it is re-initialised
+// and repainted on the next button press or alarm
 
 #define LOOP_STEP_MS        64
+#define LCD_WAKE_BUDGET_MS  200
+#define LCD_RESTART_MS      120
+#define LCD_ON_UA           3957    // display draw without backlight, as in sim/energy.conf
+#define INPUT_LATENCY_BUDGET_MS 5
 #define BUZZER_GPIO         4
+#define LCD_POWER_GPIO      0
 #define INPUT_I2C_ADDR      0x20
-
-uint32_t SystemMainClock = FIXED_CLOCK_RATE_HZ;
-uint32_t SystemCoreClock = FIXED_CLOCK_RATE_HZ;
+#define I2C_BITRATE_HZ      100000
 
 const char hexdigit[] = "0123456789abcdef";
 
-uint32_t i2cBuffer [24];
-I2C_HANDLE_T* ih;
-
 void error(const char* msg) {
     puts("\n**ERROR: ");
     puts(msg);
@@ -74,78 +82,149 @@ void errorWithCode(const char* msg, int code) {
     putchar('\n');
 }
 
-static void i2cSetup () {
-    LPC_SWM->PINENABLE0 |= 3<<2;            // disable SWCLK and SWDIO
+#if defined(DEBUG)
+static const uint32_t decimal_powers[] = {
+    1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1
+};
 
-    // Keep internal pull-ups on I2C pins, as this works and is less
-    // power draining when LCD off and in low power state
+// Print a labelled value in decimal, without needing division
+void reportValue(const char* msg, uint32_t value) {
+    bool leading = true;
     
-    LPC_SWM->PINASSIGN7 = 0x02FFFFFF;       // SDA on P2, pin 4
-    LPC_SWM->PINASSIGN8 = 0xFFFFFF03;       // SCL on P3, pin 3
-    LPC_SYSCON->SYSAHBCLKCTRL |= (1<<5);    // enable I2C clock
-
-    ih = LPC_I2CD_API->i2c_setup(LPC_I2C_BASE, i2cBuffer);
-    if (ih == NULL)
-        error("i2c_setup");
+    while (*msg) {
+        putchar(*msg++);
+    }
+    putchar(' ');
+    
+    for (int i = 0; i < 10; i++) {
+        char digit = '0';
         
-    if (LPC_I2CD_API->i2c_set_bitrate(ih, 12000000, 100000) != LPC_OK)
-        error("i2c_set_bitrate");
-
-    if (LPC_I2CD_API->i2c_set_timeout(ih, 100000) != LPC_OK)
-        error("i2c_set_timeout");
-}
-
-static void configureLowPowerPins() {
-    // Set PIO0_10 and 11 as low outputs, as they float.
-    // This saves some power
-    LPC_GPIO_PORT->DIR0 |= 3 << 10;
-    LPC_GPIO_PORT->CLR0  = 3 << 10;
+        while (value >= decimal_powers[i]) {
+            value -= decimal_powers[i];
+            digit++;
+        }
+        
+        if (digit != '0' || !leading || i == 9) {
+            putchar(digit);
+            leading = false;
+        }
+    }
+    putchar('\n');
 }
+#endif
 
-static void deepSleep() {
-    LPC_SYSCON->STARTERP0   = 0x01; // pin interrupt 0 will wakeup 
-    LPC_PMU->PCON           = 0x01; // select deep sleep
-    SCB->SCR                = SCB_SCR_SLEEPDEEP_Msk;
-    __WFI();
-    LPC_PMU->PCON           = 0;
-    SCB->SCR                = 0;
+static void i2cSetup () {
+    const char* failed = halI2cInit(I2C_BITRATE_HZ);
+    if (failed)
+        error(failed);
 }
 
-static void powerDown() {
-    LPC_SYSCON->STARTERP0   = 0x01; // pin interrupt 0 will wakeup 
-    LPC_PMU->PCON           = 0x02; // select power down
-    SCB->SCR                = SCB_SCR_SLEEPDEEP_Msk;
-    __WFI();
-    LPC_PMU->PCON           = 0;
-    SCB->SCR                = 0;
-}
+static bool lcdPowered = true;
 
 static void lcdPowerOn() {
-    LPC_GPIO_PORT->B0[0] = 1;
+    halGpioWrite(LCD_POWER_GPIO, 1);
+    lcdPowered = true;
 }
 
 static void lcdPowerOff() {
-    LPC_GPIO_PORT->B0[0] = 0;
+    lcdSuspend();
+    halGpioWrite(LCD_POWER_GPIO, 0);
+    lcdPowered = false;
 }
 
 static void initLcdPowerSwitch() {
-    LPC_SWM->PINASSIGN0 |= 0xff00;          // ensure pin 8 is not assigned to UART RXD  
-    LPC_GPIO_PORT->DIR0 |= 1;               // set GPIO 0 output (to control LCD power)
+    halGpioSetOutput(LCD_POWER_GPIO);       // to control LCD power
     lcdPowerOn();
 }
 
-int main () {
+#if defined(LCD_OFF_WHILE_RUNNING)
+static uint32_t lcdWakeMaxTicks = 0;
+static uint32_t lcdWakeStart    = 0;
+static bool     lcdWaking       = false;
+
+// Power up and re-initialise the LCD; both that and the repaint go out
+// through the stepped flush
+static void lcdWake(TimerController& timer_controller) {
+    lcdWakeStart = timersNow();
+    lcdWaking    = true;
+    
+    lcdPowerOn();
+    lcdInit();
+    timer_controller.ForceUpdate();
+}
+
+// Once the repaint is out, track the worst case time taken against its budget
+static void lcdWakeDone() {
+    if (!lcdWaking) {
+        return;
+    }
+    lcdWaking = false;
+    
+    uint32_t ticks = timersSince(lcdWakeStart);
+    if (ticks > lcdWakeMaxTicks) {
+        lcdWakeMaxTicks = ticks;
+#if defined(DEBUG)
+        reportValue("lcd wake max ms", ticks / TIMERS_TICKS_PER_MS);
+#endif
+    }
+    
+    if (ticks > LCD_WAKE_BUDGET_MS * TIMERS_TICKS_PER_MS) {
+        error("lcd wake budget");
+    }
+}
+#endif
+
+// Display output is flushed a cell at a time, so button interrupts should
+// be serviced within budget whatever the display is doing
+static void reportInputLatency() {
+#if defined(DEBUG)
+    uint32_t ticks = ButtonInput::GetMaxLatencyTicks();
+    reportValue("input latency max us", ticks / (TIMERS_TICKS_PER_MS / 1000));
+    if (ticks > INPUT_LATENCY_BUDGET_MS * TIMERS_TICKS_PER_MS) {
+        puts("input latency over budget");
+    }
+#endif
+}
+
+// Residency, wake sources and the chip's charge they add up to; the LCD and
+// backlight are not included
+static void reportPower() {
 #if defined(DEBUG)
-    // Ensure UART TXD is on 
-    LPC_SWM->PINASSIGN0 &= 0xffffff00;
-    LPC_SWM->PINASSIGN0 |= 0x00000004;
-#else
-    LPC_SWM->PINASSIGN0 |= 0xff;
+    static const char* const mode_names[POWER_MODE_COUNT] = { "active", "sleep", "deep sleep", "power down" };
+    static const char* const wake_names[POWER_WAKE_COUNT] = { " pin wakes", " mrt wakes", " systick wakes", " wkt wakes", " other wakes" };
+    uint32_t charge_uas = 0;
+    
+    for (int i = 0; i < POWER_MODE_COUNT; i++) {
+        uint32_t ms = powerGetResidencyMs((PowerMode)i);
+        uint32_t ua = powerGetModeUa((PowerMode)i);
+        
+        puts(mode_names[i]);
+        reportValue(" entries", powerGetEntries((PowerMode)i));
+        reportValue(" ms", ms);
+        charge_uas += (ms / 1000) * ua + (ms % 1000) * ua / 1000;
+    }
+    
+    for (int i = 0; i < POWER_WAKE_COUNT; i++) {
+        reportValue(wake_names[i], powerGetWakes((PowerWake)i));
+    }
+    
+    reportValue("charge uAs", charge_uas);
+    reportValue("charge uAh", charge_uas / 3600);
 #endif
+}
+
+// Everything measured so far, over serial with DEBUG
+void dumpDiagnostics() {
+    reportInputLatency();
+    LATENCY_REPORT();
+    PROFILE_REPORT();
+    reportPower();
+}
 
-    configureLowPowerPins(); 
+int main () {
+    halBoardInit();
     timersInit();
-    serial.init(LPC_USART0, FIXED_UART_BAUD_RATE);
+    powerInit();
     delayMs(100);
     puts("Smart Timer");
     i2cSetup();
@@ -156,6 +235,8 @@ int main () {
     Timer::Initialise();
     Backlight::Initialise();
     ButtonInput::Initialise();
+    LATENCY_INIT();
+    PROFILE_INIT();
 
     lcdInit();
     
@@ -168,32 +249,105 @@ int main () {
     backlight.DelayedOff(BACKLIGHT_ON_TIME_MS);
     
     while (true) {
+#if defined(LCD_OFF_WHILE_RUNNING)
+        bool input = button_input.HasButtonStateChanged() || button_input.HasButtonRepeated();
+#endif
+        
         while (button_input.HasButtonStateChanged()) {
-            timer_controller.ProcessButtons(button_input.GetButtonStates());
+            uint8_t button_state = button_input.GetButtonStates();
+#if defined(BEEP_ON_INTERRUPT)
+            if (button_input.WasReleaseOnly()) {
+                buzzer.CancelKeyBeep();
+            }
+#endif
+            timer_controller.ProcessButtons(button_state);
         }
-
-        timer_controller.Update();
         
-        if (!button_input.HasButtonStateChanged()) {
-            if (timer_controller.IsIdle() && !backlight.IsOn()) {
-                lcdPowerOff();
-                powerDown();
+        if (button_input.HasButtonRepeated()) {
+            uint8_t step = button_input.GetRepeatStep();
+            timer_controller.ProcessRepeat(button_input.GetButtonStates(), step);
+        }
+
+#if defined(LCD_OFF_WHILE_RUNNING)
+        // Input or an alarm needs the display back, once the input is handled
+        if (!lcdPowered && (input || backlight.IsOn())) {
+            lcdWake(timer_controller);
+        }
+#endif
 
-                lcdPowerOn();
-                delayMs(10);
+        if (lcdPowered) {
+            timer_controller.Update();
+            
+            // Send the frame a cell at a time, giving way to input between cells
+            while (!button_input.HasButtonStateChanged() && lcdFlushStep()) {
+            }
+            
+            if (!lcdIsFlushPending()) {
+                LATENCY_MARK(LATENCY_FLUSHED);
+#if defined(LCD_OFF_WHILE_RUNNING)
+                lcdWakeDone();
+#endif
+            }
+        }
+        
+        if (!button_input.HasButtonStateChanged() && !button_input.HasButtonRepeated()) {
+            PowerMode mode = POWER_SLEEP;
+            
+            if (timer_controller.IsIdle() && button_input.IsIdle() && !backlight.IsOn()) {
+                // Power-down also turns the LCD off, saving its draw, so has
+                // its restart to repay
+                mode = powerSelectMode(LCD_RESTART_MS, LCD_ON_UA);
+            }
+            
+            if (mode != POWER_SLEEP) {
+                timer_controller.ReportFrameStats();
+                dumpDiagnostics();
+                EVENT_LOG_DRAIN(true);
+                SESSION_LOG_DRAIN(true);
                 
-                backlight.On();
-                buzzer.Beep();
+                if (mode == POWER_DOWN) {
+                    lcdPowerOff();
+                }
                 
+                powerEnter(mode);
+                
+                // A deep-sleep that ran out just goes on into power-down
+                if (powerGetWakeSource() == POWER_WAKE_WKT) {
+                    continue;
+                }
+                
+                PROFILE_ENTER(PROFILE_WAKE);
+
+                if (mode == POWER_DOWN) {
+                    lcdPowerOn();
+                }
+                
+                // The wake press isn't dispatched; drop it before its beep
+                // counts towards the latency trace
                 if (button_input.HasButtonStateChanged()) {
                     button_input.DiscardNextState();
                 }
                 
-                lcdInit();
-                timer_controller.ForceUpdate();
+                backlight.On();
+                buzzer.KeyBeep();
+                
+                if (mode == POWER_DOWN) {
+                    lcdInit();
+                    timer_controller.ForceUpdate();
+                }
+                PROFILE_EXIT(PROFILE_WAKE);
             }
+#if defined(LCD_OFF_WHILE_RUNNING)
+            else if (lcdPowered && !backlight.IsOn()) {
+                // Timers keep running with their state in RAM; nobody is watching
+                lcdPowerOff();
+                powerEnter(POWER_SLEEP);
+            }
+#endif
             else {
-                __WFI();
+                EVENT_LOG_DRAIN(false);
+                SESSION_LOG_DRAIN(false);
+                powerEnter(POWER_SLEEP);
             }
         }
     }
@@ -0,0 +1,87 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Button session recording
+ *
+ * Entries are timed on the power module's uptime, which carries on through
+ * deep-sleep and power-down, so the gaps between presses are kept however
+ * the device idled. They're only recorded from the main loop, so the ring
+ * buffer needs no locking. When it is full new entries are dropped, and the
+ * next one recorded carries an overflow delay.
+ */
+
+#include "stdio.h"
+
+#include "session_log.h"
+#include "util/power.h"
+
+#if defined(SESSION_LOG)
+
+#define SESSION_LOG_SIZE    32      // power of 2
+
+static uint32_t entries[SESSION_LOG_SIZE];
+static uint8_t  head = 0;           // next to write
+static uint8_t  tail = 0;           // next to read
+static bool     overflowed = false;
+static uint8_t  last_buttons = 0;
+static uint32_t last_ms = 0;
+
+static bool push(uint8_t buttons, uint32_t delay) {
+    uint8_t next = (head + 1) & (SESSION_LOG_SIZE - 1);
+    
+    if (next == tail) {
+        return false;
+    }
+    
+    entries[head] = ((uint32_t)buttons << SESSION_BUTTONS_SHIFT) | delay;
+    head = next;
+    return true;
+}
+
+void sessionLogRecord(uint8_t buttons) {
+    uint32_t now = powerGetUptimeMs();
+    uint32_t delay = now - last_ms;
+    
+    if (overflowed) {
+        // The delay is unknown, so the replay picks up from here
+        if (push(buttons, SESSION_OVERFLOW)) {
+            overflowed = false;
+        }
+    }
+    else {
+        while (delay > SESSION_DELAY_MAX && push(last_buttons, SESSION_DELAY_MAX)) {
+            delay -= SESSION_DELAY_MAX;
+        }
+        
+        overflowed = delay > SESSION_DELAY_MAX || !push(buttons, delay);
+    }
+    
+    last_buttons = buttons;
+    last_ms = now;
+}
+
+void sessionLogDrain(bool all) {
+    static const char hex[] = "0123456789abcdef";
+    
+    if (!all && ((head - tail) & (SESSION_LOG_SIZE - 1)) < SESSION_LOG_SIZE / 2) {
+        return;
+    }
+    
+    while (tail != head) {
+        uint32_t entry = entries[tail];
+        tail = (tail + 1) & (SESSION_LOG_SIZE - 1);
+        
+        putchar('$');
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            putchar(hex[(entry >> shift) & 0x0f]);
+        }
+        putchar('\n');
+    }
+}
+
+#endif // #if defined(SESSION_LOG)
@@ -0,0 +1,43 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Button session recording
+ *
+ * Define SESSION_LOG in the Makefile to record each button state read from
+ * the expander, with the milliseconds since the one before, into a small
+ * buffer. It's drained over serial, with DEBUG, as lines of "$" and 8 hex
+ * digits: the buttons, then 24 bits of delay. A capture of these replays
+ * in the simulator (SIM_SESSION in sim/sim.cpp). Without it the macros
+ * compile to nothing.
+ */
+
+#if !defined(__SESSION_LOG_H__)
+#define __SESSION_LOG_H__
+
+#include "lpc_types.h"
+
+#define SESSION_BUTTONS_SHIFT   24
+#define SESSION_DELAY_MASK      0x00ffffff
+#define SESSION_DELAY_MAX       0x00fffffe      // longer delays are split, repeating the buttons
+#define SESSION_OVERFLOW        0x00ffffff      // as the delay: entries were lost before this one
+
+#if defined(SESSION_LOG)
+#define SESSION_LOG_RECORD(buttons) sessionLogRecord(buttons)
+#define SESSION_LOG_DRAIN(all)      sessionLogDrain(all)
+#else
+#define SESSION_LOG_RECORD(buttons)
+#define SESSION_LOG_DRAIN(all)
+#endif
+
+extern void sessionLogRecord(uint8_t buttons);
+
+// Send buffered entries over serial; unless all is set, only once the
+// buffer is half full
+extern void sessionLogDrain(bool all);
+
+#endif // #if !defined(__SESSION_LOG_H__)
@@ -12,13 +12,22 @@
 #include "timer.h"
 
 #include "stdio.h"
-#include "LPC8xx.h"
+#include "hal/hal.h"
 #include "util/lcd.h"
 #include "util/mrt_interrupt.h"
+#include "util/timers.h"
+#include "util/event_log.h"
+#include "util/profile.h"
 #include "timer_controller.h"
 
+#if defined(DEBUG)
+extern void reportValue(const char* msg, uint32_t value);
+#endif
+
 #define MAX_TIMER_INSTANCES     2
 #define MRT_TIMER               1
+#define TICK_INTERVAL           FIXED_CLOCK_RATE_HZ
+#define FAST_TICK_INTERVAL      (FIXED_CLOCK_RATE_HZ / 10)
 #define TIME_TEXT_BUFFER_LEN    8
 #define MAX_HOURS               9
 #define MAX_MINUTES             59
@@ -46,12 +55,75 @@ void Time2DigitsToAscii(uint8_t byte, char* str) {
 static int      timer_instance_count = 0;
 static Timer*   timer_instances[MAX_TIMER_INSTANCES];
 
+// Ticks run at 1Hz, or at 10Hz while a stopwatch is running
+static bool     fast_tick   = false;
+static uint8_t  tick_phase  = 0;    // tenths into the current second when ticking fast
+
 void TimerInterruptHandler(void) {
-    for (int i = 0; i < timer_instance_count; i++) {
-        timer_instances[i]->Tick();
+    bool second = true;
+    bool stopwatch_running = false;
+    bool active = false;
+    
+    EVENT_LOG_RECORD(EVENT_TICK);
+    
+    if (fast_tick) {
+        if (++tick_phase > 9) {
+            tick_phase = 0;
+        }
+        second = (tick_phase == 0);
+    }
+    
+    // Tick in reverse order: a timer started when an earlier one expires
+    // (chained mode) then counts its first second from this tick
+    for (int i = timer_instance_count - 1; i >= 0; i--) {
+        timer_instances[i]->Tick(second);
+        stopwatch_running |= timer_instances[i]->IsStopwatchRunning();
+        active |= !timer_instances[i]->IsStopped();
+    }
+    
+    // Stop ticking while there's nothing to count, leaving no deadline to
+    // keep the chip out of its deeper sleep modes
+    if (!active) {
+        halMrtLoad(MRT_TIMER, 0);
+        fast_tick = false;
+        return;
+    }
+    
+    // Drop back to 1Hz on a second boundary once no stopwatch needs tenths
+    if (fast_tick && second && !stopwatch_running) {
+        halMrtLoad(MRT_TIMER, TICK_INTERVAL);
+        fast_tick = false;
     }
 }
 
+// Restart the tick if it stopped while all timers were idle
+static void startTick() {
+    if (!halMrtIsRunning(MRT_TIMER)) {
+        halMrtLoad(MRT_TIMER, TICK_INTERVAL);
+    }
+}
+
+// Switch to 10Hz ticks without moving the second boundaries count-down
+// timers tick on: the first fast tick ends the tenth already under way,
+// and the tenths before it are counted into the phase
+static void startFastTick() {
+    halIrqDisable();
+    if (!fast_tick) {
+        uint32_t elapsed = TICK_INTERVAL - halMrtRemaining(MRT_TIMER);
+        
+        tick_phase = 0;
+        while (elapsed >= FAST_TICK_INTERVAL) {
+            elapsed -= FAST_TICK_INTERVAL;
+            tick_phase++;
+        }
+        
+        halMrtLoad(MRT_TIMER, FAST_TICK_INTERVAL - elapsed);
+        halMrtSetInterval(MRT_TIMER, FAST_TICK_INTERVAL);
+        fast_tick = true;
+    }
+    halIrqEnable();
+}
+
 //----------------------------------------------------------------------------------------
 // Class implementation
 //
@@ -64,8 +136,11 @@ Timer::Timer(TimerController& controller) : controller_(controller) {
     y_ = 0;
 
     state_ = STOPPED;
-    update_ = false;
+    update_ = UPDATE_NONE;
     visible_ = true;
+    stopwatch_ = false;
+    coarse_ = false;
+    drawn_coarse_ = false;
     
     if (timer_instance_count < MAX_TIMER_INSTANCES) {
         timer_instances[timer_instance_count++] = this;
@@ -73,28 +148,82 @@ Timer::Timer(TimerController& controller) : controller_(controller) {
 }
 
 void Timer::Initialise() {
-    // Set up a repeating 1 second timer interrupt on MRT channel 0
-    LPC_MRT->Channel[MRT_TIMER].CTRL    = 0x01;
-    LPC_MRT->Channel[MRT_TIMER].INTVAL  = SystemCoreClock | (1 << 31);
+    // Set up a repeating 1 second timer interrupt on MRT channel 1, started
+    // when a timer first runs
+    halMrtSetMode(MRT_TIMER, HAL_MRT_REPEAT | HAL_MRT_INTERRUPT);
     mrt_interrupt_set_timer_callback(MRT_TIMER, TimerInterruptHandler);
 }
 
+// Counts a frame request when the timer goes from drawn to needing a redraw
+void Timer::RequestUpdate(uint8_t update) {
+    if (update_ == UPDATE_NONE) {
+        controller_.RequestFrame();
+    }
+    update_ |= update;
+}
+
 void Timer::SetCoords(uint8_t x, uint8_t y) {
     x_ = x;
     y_ = y;
 }
 
+// Coarse display shows a running count-down as H:MM, redrawn once a minute,
+// for when nobody is watching. It's redrawn only when that changes what's
+// shown, so stopped and idle timers aren't repainted as the backlight goes
+// on and off.
+void Timer::SetCoarse(bool coarse) {
+    coarse_ = coarse;
+    
+    if (IsCoarse() != drawn_coarse_) {
+        RequestUpdate(UPDATE_ALL);
+    }
+}
+
+bool Timer::IsCoarse() {
+    return coarse_ && !stopwatch_ && state_ == RUNNING && (current_time_.hours || current_time_.minutes);
+}
+
 void Timer::ToggleStartStop() {
     if (state_ == ALARM) {
         Reset();
     }
     else if (state_ != RUNNING) {
-        if (current_time_.all > 0) {
-            state_ = RUNNING;
+        if (current_time_.all == 0) {
+            // Starting from zero runs a stopwatch, counting up in tenths
+            stopwatch_ = true;
+            RequestUpdate(UPDATE_ALL);
+        }
+        
+        state_ = RUNNING;
+        startTick();
+        
+        if (stopwatch_) {
+#if defined(DEBUG)
+            run_start_.all  = current_time_.all;
+            run_bus_ticks_  = lcdGetBusTicks();
+#endif
+            startFastTick();
         }
     }
     else {
         state_ = STOPPED;
+        
+        if (stopwatch_) {
+            ReportBusUse();
+        }
+    }
+}
+
+void Timer::Start() {
+    if (state_ == STOPPED && current_time_.all > 0) {
+        state_ = RUNNING;
+        startTick();
+    }
+}
+
+void Timer::Stop() {
+    if (state_ == RUNNING) {
+        state_ = STOPPED;
     }
 }
 
@@ -109,21 +238,22 @@ void Timer::Reset() {
     }
     
     current_time_.all   = start_time_.all;
-    update_             = true;
+    RequestUpdate(UPDATE_ALL);
     state_              = STOPPED;
     visible_            = true;
+    stopwatch_          = false;
 }
 
 void Timer::AddHour() {
     AddTime(1, 0, 0);
 }
 
-void Timer::AddMinute() {
-    AddTime(0, 1, 0);
+void Timer::AddMinute(uint8_t minutes) {
+    AddTime(0, minutes, 0);
 }
 
-void Timer::AddSecond() {
-    AddTime(0, 0, 1);
+void Timer::AddSecond(uint8_t seconds) {
+    AddTime(0, 0, seconds);
 }
 
 void Timer::AddTime(uint8_t hours, uint8_t minutes, uint8_t seconds) {
@@ -134,6 +264,10 @@ void Timer::AddTime(uint8_t hours, uint8_t minutes, uint8_t seconds) {
         Reset();
     }
     else {
+        // Adding time turns a stopwatch reading into a count-down
+        stopwatch_ = false;
+        current_time_.tenths = 0;
+        
         current_time_.hours += hours;
         current_time_.minutes += minutes;
         current_time_.seconds += seconds;
@@ -149,47 +283,103 @@ void Timer::AddTime(uint8_t hours, uint8_t minutes, uint8_t seconds) {
         }
         
         start_time_.all = current_time_.all;
-        update_ = true;
+        RequestUpdate(UPDATE_ALL);
     }
 }
 
-void Timer::Tick() {
+void Timer::Tick(bool second) {
     if (state_ == RUNNING) {
-        if (current_time_.seconds > 0) {
-            current_time_.seconds--;
-        }
-        else if (current_time_.minutes > 0) {
-            current_time_.seconds = 59;
-            current_time_.minutes--;
+        if (stopwatch_) {
+            CountUp();
         }
-        else if (current_time_.hours > 0) {
-            current_time_.seconds = 59;
-            current_time_.minutes = 59;
-            current_time_.hours--;
+        else if (second) {
+            CountDown();
         }
+    }
+    else if (state_ == ALARM && second) {
+        // Blink phase only: the controller blinks alarms without redrawing
+        visible_ = !visible_;
+        controller_.RequestFrame();
+    }
+}
+
+void Timer::CountUp() {
+    RequestUpdate(UPDATE_TENTHS);
+    
+    if (++current_time_.tenths > 9) {
+        current_time_.tenths = 0;
+        RequestUpdate(UPDATE_ALL);
         
-        if (current_time_.all == 0) {
-            state_ = ALARM;
-            controller_.Notify(*this, TimerController::ALARM_START);
+        if (++current_time_.seconds > MAX_SECONDS) {
+            current_time_.seconds = 0;
+            
+            if (++current_time_.minutes > MAX_MINUTES) {
+                current_time_.minutes = 0;
+                
+                if (++current_time_.hours > MAX_HOURS) {
+                    // Hold at the largest time that can be shown
+                    current_time_.hours     = MAX_HOURS;
+                    current_time_.minutes   = MAX_MINUTES;
+                    current_time_.seconds   = MAX_SECONDS;
+                    current_time_.tenths    = 9;
+                    state_                  = STOPPED;
+                }
+            }
         }
-        
-        update_ = true;
     }
-    else if (state_ == ALARM) {
-        visible_ = !visible_;
-        update_ = true;
+}
+
+void Timer::CountDown() {
+    bool minute_changed = (current_time_.seconds == 0);
+    
+    if (current_time_.seconds > 0) {
+        current_time_.seconds--;
     }
+    else if (current_time_.minutes > 0) {
+        current_time_.seconds = 59;
+        current_time_.minutes--;
+    }
+    else if (current_time_.hours > 0) {
+        current_time_.seconds = 59;
+        current_time_.minutes = 59;
+        current_time_.hours--;
+    }
+    
+    if (current_time_.all == 0) {
+        state_ = ALARM;
+        controller_.Notify(*this, TimerController::ALARM_START);
+    }
+    
+    if (minute_changed || !IsCoarse()) {
+        RequestUpdate(UPDATE_ALL);
+    }
+}
+
+void Timer::ReportBusUse() {
+#if defined(DEBUG)
+    // LCD bus time as a percentage of the stopwatch run just ended
+    uint32_t run_tenths = ToTenths(current_time_) - ToTenths(run_start_);
+    if (run_tenths) {
+        reportValue("stopwatch bus %", (lcdGetBusTicks() - run_bus_ticks_) / (run_tenths * (FIXED_CLOCK_RATE_HZ / 1000)));
+    }
+#endif
+}
+
+#if defined(DEBUG)
+uint32_t Timer::ToTenths(const TimeVal& time) {
+    return ((time.hours * 60 + time.minutes) * 60 + time.seconds) * 10 + time.tenths;
 }
+#endif
 
 static const char barChars[] = { 0x20, 0x08, 0x09, 0x0a, 0x0b, 0x0c };
 
-void Timer::DrawBar(uint8_t x, uint8_t y, uint8_t val)
+void Timer::DrawBar(uint8_t x, uint8_t y, uint8_t val, char full_char)
 {
     int barCharCount = 0;
     lcdMoveTo(x, y);
     
     while (val >= 5) {
-        lcdPutchar(0x0c);
+        lcdPutchar(full_char);
         barCharCount++;
         val -= 5;
     }
@@ -204,44 +394,68 @@ void Timer::DrawBar(uint8_t x, uint8_t y, uint8_t val)
     }
 }
 
-void Timer::Update() {    
-    if (update_) {
+void Timer::Update() {
+    PROFILE_ENTER(PROFILE_TIMER_UPDATE);
+    uint8_t update = update_;
+    update_ = UPDATE_NONE;
+    
+    bool show_tenths = stopwatch_ && !current_time_.hours;
+    
+    if (update == UPDATE_TENTHS) {
+        // Only the tenths digit has changed, so only that cell is redrawn
+        if (show_tenths) {
+            lcdMoveTo(x_ + 6, y_);
+            lcdPutchar(current_time_.tenths + '0');
+        }
+    }
+    else if (update) {
         char time_text[TIME_TEXT_BUFFER_LEN];
         int barValue = 0;
+        
+        drawn_coarse_ = IsCoarse();
 
-        if (visible_) {        
+        if (show_tenths) {
+            Time2DigitsToAscii(current_time_.minutes, time_text);
+            time_text[2] = ':';
+            Time2DigitsToAscii(current_time_.seconds, time_text + 3);
+            time_text[5] = '.';
+            time_text[6] = current_time_.tenths + '0';
+        }
+        else {
             time_text[0] = current_time_.hours + '0';
             time_text[1] = ':';
             Time2DigitsToAscii(current_time_.minutes, time_text + 2);
-            time_text[4] = ':';
-            Time2DigitsToAscii(current_time_.seconds, time_text + 5);
             
-            if (state_ == ALARM) {
-                barValue = 35;
-            }
-            else if (current_time_.hours) {
-                barValue = current_time_.hours * 2;
-            }
-            else if (current_time_.minutes) {
-                barValue = (current_time_.minutes + 1) / 2;
+            if (drawn_coarse_) {
+                time_text[4] = ' ';
+                time_text[5] = ' ';
+                time_text[6] = ' ';
             }
             else {
-                barValue = (current_time_.seconds + 1) / 2;
+                time_text[4] = ':';
+                Time2DigitsToAscii(current_time_.seconds, time_text + 5);
             }
         }
+        
+        if (state_ == ALARM) {
+            barValue = 35;
+        }
+        else if (current_time_.hours) {
+            barValue = current_time_.hours * 2;
+        }
+        else if (current_time_.minutes) {
+            barValue = (current_time_.minutes + 1) / 2;
+        }
         else {
-            uint32_t* blank_text = (uint32_t*)time_text;
-            blank_text[0] = 0x20202020;
-            blank_text[1] = 0x20202020;
+            barValue = (current_time_.seconds + 1) / 2;
         }
         
         time_text[7] = '\0';
         lcdMoveTo(x_, y_);
         lcdPuts(time_text);
         
-        DrawBar(x_, y_ + 1, barValue);
-        
-        update_ = false;
+        // Alarms draw their bar with the blinkable glyph
+        DrawBar(x_, y_ + 1, barValue, state_ == ALARM ? ALARM_CHAR : 0x0c);
     }
+    PROFILE_EXIT(PROFILE_TIMER_UPDATE);
 }
-
@@ -14,6 +14,10 @@
 
 #include "lpc_types.h"
 
+// Full block drawn by alarming timers, blinked by changing its glyph
+#define ALARM_CHAR      0x0d
+#define ALARM_GLYPH     (ALARM_CHAR & 0x07)
+
 class TimerController;
 
 class Timer {
@@ -30,32 +34,55 @@ class Timer {
         static void Initialise();
         
         void SetCoords(uint8_t x, uint8_t y);
+        void SetCoarse(bool coarse);
         void ToggleStartStop();
+        void Start();
+        void Stop();
         void Clear();
         void Reset();
         void Update();
         void AddHour();
-        void AddMinute();
-        void AddSecond();
+        void AddMinute(uint8_t minutes = 1);
+        void AddSecond(uint8_t seconds = 1);
         
         bool IsStopped() { return state_ == STOPPED; }
-        void ForceUpdate() { update_ = true; }
+        bool IsRunning() { return state_ == RUNNING; }
+        bool IsAlarm() { return state_ == ALARM; }
+        bool IsVisible() { return visible_; }
+        bool IsStopwatchRunning() { return stopwatch_ && state_ == RUNNING; }
+        void ForceUpdate() { RequestUpdate(UPDATE_ALL); }
+        bool IsUpdatePending() { return update_ != UPDATE_NONE; }
 
     private:
-        void AddTime(uint8_t hours, uint8_t minutes, uint8_t seconds);
-        void Tick();
-        void DrawBar(uint8_t x, uint8_t y, uint8_t val);
+        enum UpdateFlags {
+            UPDATE_NONE     = 0,
+            UPDATE_TENTHS   = 1,
+            UPDATE_ALL      = 3
+        };
         
         union TimeVal {
             struct {
                 uint8_t hours;
                 uint8_t minutes;
                 uint8_t seconds;
-                uint8_t pad;
+                uint8_t tenths;     // stopwatch only
             };
             uint32_t all;
         };
         
+        void RequestUpdate(uint8_t update);
+        void AddTime(uint8_t hours, uint8_t minutes, uint8_t seconds);
+        void Tick(bool second);
+        void CountUp();
+        void CountDown();
+        bool IsCoarse();
+        void ReportBusUse();
+        void DrawBar(uint8_t x, uint8_t y, uint8_t val, char full_char);
+        
+#if defined(DEBUG)
+        static uint32_t ToTenths(const TimeVal& time);
+#endif
+        
         TimerController& controller_;
         TimeVal current_time_;
         TimeVal start_time_;
@@ -65,10 +92,21 @@ class Timer {
         
         State state_;
         
-        bool update_;
+        uint8_t update_;
         bool visible_;
+        bool stopwatch_;
+        bool coarse_;
+        bool drawn_coarse_;     // as last drawn
+        
+#if defined(DEBUG)
+        TimeVal run_start_;
+        uint32_t run_bus_ticks_;
+#endif
         
         friend void TimerInterruptHandler(void);
+
+        // Host soak test (sim/soak.cpp), checking invariants on the state
+        friend class TimerProbe;
 };
 
 #endif // if !defined(__TIMER_H__)
@@ -13,14 +13,98 @@
 
 #include "buzzer.h"
 #include "backlight.h"
+#include "util/lcd.h"
+#include "util/timers.h"
+#include "latency.h"
 
+#if defined(DEBUG)
+extern void reportValue(const char* msg, uint32_t value);
+extern void dumpDiagnostics();
+#endif
+
+// Button bits within each timer's nybble of the button state. The action
+// table below is built from these at compile time, so keys can be remapped
+// by changing these alone.
 #define BUTTON_H        0x08
 #define BUTTON_M        0x01
 #define BUTTON_S        0x02
 #define BUTTON_START    0x04
 
+#define BUTTONS_TIME    (BUTTON_H|BUTTON_M|BUTTON_S)
+
+// Chord across both timers: start1 + start2 toggles timer mode
+#define CHORD_MODE      ((BUTTON_START << 4) | BUTTON_START)
+
+// Chord across both timers: s1 + s2 dumps diagnostics over serial, with DEBUG
+#define CHORD_DIAGNOSTICS   ((BUTTON_S << 4) | BUTTON_S)
+
+#define MODE_X          8
+#define MODE_Y          0
+
+//----------------------------------------------------------------------------------------
+// Button decode: action for each (state, changed) pair of a timer's buttons
+//
+
+enum ButtonAction {
+    ACTION_NONE = 0,
+    ACTION_START_STOP,
+    ACTION_CLEAR,
+    ACTION_ADD_HOUR,
+    ACTION_ADD_MINUTE,
+    ACTION_ADD_SECOND
+};
+
+constexpr bool IsSingleTimeButton(uint8_t time_buttons) {
+    return time_buttons == BUTTON_H || time_buttons == BUTTON_M || time_buttons == BUTTON_S;
+}
+
+constexpr uint8_t DecodeTimeButtons(uint8_t time_buttons) {
+    return !IsSingleTimeButton(time_buttons)   ? ACTION_CLEAR :
+           time_buttons == BUTTON_H             ? ACTION_ADD_HOUR :
+           time_buttons == BUTTON_M             ? ACTION_ADD_MINUTE :
+                                                  ACTION_ADD_SECOND;
+}
+
+// Start with any of H, M, S is a chord that resets the timer, taking
+// priority over the individual buttons making it up
+constexpr bool IsResetChord(uint8_t button_state) {
+    return (button_state & BUTTON_START) && (button_state & BUTTONS_TIME);
+}
+
+constexpr uint8_t DecodeButtons(uint8_t button_state, uint8_t buttons_changed) {
+    return !(button_state & buttons_changed)                ? ACTION_NONE :
+           IsResetChord(button_state)                       ? ACTION_CLEAR :
+           (button_state & buttons_changed & BUTTON_START)  ? ACTION_START_STOP :
+                                                              DecodeTimeButtons(button_state & BUTTONS_TIME);
+}
+
+#define ACTION_INDEX(state, changed)    ((((state) & 0xf) << 4) | ((changed) & 0xf))
+
+#define ACTION(i)       DecodeButtons((i) >> 4, (i) & 0xf)
+#define ACTIONS4(i)     ACTION(i), ACTION(i + 1), ACTION(i + 2), ACTION(i + 3)
+#define ACTIONS16(i)    ACTIONS4(i), ACTIONS4(i + 4), ACTIONS4(i + 8), ACTIONS4(i + 12)
+#define ACTIONS64(i)    ACTIONS16(i), ACTIONS16(i + 16), ACTIONS16(i + 32), ACTIONS16(i + 48)
+
+static constexpr uint8_t button_actions[256] = {
+    ACTIONS64(0), ACTIONS64(64), ACTIONS64(128), ACTIONS64(192)
+};
+
+//----------------------------------------------------------------------------------------
+// Class implementation
+//
+
 TimerController::TimerController(Buzzer& buzzer, Backlight& backlight) : buzzer_(buzzer), backlight_(backlight), timer1_(*this), timer2_(*this){
-    last_buttons_ = 0;
+    last_buttons_   = 0;
+    mode_           = INDEPENDENT;
+    mode_update_    = true;
+    chain_second_   = false;
+    display_on_     = true;
+    alarm_glyph_on_ = true;
+    repeat_enabled_ = false;
+    repeating_      = false;
+    last_frame_     = 0;
+    frames_requested_ = 0;
+    frames_emitted_ = 0;
     timer1_.SetCoords(0, 0);
     timer1_.Reset();
     timer2_.SetCoords(9, 0);
@@ -28,13 +112,119 @@ TimerController::TimerController(Buzzer& buzzer, Backlight& backlight) : buzzer_
 }
 
 void TimerController::Update() {
+    // With the backlight off nobody is watching, so running timers only
+    // need redrawing once a minute
+    bool unattended = !backlight_.IsOn();
+    timer1_.SetCoarse(unattended);
+    timer2_.SetCoarse(unattended);
+    
+    if (!IsFramePending()) {
+        return;
+    }
+    
+    // Everything pending is coalesced into one frame at most every frame
+    // interval; held back further while auto-repeating so values stay readable
+    uint32_t interval = (repeating_ ? REPEAT_REDRAW_MS : FRAME_INTERVAL_MS) * TIMERS_TICKS_PER_MS;
+    if (timersSince(last_frame_) < interval) {
+        // The alarm wakes the main loop to flush the frame
+        timersSetAlarmAt(FRAME_ALARM, last_frame_ + interval);
+        return;
+    }
+    
+    EmitFrame();
+}
+
+void TimerController::ReportFrameStats() {
+#if defined(DEBUG)
+    reportValue("frames requested", frames_requested_);
+    reportValue("frames emitted", frames_emitted_);
+#endif
+}
+
+bool TimerController::IsFramePending() {
+    bool display_on;
+    bool alarm_glyph_on;
+    GetAlarmBlink(display_on, alarm_glyph_on);
+    
+    return timer1_.IsUpdatePending() || timer2_.IsUpdatePending() || mode_update_ ||
+           display_on != display_on_ || alarm_glyph_on != alarm_glyph_on_;
+}
+
+void TimerController::EmitFrame() {
+    timersCancelAlarm(FRAME_ALARM);
+    last_frame_ = timersNow();
+    frames_emitted_++;
+    
     timer1_.Update();
     timer2_.Update();
+    
+    if (mode_update_) {
+        lcdMoveTo(MODE_X, MODE_Y);
+        lcdPutchar(mode_ == CHAINED ? '>' : ' ');
+        mode_update_ = false;
+    }
+    
+    UpdateAlarmBlink();
+}
+
+// Alarms blink without rewriting any text: when both timers are alarming
+// the whole display is switched on and off, otherwise the glyph of the
+// alarming timer's bar is blanked and restored
+void TimerController::GetAlarmBlink(bool& display_on, bool& alarm_glyph_on) {
+    display_on = true;
+    alarm_glyph_on = true;
+    
+    if (timer1_.IsAlarm() && timer2_.IsAlarm()) {
+        display_on = timer1_.IsVisible();
+    }
+    else if (timer1_.IsAlarm()) {
+        alarm_glyph_on = timer1_.IsVisible();
+    }
+    else if (timer2_.IsAlarm()) {
+        alarm_glyph_on = timer2_.IsVisible();
+    }
+}
+
+void TimerController::UpdateAlarmBlink() {
+    bool display_on;
+    bool alarm_glyph_on;
+    GetAlarmBlink(display_on, alarm_glyph_on);
+    
+    if (display_on != display_on_) {
+        lcdDisplayEnable(display_on);
+        display_on_ = display_on;
+    }
+    
+    if (alarm_glyph_on != alarm_glyph_on_) {
+        lcdSetCustomChar(ALARM_GLYPH, alarm_glyph_on ? 0x1f : 0x00);
+        alarm_glyph_on_ = alarm_glyph_on;
+    }
 }
 
 void TimerController::ForceUpdate() {
     timer1_.ForceUpdate();
     timer2_.ForceUpdate();
+    SetModeUpdate();
+    
+    // As left by lcdInit
+    display_on_     = true;
+    alarm_glyph_on_ = true;
+    
+    // Draw at the next Update without waiting out the frame interval
+    last_frame_ = timersNow() - REPEAT_REDRAW_MS * TIMERS_TICKS_PER_MS;
+}
+
+void TimerController::SetModeUpdate() {
+    if (!mode_update_) {
+        RequestFrame();
+        mode_update_ = true;
+    }
+}
+
+void TimerController::ToggleMode() {
+    mode_           = mode_ == INDEPENDENT ? CHAINED : INDEPENDENT;
+    SetModeUpdate();
+    chain_second_   = false;
 }
 
 extern void errorWithCode(const char* msg, int code);
@@ -42,42 +232,45 @@ extern void errorWithCode(const char* msg, int code);
 void TimerController::ProcessButtons(uint8_t button_state) {
     uint8_t buttons_changed = button_state ^ last_buttons_;
     
-    ProcessTimerButtons(button_state >> 4, buttons_changed >> 4, timer1_);
-    ProcessTimerButtons(button_state & 0xf, buttons_changed & 0xf, timer2_);
+    if (buttons_changed) {
+        LATENCY_MARK(LATENCY_DISPATCH);
+    }
+    
+    // Only presses acted on (rather than waking the backlight) may auto-repeat
+    repeat_enabled_ = backlight_.IsOn();
+    repeating_      = false;
+    
+    if ((button_state & CHORD_MODE) == CHORD_MODE && (buttons_changed & CHORD_MODE)) {
+        // Chord replaces the start/stop actions of its individual buttons
+        buzzer_.KeyBeep();
+        if (backlight_.IsOn()) {
+            ToggleMode();
+        }
+        else {
+            backlight_.On();
+        }
+    }
+#if defined(DEBUG)
+    else if ((button_state & CHORD_DIAGNOSTICS) == CHORD_DIAGNOSTICS && (buttons_changed & CHORD_DIAGNOSTICS)) {
+        ReportFrameStats();
+        dumpDiagnostics();
+    }
+#endif
+    else {
+        ProcessTimerAction(button_actions[ACTION_INDEX(button_state >> 4, buttons_changed >> 4)], timer1_);
+        ProcessTimerAction(button_actions[ACTION_INDEX(button_state, buttons_changed)], timer2_);
+    }
     
     backlight_.DelayedOff(BACKLIGHT_ON_TIME_MS);
     
     last_buttons_ = button_state;
 }
 
-void TimerController::ProcessTimerButtons(uint8_t button_state, uint8_t buttons_changed, Timer& timer) {
-    uint8_t buttons_pressed = button_state & buttons_changed;
-    
-    if (buttons_pressed) {
-        buzzer_.Beep();
+void TimerController::ProcessTimerAction(uint8_t action, Timer& timer) {
+    if (action != ACTION_NONE) {
+        buzzer_.KeyBeep();
         if (backlight_.IsOn()) {
-            if (buttons_pressed & BUTTON_START) {
-                timer.ToggleStartStop();
-            }
-            else if (buttons_pressed & (BUTTON_H|BUTTON_M|BUTTON_S)) {
-                uint8_t time_buttons = button_state & (BUTTON_H|BUTTON_M|BUTTON_S);
-                if (time_buttons != BUTTON_H && time_buttons != BUTTON_M && time_buttons != BUTTON_S) {
-                    timer.Clear();
-                }
-                else {
-                    switch(time_buttons) {
-                        case BUTTON_H:
-                            timer.AddHour();
-                            break;
-                        case BUTTON_M:
-                            timer.AddMinute();
-                            break;
-                        case BUTTON_S:
-                            timer.AddSecond();
-                            break;
-                    }
-                }
-            }
+            DispatchAction(action, 1, timer);
         }
         else {
             backlight_.On();
@@ -85,9 +278,91 @@ void TimerController::ProcessTimerButtons(uint8_t button_state, uint8_t buttons_
     }    
 }
 
+void TimerController::ProcessRepeat(uint8_t button_state, uint8_t step) {
+    if (repeat_enabled_ && backlight_.IsOn()) {
+        repeating_ = true;
+        
+        RepeatTimerAction(button_actions[ACTION_INDEX(button_state >> 4, button_state >> 4)], step, timer1_);
+        RepeatTimerAction(button_actions[ACTION_INDEX(button_state, button_state)], step, timer2_);
+        
+        backlight_.DelayedOff(BACKLIGHT_ON_TIME_MS);
+    }
+}
+
+void TimerController::RepeatTimerAction(uint8_t action, uint8_t step, Timer& timer) {
+    // Only adding time repeats
+    if (action >= ACTION_ADD_HOUR) {
+        DispatchAction(action, step, timer);
+    }
+}
+
+void TimerController::DispatchAction(uint8_t action, uint8_t step, Timer& timer) {
+    if (mode_ == CHAINED && DispatchChainedAction(action, timer)) {
+        return;
+    }
+    
+    switch(action) {
+        case ACTION_START_STOP:
+            timer.ToggleStartStop();
+            break;
+        case ACTION_CLEAR:
+            timer.Clear();
+            break;
+        case ACTION_ADD_HOUR:
+            timer.AddHour();
+            break;
+        case ACTION_ADD_MINUTE:
+            timer.AddMinute(step);
+            break;
+        case ACTION_ADD_SECOND:
+            timer.AddSecond(step);
+            break;
+    }
+}
+
+// Chained mode: resets and stops apply to both timers, and start resumes
+// the chain at whichever timer it reached. Returns false if the action is
+// left to the individual timer.
+bool TimerController::DispatchChainedAction(uint8_t action, Timer& timer) {
+    if (timer.IsAlarm()) {
+        return false;
+    }
+    
+    if (action == ACTION_CLEAR) {
+        timer1_.Clear();
+        timer2_.Clear();
+        chain_second_ = false;
+    }
+    else if (timer1_.IsRunning() || timer2_.IsRunning()) {
+        timer1_.Stop();
+        timer2_.Stop();
+    }
+    else if (action == ACTION_START_STOP) {
+        if (chain_second_) {
+            timer2_.Start();
+        }
+        else {
+            timer1_.Start();
+        }
+    }
+    else {
+        return false;
+    }
+    
+    return true;
+}
+
 void TimerController::Notify(Timer& timer, Notification notification) {
     switch(notification) {
         case ALARM_START:
+            // Called from the tick interrupt, so in chained mode timer 2
+            // takes over in the same tick that timer 1 expires
+            if (mode_ == CHAINED) {
+                chain_second_ = (&timer == &timer1_);
+                if (chain_second_) {
+                    timer2_.Start();
+                }
+            }
             buzzer_.Beeps();
             backlight_.On();
             break;
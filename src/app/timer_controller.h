@@ -15,6 +15,9 @@
 #include "timer.h"
 
 #define BACKLIGHT_ON_TIME_MS   2000
+#define REPEAT_REDRAW_MS       250
+#define FRAME_INTERVAL_MS      100
+#define FRAME_ALARM            1
 
 class Buzzer;
 class Backlight;
@@ -26,24 +29,59 @@ class TimerController {
             ALARM_STOP
         };
         
+        enum Mode {
+            INDEPENDENT,
+            CHAINED
+        };
+        
         TimerController(Buzzer& buzzer, Backlight& backlight);
         
         void Update();
         void ProcessButtons(uint8_t button_state);
+        void ProcessRepeat(uint8_t button_state, uint8_t step);
         void Notify(Timer& timer, Notification notification);
         void ForceUpdate();
         
+        // Something on the display went from drawn to needing a redraw
+        void RequestFrame() { frames_requested_++; }
+        
         bool IsIdle() { return timer1_.IsStopped() && timer2_.IsStopped(); }
         
+        uint32_t GetFramesRequested() { return frames_requested_; }
+        uint32_t GetFramesEmitted() { return frames_emitted_; }
+        void ReportFrameStats();
+        
     private:
     
-        void ProcessTimerButtons(uint8_t button_state, uint8_t buttons_changed, Timer& timer);
+        bool IsFramePending();
+        void EmitFrame();
+        void SetModeUpdate();
+        void ToggleMode();
+        void GetAlarmBlink(bool& display_on, bool& alarm_glyph_on);
+        void UpdateAlarmBlink();
+        void ProcessTimerAction(uint8_t action, Timer& timer);
+        void RepeatTimerAction(uint8_t action, uint8_t step, Timer& timer);
+        void DispatchAction(uint8_t action, uint8_t step, Timer& timer);
+        bool DispatchChainedAction(uint8_t action, Timer& timer);
         
         Buzzer&     buzzer_;
         Backlight&  backlight_;
         Timer       timer1_;
         Timer       timer2_;
         uint8_t     last_buttons_;
+        Mode        mode_;
+        bool        mode_update_;
+        bool        chain_second_;
+        bool        display_on_;
+        bool        alarm_glyph_on_;
+        bool        repeat_enabled_;
+        bool        repeating_;
+        uint32_t    last_frame_;
+        uint32_t    frames_requested_;
+        uint32_t    frames_emitted_;
+
+        // Host soak test (sim/soak.cpp), checking invariants on the state
+        friend class TimerProbe;
 };
 
 #endif // #if !defined(__TIMERCONTROLLER_H__)
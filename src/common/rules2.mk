@@ -11,6 +11,7 @@ TRGT = ../../../gcc-arm-none-eabi-4_9-2014q4/bin/arm-none-eabi-
 CC = $(TRGT)gcc
 CXX = $(TRGT)g++
 CP = $(TRGT)objcopy
+SZ = $(TRGT)size
 
 # compiler and linker settings
 CFLAGS = -mcpu=cortex-m0plus -mthumb -I../common -I.. -Os -ggdb
@@ -0,0 +1,142 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Hardware abstraction layer
+ *
+ * The only way app and util code reaches the hardware. The LPC810 backend
+ * (hal_lpc810.h) implements the register accessors inline, so costs nothing
+ * over touching the registers directly. Define HAL_HOST to build against
+ * the host backend instead (hal_host.h), which simulates the peripherals in
+ * virtual time so the firmware runs unchanged on a PC.
+ */
+
+#if !defined(__HAL_H__)
+#define __HAL_H__
+
+#include "lpc_types.h"
+
+#if defined(HAL_HOST)
+#define HAL_INLINE              extern
+#else
+#define HAL_INLINE              static inline
+#endif
+
+// Board setup: pin assignments, serial output (TXD replaces the buzzer with
+// DEBUG) and pulling unused pins low
+extern void halBoardInit();
+
+// Interrupts, globally
+HAL_INLINE void halIrqDisable();
+HAL_INLINE void halIrqEnable();
+
+// Mask them around a section that may already be inside a masked one;
+// halIrqRestore puts back the state halIrqSave found
+HAL_INLINE uint32_t halIrqSave();
+HAL_INLINE void halIrqRestore(uint32_t state);
+
+//----------------------------------------------------------------------------------------
+// GPIO, port 0
+//
+
+HAL_INLINE void halGpioSetOutput(int pin);
+HAL_INLINE void halGpioWrite(int pin, bool value);
+HAL_INLINE void halGpioToggle(int pin);
+
+//----------------------------------------------------------------------------------------
+// Multi-rate timer: four channels counting core clock ticks down to zero
+//
+
+#define HAL_MRT_CHANNEL_COUNT   4
+#define HAL_MRT_INTERRUPT       0x01
+#define HAL_MRT_REPEAT          0x00
+#define HAL_MRT_ONE_SHOT        0x02
+
+extern void halMrtInit();
+
+// Mode bits for a channel, as above
+HAL_INLINE void halMrtSetMode(int channel, uint32_t mode);
+
+// Start the channel counting down from ticks immediately; zero stops it
+HAL_INLINE void halMrtLoad(int channel, uint32_t ticks);
+
+// Count down from ticks after the current period runs out, repeating at it
+// from then on; a stopped channel starts at once
+HAL_INLINE void halMrtSetInterval(int channel, uint32_t ticks);
+HAL_INLINE uint32_t halMrtRemaining(int channel);
+HAL_INLINE bool halMrtIsRunning(int channel);
+
+// Whether the channel has interrupted since last asked; clears the request
+HAL_INLINE bool halMrtTakeInterrupt(int channel);
+
+// MRT_IRQHandler, in the NVIC
+HAL_INLINE void halMrtIrqEnable(bool enable);
+
+//----------------------------------------------------------------------------------------
+// SysTick, interrupting SysTick_Handler every period
+//
+
+HAL_INLINE void halSysTickStart(uint32_t ticks);
+HAL_INLINE void halSysTickStop();
+HAL_INLINE bool halSysTickIsRunning();
+HAL_INLINE uint32_t halSysTickRemaining();
+
+//----------------------------------------------------------------------------------------
+// Pin interrupt 0, on falling edges of a GPIO, to PININT0_IRQHandler
+//
+
+HAL_INLINE void halPinIntInit(int pin);
+
+// Whether a falling edge has been seen since last asked; clears it
+HAL_INLINE bool halPinIntTakeFall();
+
+//----------------------------------------------------------------------------------------
+// I2C master, polled. Transfers return 0, or a non-zero error code. Each
+// runs with interrupts masked, so one started from a handler can't land in
+// the middle of another.
+//
+
+// Returns the name of the failing step, or NULL
+extern const char* halI2cInit(uint32_t bitrate_hz);
+extern int halI2cWrite(uint8_t addr, const uint8_t* data, int length);
+
+// Write then read, with a repeated start
+extern int halI2cWriteRead(uint8_t addr, const uint8_t* send, int send_length, uint8_t* receive, int receive_length);
+
+//----------------------------------------------------------------------------------------
+// Low power modes and the self-wake timer (WKT)
+//
+
+// Until any interrupt. Either may be entered with interrupts masked, as by
+// halIrqSave: one that comes due still wakes the chip, and runs once they
+// are restored.
+HAL_INLINE void halSleep();
+
+// Until pin interrupt 0, with the clocks (so MRT and SysTick) stopped
+extern void halDeepSleep(bool power_down);
+
+// The WKT counts at this rate in every mode, timing them, and can bound a
+// deep-sleep or power-down by waking the chip
+#define HAL_WKT_CLOCK_HZ        10000
+
+extern void halWktInit();
+
+// Restart the count; with wake_counts non-zero the WKT also interrupts, and
+// wakes the chip from the deep modes, once that many have passed
+extern void halWktStart(uint32_t wake_counts);
+extern uint32_t halWktElapsed();        // counts since halWktStart; cancels the wake
+
+// Whether the WKT has interrupted since last asked; clears it
+extern bool halWktTakeInterrupt();
+
+#if defined(HAL_HOST)
+#include "hal_host.h"
+#else
+#include "hal_lpc810.h"
+#endif
+
+#endif // #if !defined(__HAL_H__)
@@ -0,0 +1,596 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * HAL host backend - the LPC810 peripherals simulated in virtual time
+ */
+
+#include "hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+extern "C" void MRT_IRQHandler(void);
+extern "C" void SysTick_Handler(void);
+extern "C" void PININT0_IRQHandler(void);
+extern "C" void WKT_IRQHandler(void);
+
+// Cost of each timer read, so that polling loops see time pass: 1us
+#define POLL_TICKS              (FIXED_CLOCK_RATE_HZ / 1000000)
+
+// Bits on the bus for each byte with its acknowledge, and for a start or stop
+#define I2C_BYTE_BITS           9
+#define I2C_CONDITION_BITS      1
+#define I2C_NACK                1
+
+#define NEVER                   0xffffffffffffffffULL
+
+struct MrtChannel {
+    uint32_t    mode;
+    uint32_t    interval;
+    uint64_t    deadline;
+    bool        running;
+    bool        flag;
+};
+
+struct ScheduledEvent {
+    uint64_t    at;
+    void        (*event)(void* context);
+    void*       context;
+};
+
+static uint64_t     now = 0;
+static uint64_t     run_limit = NEVER;
+
+static bool         irq_masked = false;
+static bool         in_isr = false;
+
+static MrtChannel   mrt[HAL_MRT_CHANNEL_COUNT];
+static bool         mrt_irq_enabled = false;
+
+static uint32_t     systick_period = 0;
+static uint64_t     systick_deadline = NEVER;
+static bool         systick_flag = false;
+
+static std::vector<void (*)(int, bool)> gpio_watches;
+
+static int          pin_int_pin = -1;
+static bool         pin_fall = false;
+
+static uint32_t     gpio_dir = 0;
+static uint32_t     gpio_out = 0;                   // output latches, low from reset
+static uint32_t     gpio_level = 0xffffffff;        // inputs are pulled up
+
+static uint32_t     i2c_bitrate = 100000;
+static std::vector<const HostI2cDevice*> i2c_devices;
+static std::vector<void (*)(const HostI2cTransfer&)> i2c_watches;
+
+static std::vector<ScheduledEvent> scheduled;
+
+static uint64_t     wkt_start = 0;
+static uint64_t     wkt_deadline = NEVER;
+static bool         wkt_flag = false;
+
+static HostStats    stats;
+static HostPowerState power_state = HOST_AWAKE;
+static uint64_t     power_state_since = 0;
+static std::vector<void (*)(HostPowerState)> power_watches;
+
+//----------------------------------------------------------------------------------------
+// Virtual time
+//
+
+// Default hooks, for a run with nothing attached
+__attribute__((weak)) void hostRunStart() {
+}
+
+__attribute__((weak)) void hostRunEnd(const char* reason) {
+    printf("host: %s after %llu ms; %u interrupts, %u i2c transfers\n",
+           reason, (unsigned long long)(now / HOST_TICKS_PER_MS),
+           stats.mrt_interrupts + stats.systick_interrupts + stats.pin_interrupts + stats.wkt_interrupts, stats.i2c_transfers);
+}
+
+// Bring the time in the current power state up to date
+static void accountPowerState() {
+    stats.state_ticks[power_state] += now - power_state_since;
+    power_state_since = now;
+}
+
+static void setPowerState(HostPowerState state) {
+    accountPowerState();
+    power_state = state;
+    stats.state_entries[state]++;
+
+    for (size_t i = 0; i < power_watches.size(); i++) {
+        power_watches[i](state);
+    }
+}
+
+void hostPowerWatch(void (*changed)(HostPowerState state)) {
+    power_watches.push_back(changed);
+}
+
+static void stop(const char* reason) {
+    hostRunEnd(reason);
+    exit(0);
+}
+
+static uint64_t nextScheduled() {
+    uint64_t next = NEVER;
+
+    for (size_t i = 0; i < scheduled.size(); i++) {
+        if (scheduled[i].at < next) {
+            next = scheduled[i].at;
+        }
+    }
+
+    return next;
+}
+
+static uint64_t nextEvent() {
+    uint64_t next = nextScheduled();
+
+    for (int i = 0; i < HAL_MRT_CHANNEL_COUNT; i++) {
+        if (mrt[i].running && mrt[i].deadline < next) {
+            next = mrt[i].deadline;
+        }
+    }
+
+    if (wkt_deadline < next) {
+        next = wkt_deadline;
+    }
+
+    return systick_deadline < next ? systick_deadline : next;
+}
+
+// Latch whatever has come due by now, and run scheduled events
+static void fireEvents() {
+    for (int i = 0; i < HAL_MRT_CHANNEL_COUNT; i++) {
+        MrtChannel& channel = mrt[i];
+
+        while (channel.running && channel.deadline <= now) {
+            channel.flag = true;
+            if (channel.mode & HAL_MRT_ONE_SHOT) {
+                channel.running = false;
+            }
+            else {
+                channel.deadline += channel.interval;
+            }
+        }
+    }
+
+    if (wkt_deadline <= now) {
+        wkt_flag = true;
+        wkt_deadline = NEVER;
+    }
+
+    // Periods missed while the interrupt was pending are lost, as on the hardware
+    if (systick_deadline <= now) {
+        systick_flag = true;
+        systick_deadline += systick_period * ((now - systick_deadline) / systick_period + 1);
+    }
+
+    for (size_t i = 0; i < scheduled.size(); ) {
+        if (scheduled[i].at <= now) {
+            ScheduledEvent due = scheduled[i];
+            scheduled.erase(scheduled.begin() + i);
+            due.event(due.context);
+            i = 0;
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+static bool mrtInterruptPending() {
+    for (int i = 0; i < HAL_MRT_CHANNEL_COUNT; i++) {
+        if (mrt[i].flag && (mrt[i].mode & HAL_MRT_INTERRUPT)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool interruptPending() {
+    return systick_flag || pin_fall || wkt_flag || (mrt_irq_enabled && mrtInterruptPending());
+}
+
+// Run pending handlers one at a time, unless masked or already in one
+static void dispatchInterrupts() {
+    if (irq_masked || in_isr) {
+        return;
+    }
+
+    in_isr = true;
+
+    while (interruptPending()) {
+        // Any interrupt ends a sleep
+        if (power_state != HOST_AWAKE) {
+            setPowerState(HOST_AWAKE);
+        }
+
+        if (systick_flag) {
+            stats.systick_interrupts++;
+            systick_flag = false;
+            SysTick_Handler();
+        }
+        else if (pin_fall) {
+            stats.pin_interrupts++;
+            PININT0_IRQHandler();
+        }
+        else if (wkt_flag) {
+            stats.wkt_interrupts++;
+            WKT_IRQHandler();
+        }
+        else {
+            stats.mrt_interrupts++;
+            MRT_IRQHandler();
+        }
+    }
+
+    in_isr = false;
+}
+
+static void advanceTo(uint64_t target) {
+    uint64_t next;
+
+    while ((next = nextEvent()) <= target) {
+        if (next > now) {
+            now = next;
+        }
+        fireEvents();
+        dispatchInterrupts();
+    }
+
+    if (target > now) {
+        now = target;
+    }
+
+    if (now >= run_limit) {
+        stop("run limit reached");
+    }
+}
+
+uint64_t hostTicks() {
+    return now;
+}
+
+void hostAdvance(uint32_t ticks) {
+    advanceTo(now + ticks);
+}
+
+void hostSchedule(uint64_t at, void (*event)(void* context), void* context) {
+    ScheduledEvent scheduled_event = { at, event, context };
+    scheduled.push_back(scheduled_event);
+}
+
+void hostSetRunLimit(uint32_t ms) {
+    run_limit = (uint64_t)ms * HOST_TICKS_PER_MS;
+}
+
+const HostStats& hostGetStats() {
+    accountPowerState();
+    stats.ticks = now;
+    return stats;
+}
+
+//----------------------------------------------------------------------------------------
+// Board, interrupts and GPIO
+//
+
+void halBoardInit() {
+    const char* run_ms = getenv("HOST_RUN_MS");
+    if (run_ms) {
+        run_limit = strtoull(run_ms, NULL, 0) * HOST_TICKS_PER_MS;
+    }
+
+    // Output goes to stdout; keep it in order with anything on stderr
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    hostRunStart();
+}
+
+void halIrqDisable() {
+    irq_masked = true;
+}
+
+void halIrqEnable() {
+    irq_masked = false;
+    dispatchInterrupts();
+}
+
+uint32_t halIrqSave() {
+    bool state = irq_masked;
+    irq_masked = true;
+    return state;
+}
+
+void halIrqRestore(uint32_t state) {
+    irq_masked = state;
+    dispatchInterrupts();
+}
+
+static void setLevel(int pin, bool value) {
+    if (value == hostGpioRead(pin)) {
+        return;
+    }
+
+    gpio_level ^= 1 << pin;
+
+    for (size_t i = 0; i < gpio_watches.size(); i++) {
+        gpio_watches[i](pin, value);
+    }
+}
+
+void halGpioSetOutput(int pin) {
+    gpio_dir |= 1 << pin;
+    setLevel(pin, gpio_out & (1 << pin));
+}
+
+void halGpioWrite(int pin, bool value) {
+    gpio_out = (gpio_out & ~(1 << pin)) | ((uint32_t)value << pin);
+
+    if (gpio_dir & (1 << pin)) {
+        setLevel(pin, value);
+    }
+}
+
+void halGpioToggle(int pin) {
+    halGpioWrite(pin, !hostGpioRead(pin));
+}
+
+bool hostGpioRead(int pin) {
+    return gpio_level & (1 << pin);
+}
+
+void hostGpioWatch(void (*changed)(int pin, bool level)) {
+    gpio_watches.push_back(changed);
+}
+
+void hostPinSet(int pin, bool level) {
+    if (pin == pin_int_pin && hostGpioRead(pin) && !level) {
+        pin_fall = true;
+    }
+
+    setLevel(pin, level);
+    dispatchInterrupts();
+}
+
+//----------------------------------------------------------------------------------------
+// MRT and SysTick
+//
+
+void halMrtInit() {
+    memset(mrt, 0, sizeof(mrt));
+}
+
+void halMrtSetMode(int channel, uint32_t mode) {
+    mrt[channel].mode = mode;
+}
+
+void halMrtLoad(int channel, uint32_t ticks) {
+    mrt[channel].interval   = ticks;
+    mrt[channel].deadline   = now + ticks;
+    mrt[channel].running    = ticks != 0;
+}
+
+void halMrtSetInterval(int channel, uint32_t ticks) {
+    if (mrt[channel].running) {
+        mrt[channel].interval = ticks;
+    }
+    else {
+        halMrtLoad(channel, ticks);
+    }
+}
+
+uint32_t halMrtRemaining(int channel) {
+    hostAdvance(POLL_TICKS);
+    return mrt[channel].running ? mrt[channel].deadline - now : 0;
+}
+
+bool halMrtIsRunning(int channel) {
+    return mrt[channel].running;
+}
+
+bool halMrtTakeInterrupt(int channel) {
+    bool flag = mrt[channel].flag;
+    mrt[channel].flag = false;
+    return flag;
+}
+
+void halMrtIrqEnable(bool enable) {
+    mrt_irq_enabled = enable;
+    dispatchInterrupts();
+}
+
+void halSysTickStart(uint32_t ticks) {
+    systick_period      = ticks;
+    systick_deadline    = now + ticks;
+}
+
+void halSysTickStop() {
+    systick_deadline    = NEVER;
+    systick_flag        = false;
+}
+
+bool halSysTickIsRunning() {
+    return systick_deadline != NEVER;
+}
+
+uint32_t halSysTickRemaining() {
+    return systick_deadline != NEVER ? systick_deadline - now : 0;
+}
+
+//----------------------------------------------------------------------------------------
+// Pin interrupt
+//
+
+void halPinIntInit(int pin) {
+    pin_int_pin = pin;
+}
+
+bool halPinIntTakeFall() {
+    bool fall = pin_fall;
+    pin_fall = false;
+    return fall;
+}
+
+//----------------------------------------------------------------------------------------
+// I2C
+//
+
+static const HostI2cDevice* findDevice(uint8_t addr) {
+    for (size_t i = 0; i < i2c_devices.size(); i++) {
+        if (i2c_devices[i]->addr == addr) {
+            return i2c_devices[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Occupy the bus for a transfer of bytes with the given number of start,
+// repeated start and stop conditions
+static void busTime(int bytes, int conditions) {
+    uint32_t bits = bytes * I2C_BYTE_BITS + conditions * I2C_CONDITION_BITS;
+    uint32_t ticks = (uint64_t)bits * FIXED_CLOCK_RATE_HZ / i2c_bitrate;
+
+    stats.i2c_transfers++;
+    stats.i2c_bytes += bytes;
+    stats.i2c_ticks += ticks;
+    hostAdvance(ticks);
+}
+
+static void traceTransfer(uint64_t start, uint8_t addr, const uint8_t* send, int send_length,
+                          const uint8_t* receive, int receive_length, bool nack) {
+    HostI2cTransfer transfer = { start, i2c_bitrate, addr, send, send_length, receive, receive_length, nack };
+
+    for (size_t i = 0; i < i2c_watches.size(); i++) {
+        i2c_watches[i](transfer);
+    }
+}
+
+void hostI2cAttach(const HostI2cDevice* device) {
+    i2c_devices.push_back(device);
+}
+
+void hostI2cWatch(void (*transfer)(const HostI2cTransfer& transfer)) {
+    i2c_watches.push_back(transfer);
+}
+
+const char* halI2cInit(uint32_t bitrate_hz) {
+    i2c_bitrate = bitrate_hz;
+    return NULL;
+}
+
+// Masked across the bus time, as on the LPC810, so interrupts falling due
+// mid-transfer are taken once it's complete
+int halI2cWrite(uint8_t addr, const uint8_t* data, int length) {
+    const HostI2cDevice* device = findDevice(addr);
+    uint64_t start = now;
+    uint32_t irq_state = halIrqSave();
+
+    busTime(length + 1, 2);
+    bool nack = device && !device->write(data, length);
+
+    traceTransfer(start, addr, data, length, NULL, 0, nack);
+    halIrqRestore(irq_state);
+    return nack ? I2C_NACK : 0;
+}
+
+int halI2cWriteRead(uint8_t addr, const uint8_t* send, int send_length, uint8_t* receive, int receive_length) {
+    const HostI2cDevice* device = findDevice(addr);
+    uint64_t start = now;
+    uint32_t irq_state = halIrqSave();
+
+    busTime(send_length + 1 + receive_length + 1, 3);
+    memset(receive, 0, receive_length);
+
+    bool nack = device && (!device->write(send, send_length) || !device->read(receive, receive_length));
+
+    traceTransfer(start, addr, send, send_length, receive, receive_length, nack);
+    halIrqRestore(irq_state);
+    return nack ? I2C_NACK : 0;
+}
+
+//----------------------------------------------------------------------------------------
+// Low power modes
+//
+
+void halSleep() {
+    setPowerState(HOST_SLEEP);
+
+    while (power_state == HOST_SLEEP && !interruptPending()) {
+        uint64_t next = nextEvent();
+        if (next == NEVER && run_limit == NEVER) {
+            stop("asleep with nothing to wake it");
+        }
+
+        advanceTo(next < run_limit ? next : run_limit);
+    }
+
+    if (power_state != HOST_AWAKE) {
+        setPowerState(HOST_AWAKE);
+    }
+}
+
+// The clocks stop, so the MRT and SysTick hold their counts, and only
+// scheduled events run until one of them brings the pin interrupt, or the
+// WKT runs out
+void halDeepSleep(bool power_down) {
+    setPowerState(power_down ? HOST_POWER_DOWN : HOST_DEEP_SLEEP);
+
+    while (power_state != HOST_AWAKE && !pin_fall && !wkt_flag) {
+        uint64_t next = nextScheduled();
+        if (wkt_deadline < next) {
+            next = wkt_deadline;
+        }
+        if (next == NEVER && run_limit == NEVER) {
+            stop(power_down ? "powered down with nothing to wake it" : "in deep sleep with nothing to wake it");
+        }
+        if (next > run_limit) {
+            next = run_limit;
+        }
+
+        uint64_t frozen = next > now ? next - now : 0;
+        for (int i = 0; i < HAL_MRT_CHANNEL_COUNT; i++) {
+            mrt[i].deadline += frozen;
+        }
+        if (systick_deadline != NEVER) {
+            systick_deadline += frozen;
+        }
+
+        advanceTo(next);
+    }
+
+    dispatchInterrupts();
+}
+
+void halWktInit() {
+    wkt_start = now;
+}
+
+void halWktStart(uint32_t wake_counts) {
+    wkt_start = now;
+    wkt_deadline = wake_counts ? now + (uint64_t)wake_counts * FIXED_CLOCK_RATE_HZ / HAL_WKT_CLOCK_HZ : NEVER;
+}
+
+uint32_t halWktElapsed() {
+    wkt_deadline = NEVER;
+    return (now - wkt_start) * HAL_WKT_CLOCK_HZ / FIXED_CLOCK_RATE_HZ;
+}
+
+bool halWktTakeInterrupt() {
+    bool flag = wkt_flag;
+    wkt_flag = false;
+    return flag;
+}
@@ -0,0 +1,111 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * HAL host backend, included by hal.h with HAL_HOST
+ *
+ * The peripherals are simulated in virtual time, counted in core clock
+ * ticks. Time passes only in the HAL: each timer read costs a poll's worth,
+ * each I2C transfer its time on the bus at the configured bitrate, and
+ * sleeping jumps to the next event. Code between HAL calls takes no time.
+ * Interrupt handlers run as soon as they are due and interrupts are enabled,
+ * one at a time.
+ *
+ * The run ends once HOST_RUN_MS (from the environment) of virtual time has
+ * passed; without a limit, as soon as the device sleeps with nothing left
+ * to wake it.
+ *
+ * The functions below are for host code driving a run, such as device models.
+ */
+
+#if !defined(__HAL_HOST_H__)
+#define __HAL_HOST_H__
+
+#include "lpc_types.h"
+
+#define HOST_TICKS_PER_MS       (FIXED_CLOCK_RATE_HZ / 1000)
+
+enum HostPowerState {
+    HOST_AWAKE,
+    HOST_SLEEP,
+    HOST_DEEP_SLEEP,
+    HOST_POWER_DOWN,
+    HOST_POWER_STATES
+};
+
+// Totals for the run so far; times are in ticks
+struct HostStats {
+    uint64_t    ticks;
+    uint64_t    state_ticks[HOST_POWER_STATES];
+    uint32_t    state_entries[HOST_POWER_STATES];
+    uint32_t    mrt_interrupts;
+    uint32_t    systick_interrupts;
+    uint32_t    pin_interrupts;
+    uint32_t    wkt_interrupts;
+    uint32_t    i2c_transfers;
+    uint32_t    i2c_bytes;          // including address bytes
+    uint64_t    i2c_ticks;
+};
+
+// Called from halBoardInit, so before the firmware does anything else, to
+// attach models and schedule input; and when the run ends. Both may be
+// defined by the program, e.g. a simulator, replacing the defaults.
+extern void hostRunStart();
+extern void hostRunEnd(const char* reason);
+
+extern const HostStats& hostGetStats();
+
+// As HOST_RUN_MS, e.g. from hostRunStart
+extern void hostSetRunLimit(uint32_t ms);
+
+// Virtual time, in ticks since the start of the run
+extern uint64_t hostTicks();
+
+// Pass time, running any interrupts that come due
+extern void hostAdvance(uint32_t ticks);
+
+// Call event at a virtual time, e.g. to script input; it may schedule more
+extern void hostSchedule(uint64_t at, void (*event)(void* context), void* context);
+
+// Drive a GPIO input from outside, e.g. an expander's interrupt output
+extern void hostPinSet(int pin, bool level);
+extern bool hostGpioRead(int pin);
+
+// Called on every change of a GPIO level, output or input
+extern void hostGpioWatch(void (*changed)(int pin, bool level));
+
+// An I2C slave model. Either handler returns false to NACK. Transfers to
+// addresses with no model attached are acknowledged, and read as zeros.
+struct HostI2cDevice {
+    uint8_t addr;
+    bool    (*write)(const uint8_t* data, int length);
+    bool    (*read)(uint8_t* data, int length);
+};
+
+extern void hostI2cAttach(const HostI2cDevice* device);
+
+// A transfer as it went on the bus: the address and send data, then after a
+// repeated start the address again and the data received. Either part may
+// be empty; nack is set if the device refused either.
+struct HostI2cTransfer {
+    uint64_t        start;              // in ticks
+    uint32_t        bitrate_hz;
+    uint8_t         addr;
+    const uint8_t*  send;
+    int             send_length;
+    const uint8_t*  receive;
+    int             receive_length;
+    bool            nack;
+};
+
+// Called after each transfer, e.g. to draw it on a timeline
+extern void hostI2cWatch(void (*transfer)(const HostI2cTransfer& transfer));
+
+// Called on every change of power state
+extern void hostPowerWatch(void (*changed)(HostPowerState state));
+
+#endif // #if !defined(__HAL_HOST_H__)
@@ -0,0 +1,179 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * HAL LPC810 backend - board setup, ROM I2C driver and low power modes
+ */
+
+#include "hal.h"
+
+#include "string.h"
+#include "serial.h"
+#include "romapi_8xx.h"
+
+#define LOW_POWER_PINS          (3 << 10)
+#define I2C_TIMEOUT             100000
+#define I2C_MAX_BYTES           4
+
+#define WKT_CTRL_LOW_POWER_OSC  0x01
+#define WKT_CTRL_ALARM          0x02
+#define WKT_CTRL_CLEAR          0x04
+#define WKT_WAKE                (1 << 15)   // in STARTERP1
+#define WKT_COUNT_START         0xffffffff
+
+uint32_t SystemMainClock = FIXED_CLOCK_RATE_HZ;
+uint32_t SystemCoreClock = FIXED_CLOCK_RATE_HZ;
+
+static uint32_t wktLoaded = WKT_COUNT_START;
+
+static uint32_t i2cBuffer [24];
+static I2C_HANDLE_T* ih;
+
+void halBoardInit() {
+#if defined(DEBUG)
+    // Ensure UART TXD is on
+    LPC_SWM->PINASSIGN0 &= 0xffffff00;
+    LPC_SWM->PINASSIGN0 |= 0x00000004;
+#else
+    LPC_SWM->PINASSIGN0 |= 0xff;
+#endif
+    LPC_SWM->PINASSIGN0 |= 0xff00;          // ensure pin 8 is not assigned to UART RXD
+
+    // Set PIO0_10 and 11 as low outputs, as they float.
+    // This saves some power
+    LPC_GPIO_PORT->DIR0 |= LOW_POWER_PINS;
+    LPC_GPIO_PORT->CLR0  = LOW_POWER_PINS;
+
+    serial.init(LPC_USART0, FIXED_UART_BAUD_RATE);
+}
+
+void halMrtInit() {
+    LPC_SYSCON->SYSAHBCLKCTRL |= (1<<10);    // enable MRT clock
+    LPC_SYSCON->PRESETCTRL &= ~(1<<7);       // reset MRT
+    LPC_SYSCON->PRESETCTRL |=  (1<<7);
+}
+
+//----------------------------------------------------------------------------------------
+// I2C, via the ROM driver
+//
+
+const char* halI2cInit(uint32_t bitrate_hz) {
+    LPC_SWM->PINENABLE0 |= 3<<2;            // disable SWCLK and SWDIO
+
+    // Keep internal pull-ups on I2C pins, as this works and is less
+    // power draining when LCD off and in low power state
+
+    LPC_SWM->PINASSIGN7 = 0x02FFFFFF;       // SDA on P2, pin 4
+    LPC_SWM->PINASSIGN8 = 0xFFFFFF03;       // SCL on P3, pin 3
+    LPC_SYSCON->SYSAHBCLKCTRL |= (1<<5);    // enable I2C clock
+
+    ih = LPC_I2CD_API->i2c_setup(LPC_I2C_BASE, i2cBuffer);
+    if (ih == NULL)
+        return "i2c_setup";
+
+    if (LPC_I2CD_API->i2c_set_bitrate(ih, FIXED_CLOCK_RATE_HZ, bitrate_hz) != LPC_OK)
+        return "i2c_set_bitrate";
+
+    if (LPC_I2CD_API->i2c_set_timeout(ih, I2C_TIMEOUT) != LPC_OK)
+        return "i2c_set_timeout";
+
+    return NULL;
+}
+
+// The ROM driver's buffers start with the address byte. Its handle holds
+// the transfer in progress, so interrupts stay masked until it's done.
+int halI2cWrite(uint8_t addr, const uint8_t* data, int length) {
+    uint8_t buf [I2C_MAX_BYTES + 1];
+
+    I2C_PARAM_T param;
+    I2C_RESULT_T result;
+
+    buf[0] = (addr << 1) | 0;
+    memcpy(buf + 1, data, length);
+
+    /* Setup parameters for transfer */
+    param.num_bytes_send  = length + 1;
+    param.num_bytes_rec   = 0;
+    param.buffer_ptr_send = buf;
+    param.buffer_ptr_rec  = NULL;
+    param.stop_flag       = 1;
+
+    uint32_t irq_state = halIrqSave();
+    int err = LPC_I2CD_API->i2c_master_transmit_poll(ih, &param, &result);
+    halIrqRestore(irq_state);
+
+    return err;
+}
+
+int halI2cWriteRead(uint8_t addr, const uint8_t* send, int send_length, uint8_t* receive, int receive_length) {
+    uint8_t buf [I2C_MAX_BYTES + 1];
+
+    I2C_PARAM_T param;
+    I2C_RESULT_T result;
+
+    buf[0] = (addr << 1) | 1;
+    memcpy(buf + 1, send, send_length);
+
+    // The received bytes follow the address byte, over what was sent
+    param.num_bytes_send  = send_length + 1;
+    param.num_bytes_rec   = receive_length + 1;
+    param.buffer_ptr_send = param.buffer_ptr_rec = buf;
+    param.stop_flag       = 1;
+
+    uint32_t irq_state = halIrqSave();
+    int err = LPC_I2CD_API->i2c_master_tx_rx_poll(ih, &param, &result);
+    halIrqRestore(irq_state);
+
+    memcpy(receive, buf + 1, receive_length);
+
+    return err;
+}
+
+//----------------------------------------------------------------------------------------
+// Low power modes
+//
+
+void halDeepSleep(bool power_down) {
+    LPC_SYSCON->STARTERP0       = 0x01;     // pin interrupt 0 will wakeup
+    LPC_PMU->PCON               = power_down ? 0x02 : 0x01;
+    SCB->SCR                    = SCB_SCR_SLEEPDEEP_Msk;
+    __WFI();
+    LPC_PMU->PCON               = 0;
+    SCB->SCR                    = 0;
+}
+
+// The WKT counts down from the low power oscillator; its wake-up is only
+// enabled for a start with a wake count
+void halWktInit() {
+    LPC_SYSCON->SYSAHBCLKCTRL  |= 1 << 9;   // clock the WKT
+    LPC_PMU->DPDCTRL           |= 1 << 2;   // low power oscillator on, for the WKT
+    LPC_WKT->CTRL               = WKT_CTRL_LOW_POWER_OSC;
+    NVIC_EnableIRQ(WKT_IRQn);
+}
+
+void halWktStart(uint32_t wake_counts) {
+    wktLoaded                   = wake_counts ? wake_counts : WKT_COUNT_START;
+    LPC_WKT->CTRL               = WKT_CTRL_LOW_POWER_OSC | WKT_CTRL_CLEAR;
+    LPC_WKT->COUNT              = wktLoaded;
+    LPC_SYSCON->STARTERP1       = wake_counts ? WKT_WAKE : 0;
+}
+
+uint32_t halWktElapsed() {
+    uint32_t elapsed            = wktLoaded - LPC_WKT->COUNT;
+    LPC_WKT->CTRL               = WKT_CTRL_LOW_POWER_OSC | WKT_CTRL_CLEAR;
+    LPC_SYSCON->STARTERP1       = 0;
+    return elapsed;
+}
+
+bool halWktTakeInterrupt() {
+    if (LPC_WKT->CTRL & WKT_CTRL_ALARM) {
+        LPC_WKT->CTRL           = WKT_CTRL_LOW_POWER_OSC | WKT_CTRL_ALARM;
+        return true;
+    }
+    
+    return false;
+}
@@ -0,0 +1,124 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* HAL LPC810 backend - register accessors, included by hal.h */
+
+#if !defined(__HAL_LPC810_H__)
+#define __HAL_LPC810_H__
+
+#include "LPC8xx.h"
+
+#define MRT_STAT_INTFLAG        0x01
+#define MRT_STAT_RUN            0x02
+#define MRT_INTVAL_LOAD         (1UL << 31)
+
+HAL_INLINE void halIrqDisable() {
+    __disable_irq();
+}
+
+HAL_INLINE void halIrqEnable() {
+    __enable_irq();
+}
+
+HAL_INLINE uint32_t halIrqSave() {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+HAL_INLINE void halIrqRestore(uint32_t state) {
+    __set_PRIMASK(state);
+}
+
+HAL_INLINE void halGpioSetOutput(int pin) {
+    LPC_GPIO_PORT->DIR0 |= 1 << pin;
+}
+
+HAL_INLINE void halGpioWrite(int pin, bool value) {
+    LPC_GPIO_PORT->B0[pin] = value;
+}
+
+HAL_INLINE void halGpioToggle(int pin) {
+    LPC_GPIO_PORT->NOT0 = 1 << pin;
+}
+
+HAL_INLINE void halMrtSetMode(int channel, uint32_t mode) {
+    LPC_MRT->Channel[channel].CTRL = mode;
+}
+
+HAL_INLINE void halMrtLoad(int channel, uint32_t ticks) {
+    LPC_MRT->Channel[channel].INTVAL = ticks | MRT_INTVAL_LOAD;
+}
+
+HAL_INLINE void halMrtSetInterval(int channel, uint32_t ticks) {
+    LPC_MRT->Channel[channel].INTVAL = ticks;
+}
+
+HAL_INLINE uint32_t halMrtRemaining(int channel) {
+    return LPC_MRT->Channel[channel].TIMER;
+}
+
+HAL_INLINE bool halMrtIsRunning(int channel) {
+    return LPC_MRT->Channel[channel].STAT & MRT_STAT_RUN;
+}
+
+HAL_INLINE bool halMrtTakeInterrupt(int channel) {
+    if (LPC_MRT->Channel[channel].STAT & MRT_STAT_INTFLAG) {
+        LPC_MRT->Channel[channel].STAT = MRT_STAT_INTFLAG;
+        return true;
+    }
+
+    return false;
+}
+
+HAL_INLINE void halMrtIrqEnable(bool enable) {
+    if (enable) {
+        NVIC_EnableIRQ(MRT_IRQn);
+    }
+    else {
+        NVIC_DisableIRQ(MRT_IRQn);
+    }
+}
+
+HAL_INLINE void halSysTickStart(uint32_t ticks) {
+    SysTick_Config(ticks);
+}
+
+HAL_INLINE void halSysTickStop() {
+    SysTick->CTRL = 0;
+}
+
+HAL_INLINE bool halSysTickIsRunning() {
+    return SysTick->CTRL & SysTick_CTRL_ENABLE_Msk;
+}
+
+HAL_INLINE uint32_t halSysTickRemaining() {
+    return SysTick->VAL;
+}
+
+HAL_INLINE void halPinIntInit(int pin) {
+    LPC_SYSCON->PINTSEL[0]      = pin;      // Pin interrupt 0 from the pin
+    LPC_PIN_INT->ISEL           = 0;        // Edge sensitive (1 bit per pin interrupt)
+    LPC_PIN_INT->IENF           = 1;        // Falling edge   (1 bit per pin interrupt)
+    LPC_SYSCON->SYSAHBCLKCTRL  |= 1<<6;     // Turn on clock to pin interrupts block (already 1 after reset)
+    NVIC_EnableIRQ(PININT0_IRQn);           // Enable pin interrupt in NVIC (#24)
+}
+
+HAL_INLINE bool halPinIntTakeFall() {
+    if (LPC_PIN_INT->FALL & 1) {
+        LPC_PIN_INT->FALL = 1;
+        return true;
+    }
+
+    return false;
+}
+
+HAL_INLINE void halSleep() {
+    __WFI();
+}
+
+#endif // #if !defined(__HAL_LPC810_H__)
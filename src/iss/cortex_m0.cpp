@@ -0,0 +1,1067 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Cortex-M0+ core
+ *
+ * The ARMv6-M Thumb instruction set, with the NVIC and SCB; SysTick is left
+ * to the bus, as it is clocked with the rest of the chip. Cycles are those of
+ * the Cortex-M0+ TRM for zero wait state memory, with single cycle loads and
+ * stores on the I/O port at 0xa0000000 and the single cycle multiplier.
+ * Exception entry and return are charged as a whole; tail-chaining and
+ * late arrival aren't modelled, nor are debug and the MPU.
+ */
+
+#include "cortex_m0.h"
+
+#include <stddef.h>
+
+#define EXCEPTION_ENTRY_CYCLES  15
+#define EXCEPTION_RETURN_CYCLES 13      // on top of the returning instruction's
+#define MUL_CYCLES              1
+#define SYSTEM_CYCLES           3       // MRS, MSR and the barriers
+
+#define IOP_REGION              0xa
+#define SCS_BASE                0xe000e000
+#define SCS_END                 0xe000f000
+#define SYSTICK_BASE            0xe000e010
+#define SYSTICK_END             0xe000e020
+
+#define EXC_RETURN_MASK         0xfffffff0
+#define EXC_RETURN_THREAD       0x08
+#define EXC_RETURN_PSP          0x04
+#define CONTROL_SPSEL           0x02
+#define XPSR_ALIGNED            (1 << 9)
+#define XPSR_THUMB              (1 << 24)
+
+#define CPUID_CORTEX_M0PLUS     0x410cc601
+#define CCR_VALUE               0x208   // STKALIGN and UNALIGN_TRP, fixed on ARMv6-M
+
+#define ICSR_NMIPENDSET         (1UL << 31)
+#define ICSR_PENDSVSET          (1 << 28)
+#define ICSR_PENDSVCLR          (1 << 27)
+#define ICSR_PENDSTSET          (1 << 26)
+#define ICSR_PENDSTCLR          (1 << 25)
+#define ICSR_ISRPENDING         (1 << 22)
+#define AIRCR_SYSRESETREQ       (1 << 2)
+
+#define NO_EXCEPTION            0
+#define THREAD_PRIORITY         256
+
+// The bus may not be ready yet, so nothing runs until Reset
+CortexM0::CortexM0(CortexM0Bus& bus) : bus_(bus), sleeping_(false), fault_("not reset") {
+}
+
+void CortexM0::Reset() {
+    for (int i = 0; i < 16; i++) {
+        regs_[i] = 0;
+    }
+
+    other_sp_                   = 0;
+    n_ = z_ = c_ = v_           = false;
+    primask_                    = false;
+    control_                    = 0;
+    ipsr_                       = 0;
+    pending_                    = 0;
+    active_                     = 0;
+    irq_lines_                  = 0;
+    nvic_enabled_               = 0;
+    shpr2_ = shpr3_             = 0;
+    scr_                        = 0;
+    vtor_                       = 0;
+    sleeping_                   = false;
+    fault_                      = NULL;
+    cycles_                     = 0;
+    took_exception_             = false;
+    returned_from_exception_    = false;
+
+    for (int i = 0; i < 32; i++) {
+        nvic_priority_[i] = 0;
+    }
+
+    uint32_t sp, pc;
+    if (bus_.Read(0, 4, sp) && bus_.Read(4, 4, pc)) {
+        regs_[13] = sp & ~3;
+        regs_[14] = 0xffffffff;
+        regs_[15] = pc & ~1;
+    }
+    else {
+        fault_ = "no vector table";
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Memory, with the system control space
+//
+
+bool CortexM0::Read(uint32_t address, int size, uint32_t& value) {
+    if (address & (size - 1)) {
+        return false;
+    }
+
+    if (address >= SCS_BASE && address < SCS_END && !(address >= SYSTICK_BASE && address < SYSTICK_END)) {
+        uint32_t word;
+        if (!ReadScs(address & 0xffc, word)) {
+            return false;
+        }
+        value = word >> ((address & 3) * 8);
+        if (size < 4) {
+            value &= (1UL << (size * 8)) - 1;
+        }
+        return true;
+    }
+
+    return bus_.Read(address, size, value);
+}
+
+bool CortexM0::Write(uint32_t address, int size, uint32_t value) {
+    if (address & (size - 1)) {
+        return false;
+    }
+
+    if (address >= SCS_BASE && address < SCS_END && !(address >= SYSTICK_BASE && address < SYSTICK_END)) {
+        if (size < 4) {
+            uint32_t word;
+            int shift = (address & 3) * 8;
+            uint32_t mask = ((1UL << (size * 8)) - 1) << shift;
+
+            if (!ReadScs(address & 0xffc, word)) {
+                return false;
+            }
+            value = (word & ~mask) | ((value << shift) & mask);
+        }
+        return WriteScs(address & 0xffc, value);
+    }
+
+    return bus_.Write(address, size, value);
+}
+
+uint32_t CortexM0::ReadOrFault(uint32_t address, int size) {
+    uint32_t value = 0;
+
+    if (!Read(address, size, value) && !fault_) {
+        fault_ = "bus fault on read";
+    }
+
+    return value;
+}
+
+void CortexM0::WriteOrFault(uint32_t address, int size, uint32_t value) {
+    if (!Write(address, size, value) && !fault_) {
+        fault_ = "bus fault on write";
+    }
+}
+
+bool CortexM0::ReadScs(uint32_t offset, uint32_t& value) {
+    if (offset >= 0x400 && offset < 0x420) {
+        const uint8_t* priority = nvic_priority_ + (offset - 0x400);
+        value = priority[0] | (priority[1] << 8) | (priority[2] << 16) | ((uint32_t)priority[3] << 24);
+        return true;
+    }
+
+    switch (offset) {
+        case 0x100:
+        case 0x180:
+            value = nvic_enabled_;
+            return true;
+
+        case 0x200:
+        case 0x280:
+            value = (uint32_t)(pending_ >> EXCEPTION_IRQ0);
+            return true;
+
+        case 0xd00:
+            value = CPUID_CORTEX_M0PLUS;
+            return true;
+
+        case 0xd04: {
+            int next = PendingException(true);
+            value = ipsr_ | (next << 12);
+            if (pending_ >> EXCEPTION_IRQ0 || irq_lines_) {
+                value |= ICSR_ISRPENDING;
+            }
+            if (pending_ & (1ULL << EXCEPTION_SYSTICK)) {
+                value |= ICSR_PENDSTSET;
+            }
+            if (pending_ & (1ULL << EXCEPTION_PENDSV)) {
+                value |= ICSR_PENDSVSET;
+            }
+            return true;
+        }
+
+        case 0xd08:
+            value = vtor_;
+            return true;
+
+        case 0xd0c:
+            value = 0;
+            return true;
+
+        case 0xd10:
+            value = scr_;
+            return true;
+
+        case 0xd14:
+            value = CCR_VALUE;
+            return true;
+
+        case 0xd1c:
+            value = shpr2_;
+            return true;
+
+        case 0xd20:
+            value = shpr3_;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool CortexM0::WriteScs(uint32_t offset, uint32_t value) {
+    if (offset >= 0x400 && offset < 0x420) {
+        uint8_t* priority = nvic_priority_ + (offset - 0x400);
+        for (int i = 0; i < 4; i++) {
+            priority[i] = (value >> (i * 8)) & 0xc0;
+        }
+        return true;
+    }
+
+    switch (offset) {
+        case 0x100:
+            nvic_enabled_ |= value;
+            return true;
+
+        case 0x180:
+            nvic_enabled_ &= ~value;
+            return true;
+
+        case 0x200:
+            pending_ |= (uint64_t)value << EXCEPTION_IRQ0;
+            return true;
+
+        case 0x280:
+            pending_ &= ~((uint64_t)value << EXCEPTION_IRQ0);
+            return true;
+
+        case 0xd04:
+            if (value & ICSR_PENDSVSET) {
+                SetPending(EXCEPTION_PENDSV);
+            }
+            if (value & ICSR_PENDSVCLR) {
+                pending_ &= ~(1ULL << EXCEPTION_PENDSV);
+            }
+            if (value & ICSR_PENDSTSET) {
+                SetPending(EXCEPTION_SYSTICK);
+            }
+            if (value & ICSR_PENDSTCLR) {
+                pending_ &= ~(1ULL << EXCEPTION_SYSTICK);
+            }
+            if (value & ICSR_NMIPENDSET) {
+                fault_ = "NMI";
+            }
+            return true;
+
+        case 0xd08:
+            vtor_ = value & 0xffffff80;
+            return true;
+
+        case 0xd0c:
+            if ((value >> 16) == 0x05fa && (value & AIRCR_SYSRESETREQ)) {
+                fault_ = "system reset requested";
+            }
+            return true;
+
+        case 0xd10:
+            scr_ = value & 0x16;
+            return true;
+
+        case 0xd14:
+            return true;
+
+        case 0xd1c:
+            shpr2_ = value & 0xc0000000;
+            return true;
+
+        case 0xd20:
+            shpr3_ = value & 0xc0c00000;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Exceptions
+//
+
+int CortexM0::Priority(int exception) const {
+    switch (exception) {
+        case EXCEPTION_HARD_FAULT:  return -1;
+        case EXCEPTION_SVCALL:      return (shpr2_ >> 24) & 0xc0;
+        case EXCEPTION_PENDSV:      return (shpr3_ >> 16) & 0xc0;
+        case EXCEPTION_SYSTICK:     return (shpr3_ >> 24) & 0xc0;
+        default:                    return nvic_priority_[exception - EXCEPTION_IRQ0];
+    }
+}
+
+int CortexM0::ExecutionPriority() const {
+    int priority = THREAD_PRIORITY;
+
+    for (int exception = 1; exception < EXCEPTION_COUNT; exception++) {
+        if (active_ & (1ULL << exception) && Priority(exception) < priority) {
+            priority = Priority(exception);
+        }
+    }
+
+    return primask_ && priority > 0 ? 0 : priority;
+}
+
+// The exception that would be taken now, if any. Interrupt lines are level
+// sensitive: one still asserted pends again once its handler has returned.
+int CortexM0::PendingException(bool ignore_primask) {
+    uint32_t active_irqs = (uint32_t)(active_ >> EXCEPTION_IRQ0);
+    pending_ |= (uint64_t)(irq_lines_ & ~active_irqs) << EXCEPTION_IRQ0;
+
+    uint64_t candidates = pending_ & ~(((uint64_t)~nvic_enabled_ & 0xffffffff) << EXCEPTION_IRQ0);
+    if (!candidates) {
+        return NO_EXCEPTION;
+    }
+
+    int best = NO_EXCEPTION;
+    int best_priority = THREAD_PRIORITY;
+    for (int exception = 1; exception < EXCEPTION_COUNT; exception++) {
+        if (candidates & (1ULL << exception) && Priority(exception) < best_priority) {
+            best = exception;
+            best_priority = Priority(exception);
+        }
+    }
+
+    bool saved_primask = primask_;
+    if (ignore_primask) {
+        primask_ = false;
+    }
+    int execution_priority = ExecutionPriority();
+    primask_ = saved_primask;
+
+    return best_priority < execution_priority ? best : NO_EXCEPTION;
+}
+
+bool CortexM0::CanWake() {
+    return PendingException(true) != NO_EXCEPTION;
+}
+
+void CortexM0::EnterException(int exception) {
+    uint32_t return_address = regs_[15];
+    uint32_t exc_return;
+
+    if (ipsr_) {
+        exc_return = 0xfffffff1;
+    }
+    else if (control_ & CONTROL_SPSEL) {
+        exc_return = 0xfffffffd;
+        uint32_t psp = regs_[13];
+        regs_[13] = other_sp_;
+        other_sp_ = psp;
+    }
+    else {
+        exc_return = 0xfffffff9;
+    }
+
+    // Thread mode's stack pointer when on the process stack, else this one
+    uint32_t sp = exc_return == 0xfffffffd ? other_sp_ : regs_[13];
+    uint32_t xpsr = (n_ << 31) | (z_ << 30) | (c_ << 29) | (v_ << 28) | XPSR_THUMB | ipsr_;
+    if (sp & 4) {
+        xpsr |= XPSR_ALIGNED;
+    }
+    sp = (sp - 0x20) & ~4;
+
+    WriteOrFault(sp + 0x00, 4, regs_[0]);
+    WriteOrFault(sp + 0x04, 4, regs_[1]);
+    WriteOrFault(sp + 0x08, 4, regs_[2]);
+    WriteOrFault(sp + 0x0c, 4, regs_[3]);
+    WriteOrFault(sp + 0x10, 4, regs_[12]);
+    WriteOrFault(sp + 0x14, 4, regs_[14]);
+    WriteOrFault(sp + 0x18, 4, return_address);
+    WriteOrFault(sp + 0x1c, 4, xpsr);
+
+    if (exc_return == 0xfffffffd) {
+        other_sp_ = sp;
+    }
+    else {
+        regs_[13] = sp;
+    }
+
+    regs_[14]   = exc_return;
+    regs_[15]   = ReadOrFault(vtor_ + exception * 4, 4) & ~1;
+    ipsr_       = exception;
+    pending_   &= ~(1ULL << exception);
+    active_    |= 1ULL << exception;
+    sleeping_   = false;
+    cycles_    += EXCEPTION_ENTRY_CYCLES;
+}
+
+void CortexM0::ReturnFromException(uint32_t exc_return) {
+    active_ &= ~(1ULL << ipsr_);
+
+    bool to_thread = exc_return & EXC_RETURN_THREAD;
+    if (to_thread && (exc_return & EXC_RETURN_PSP)) {
+        uint32_t msp = regs_[13];
+        regs_[13] = other_sp_;
+        other_sp_ = msp;
+        control_ |= CONTROL_SPSEL;
+    }
+    else if (to_thread) {
+        control_ &= ~CONTROL_SPSEL;
+    }
+
+    uint32_t sp = regs_[13];
+    regs_[0]        = ReadOrFault(sp + 0x00, 4);
+    regs_[1]        = ReadOrFault(sp + 0x04, 4);
+    regs_[2]        = ReadOrFault(sp + 0x08, 4);
+    regs_[3]        = ReadOrFault(sp + 0x0c, 4);
+    regs_[12]       = ReadOrFault(sp + 0x10, 4);
+    regs_[14]       = ReadOrFault(sp + 0x14, 4);
+    next_pc_        = ReadOrFault(sp + 0x18, 4) & ~1;
+    uint32_t xpsr   = ReadOrFault(sp + 0x1c, 4);
+
+    regs_[13] = (sp + 0x20) | (xpsr & XPSR_ALIGNED ? 4 : 0);
+    n_      = xpsr >> 31;
+    z_      = (xpsr >> 30) & 1;
+    c_      = (xpsr >> 29) & 1;
+    v_      = (xpsr >> 28) & 1;
+    ipsr_   = to_thread ? 0 : xpsr & 0x3f;
+
+    cycles_ += EXCEPTION_RETURN_CYCLES;
+    returned_from_exception_ = true;
+}
+
+void CortexM0::BranchTo(uint32_t address) {
+    next_pc_ = address & ~1;
+    cycles_++;
+}
+
+// BX, BLX and POP to the PC: interworking, which on ARMv6-M means staying
+// in Thumb state, or an exception return
+void CortexM0::BranchExchange(uint32_t address) {
+    if (ipsr_ && (address & EXC_RETURN_MASK) == EXC_RETURN_MASK) {
+        cycles_++;
+        ReturnFromException(address);
+    }
+    else if (!(address & 1)) {
+        fault_ = "branch to ARM state";
+    }
+    else {
+        BranchTo(address);
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Arithmetic
+//
+
+uint32_t CortexM0::AddWithCarry(uint32_t x, uint32_t y, bool carry_in, bool set_flags) {
+    uint64_t unsigned_sum = (uint64_t)x + y + carry_in;
+    int64_t signed_sum = (int64_t)(int32_t)x + (int32_t)y + carry_in;
+    uint32_t result = (uint32_t)unsigned_sum;
+
+    if (set_flags) {
+        SetNZ(result);
+        c_ = unsigned_sum >> 32;
+        v_ = (int64_t)(int32_t)result != signed_sum;
+    }
+
+    return result;
+}
+
+void CortexM0::SetNZ(uint32_t result) {
+    n_ = result >> 31;
+    z_ = result == 0;
+}
+
+// Shifts by a register, setting the carry flag: LSL, LSR, ASR or ROR
+uint32_t CortexM0::ShiftRegister(int type, uint32_t value, uint32_t amount) {
+    if (amount == 0) {
+        return value;
+    }
+
+    switch (type) {
+        case 0:
+            c_ = amount <= 32 ? (value >> (32 - amount)) & 1 : 0;
+            return amount < 32 ? value << amount : 0;
+
+        case 1:
+            c_ = amount <= 32 ? (value >> (amount - 1)) & 1 : 0;
+            return amount < 32 ? value >> amount : 0;
+
+        case 2:
+            if (amount >= 32) {
+                c_ = value >> 31;
+                return c_ ? 0xffffffff : 0;
+            }
+            c_ = ((int32_t)value >> (amount - 1)) & 1;
+            return (int32_t)value >> amount;
+
+        default:
+            amount &= 31;
+            if (amount) {
+                value = (value >> amount) | (value << (32 - amount));
+            }
+            c_ = value >> 31;
+            return value;
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Instructions
+//
+
+static inline bool isIop(uint32_t address) {
+    return (address >> 28) == IOP_REGION;
+}
+
+void CortexM0::ExecuteDataProcessing(uint16_t op) {
+    uint32_t& rdn = regs_[op & 7];
+    uint32_t m = regs_[(op >> 3) & 7];
+
+    switch ((op >> 6) & 15) {
+        case 0:  rdn &= m;                                  SetNZ(rdn); break;  // ANDS
+        case 1:  rdn ^= m;                                  SetNZ(rdn); break;  // EORS
+        case 2:  rdn = ShiftRegister(0, rdn, m & 0xff);     SetNZ(rdn); break;  // LSLS
+        case 3:  rdn = ShiftRegister(1, rdn, m & 0xff);     SetNZ(rdn); break;  // LSRS
+        case 4:  rdn = ShiftRegister(2, rdn, m & 0xff);     SetNZ(rdn); break;  // ASRS
+        case 5:  rdn = AddWithCarry(rdn, m, c_, true);                  break;  // ADCS
+        case 6:  rdn = AddWithCarry(rdn, ~m, c_, true);                 break;  // SBCS
+        case 7:  rdn = ShiftRegister(3, rdn, m & 0xff);     SetNZ(rdn); break;  // RORS
+        case 8:  SetNZ(rdn & m);                                        break;  // TST
+        case 9:  rdn = AddWithCarry(~m, 0, true, true);                 break;  // RSBS #0
+        case 10: AddWithCarry(rdn, ~m, true, true);                     break;  // CMP
+        case 11: AddWithCarry(rdn, m, false, true);                     break;  // CMN
+        case 12: rdn |= m;                                  SetNZ(rdn); break;  // ORRS
+        case 13: rdn *= m;                                  SetNZ(rdn);         // MULS
+                 cycles_ += MUL_CYCLES - 1;                             break;
+        case 14: rdn &= ~m;                                 SetNZ(rdn); break;  // BICS
+        case 15: rdn = ~m;                                  SetNZ(rdn); break;  // MVNS
+    }
+}
+
+// 1011 xxxx: stack, extends, reverses, interrupt masking and hints
+void CortexM0::ExecuteMisc(uint16_t op) {
+    int rd = op & 7;
+    uint32_t m = regs_[(op >> 3) & 7];
+
+    switch ((op >> 8) & 15) {
+        case 0x0:                                   // ADD/SUB SP, #imm7
+            if (op & 0x80) {
+                regs_[13] -= (op & 0x7f) * 4;
+            }
+            else {
+                regs_[13] += (op & 0x7f) * 4;
+            }
+            break;
+
+        case 0x2:
+            switch ((op >> 6) & 3) {
+                case 0: regs_[rd] = (int32_t)(int16_t)m;    break;  // SXTH
+                case 1: regs_[rd] = (int32_t)(int8_t)m;     break;  // SXTB
+                case 2: regs_[rd] = m & 0xffff;             break;  // UXTH
+                case 3: regs_[rd] = m & 0xff;               break;  // UXTB
+            }
+            break;
+
+        case 0x4:
+        case 0x5: {                                 // PUSH
+            int count = __builtin_popcount(op & 0x1ff);
+            uint32_t address = regs_[13] - count * 4;
+
+            regs_[13] = address;
+            for (int r = 0; r < 8; r++) {
+                if (op & (1 << r)) {
+                    WriteOrFault(address, 4, regs_[r]);
+                    address += 4;
+                }
+            }
+            if (op & 0x100) {
+                WriteOrFault(address, 4, regs_[14]);
+            }
+            cycles_ += count;
+            break;
+        }
+
+        case 0x6:                                   // CPSIE/CPSID i
+            if ((op & 0xffef) != 0xb662) {
+                fault_ = "undefined instruction";
+                break;
+            }
+            primask_ = op & 0x10;
+            break;
+
+        case 0xa:
+            switch ((op >> 6) & 3) {
+                case 0:                             // REV
+                    regs_[rd] = __builtin_bswap32(m);
+                    break;
+                case 1:                             // REV16
+                    regs_[rd] = ((m & 0x00ff00ff) << 8) | ((m >> 8) & 0x00ff00ff);
+                    break;
+                case 3:                             // REVSH
+                    regs_[rd] = (int32_t)(int16_t)(((m & 0xff) << 8) | ((m >> 8) & 0xff));
+                    break;
+                default:
+                    fault_ = "undefined instruction";
+                    break;
+            }
+            break;
+
+        case 0xc:
+        case 0xd: {                                 // POP
+            int count = __builtin_popcount(op & 0x1ff);
+            uint32_t address = regs_[13];
+
+            regs_[13] += count * 4;
+            for (int r = 0; r < 8; r++) {
+                if (op & (1 << r)) {
+                    regs_[r] = ReadOrFault(address, 4);
+                    address += 4;
+                }
+            }
+            cycles_ += count;
+            if (op & 0x100) {
+                cycles_++;
+                BranchExchange(ReadOrFault(address, 4));
+            }
+            break;
+        }
+
+        case 0xe:                                   // BKPT
+            if (!bus_.Breakpoint(*this, op & 0xff) && !fault_) {
+                fault_ = "breakpoint";
+            }
+            break;
+
+        case 0xf:                                   // hints
+            switch (op & 0xff) {
+                case 0x00:                          // NOP
+                case 0x10:                          // YIELD
+                case 0x40:                          // SEV
+                    break;
+                case 0x20:                          // WFE: as WFI, as nothing sends events
+                case 0x30:                          // WFI
+                    cycles_++;
+                    sleeping_ = !CanWake();
+                    break;
+                default:
+                    fault_ = "undefined instruction";
+                    break;
+            }
+            break;
+
+        default:
+            fault_ = "undefined instruction";
+            break;
+    }
+}
+
+void CortexM0::Execute32(uint16_t hw1, uint16_t hw2) {
+    next_pc_ = regs_[15] + 4;
+
+    if ((hw1 & 0xf800) == 0xf000 && (hw2 & 0xd000) == 0xd000) {      // BL
+        uint32_t s = (hw1 >> 10) & 1;
+        uint32_t i1 = !(((hw2 >> 13) & 1) ^ s);
+        uint32_t i2 = !(((hw2 >> 11) & 1) ^ s);
+        uint32_t offset = (s << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3ff) << 12) | ((hw2 & 0x7ff) << 1);
+        if (s) {
+            offset |= 0xfe000000;
+        }
+
+        regs_[14] = next_pc_ | 1;
+        cycles_++;
+        BranchTo(next_pc_ + offset);
+        return;
+    }
+
+    cycles_ += SYSTEM_CYCLES - 1;
+
+    if ((hw1 & 0xfff0) == 0xf380 && (hw2 & 0xff00) == 0x8800) {      // MSR
+        uint32_t value = regs_[hw1 & 15];
+        int sysm = hw2 & 0xff;
+
+        if (sysm < 8 && !(sysm & 4)) {
+            n_ = value >> 31;
+            z_ = (value >> 30) & 1;
+            c_ = (value >> 29) & 1;
+            v_ = (value >> 28) & 1;
+        }
+        else if (sysm == 8) {
+            if (!ipsr_ && (control_ & CONTROL_SPSEL)) {
+                other_sp_ = value & ~3;
+            }
+            else {
+                regs_[13] = value & ~3;
+            }
+        }
+        else if (sysm == 9) {
+            if (!ipsr_ && (control_ & CONTROL_SPSEL)) {
+                regs_[13] = value & ~3;
+            }
+            else {
+                other_sp_ = value & ~3;
+            }
+        }
+        else if (sysm == 16) {
+            primask_ = value & 1;
+        }
+        else if (sysm == 20) {
+            // Only thread mode can change stacks
+            if (!ipsr_ && ((value ^ control_) & CONTROL_SPSEL)) {
+                uint32_t sp = regs_[13];
+                regs_[13] = other_sp_;
+                other_sp_ = sp;
+            }
+            control_ = ipsr_ ? (control_ & CONTROL_SPSEL) | (value & 1) : value & 3;
+        }
+        return;
+    }
+
+    if (hw1 == 0xf3ef && (hw2 & 0xf000) == 0x8000) {                 // MRS
+        int rd = (hw2 >> 8) & 15;
+        int sysm = hw2 & 0xff;
+        bool on_psp = !ipsr_ && (control_ & CONTROL_SPSEL);
+        uint32_t value = 0;
+
+        if (sysm < 8) {
+            if (sysm & 1) {
+                value |= ipsr_;
+            }
+            if (!(sysm & 4)) {
+                value |= (n_ << 31) | (z_ << 30) | (c_ << 29) | (v_ << 28);
+            }
+        }
+        else if (sysm == 8) {
+            value = on_psp ? other_sp_ : regs_[13];
+        }
+        else if (sysm == 9) {
+            value = on_psp ? regs_[13] : other_sp_;
+        }
+        else if (sysm == 16) {
+            value = primask_;
+        }
+        else if (sysm == 20) {
+            value = control_;
+        }
+        regs_[rd] = value;
+        return;
+    }
+
+    if (hw1 == 0xf3bf && (hw2 & 0xffc0) == 0x8f40) {                 // DSB, DMB, ISB
+        return;
+    }
+
+    fault_ = "undefined instruction";
+}
+
+static inline bool conditionPassed(int cond, bool n, bool z, bool c, bool v) {
+    bool result;
+
+    switch (cond >> 1) {
+        case 0:  result = z;                    break;
+        case 1:  result = c;                    break;
+        case 2:  result = n;                    break;
+        case 3:  result = v;                    break;
+        case 4:  result = c && !z;              break;
+        case 5:  result = n == v;               break;
+        case 6:  result = n == v && !z;         break;
+        default: return true;
+    }
+
+    return cond & 1 ? !result : result;
+}
+
+void CortexM0::Execute(uint16_t op) {
+    uint32_t pc = regs_[15];
+    int rd = op & 7;
+    int rn = (op >> 3) & 7;
+    int r8 = (op >> 8) & 7;
+    uint32_t imm5 = (op >> 6) & 31;
+    uint32_t imm8 = op & 0xff;
+    uint32_t address;
+
+    cycles_++;
+
+    switch (op >> 11) {
+        case 0x00:                                  // LSLS #imm, or MOVS
+            if (imm5) {
+                c_ = (regs_[rn] >> (32 - imm5)) & 1;
+                regs_[rd] = regs_[rn] << imm5;
+            }
+            else {
+                regs_[rd] = regs_[rn];
+            }
+            SetNZ(regs_[rd]);
+            break;
+
+        case 0x01:                                  // LSRS #imm
+            regs_[rd] = ShiftRegister(1, regs_[rn], imm5 ? imm5 : 32);
+            SetNZ(regs_[rd]);
+            break;
+
+        case 0x02:                                  // ASRS #imm
+            regs_[rd] = ShiftRegister(2, regs_[rn], imm5 ? imm5 : 32);
+            SetNZ(regs_[rd]);
+            break;
+
+        case 0x03: {                                // ADDS/SUBS, register or #imm3
+            uint32_t operand = op & 0x400 ? (op >> 6) & 7 : regs_[(op >> 6) & 7];
+            if (op & 0x200) {
+                regs_[rd] = AddWithCarry(regs_[rn], ~operand, true, true);
+            }
+            else {
+                regs_[rd] = AddWithCarry(regs_[rn], operand, false, true);
+            }
+            break;
+        }
+
+        case 0x04:                                  // MOVS #imm8
+            regs_[r8] = imm8;
+            SetNZ(imm8);
+            break;
+
+        case 0x05:                                  // CMP #imm8
+            AddWithCarry(regs_[r8], ~imm8, true, true);
+            break;
+
+        case 0x06:                                  // ADDS #imm8
+            regs_[r8] = AddWithCarry(regs_[r8], imm8, false, true);
+            break;
+
+        case 0x07:                                  // SUBS #imm8
+            regs_[r8] = AddWithCarry(regs_[r8], ~imm8, true, true);
+            break;
+
+        case 0x08:
+            if (!(op & 0x400)) {
+                ExecuteDataProcessing(op);
+                break;
+            }
+            else {
+                // High registers: ADD, CMP, MOV, and BX/BLX
+                int rdn = (op & 7) | ((op >> 4) & 8);
+                int rm = (op >> 3) & 15;
+                uint32_t m = rm == 15 ? pc + 4 : regs_[rm];
+                uint32_t dn = rdn == 15 ? pc + 4 : regs_[rdn];
+
+                switch ((op >> 8) & 3) {
+                    case 0:
+                        if (rdn == 15) {
+                            BranchTo(dn + m);
+                        }
+                        else {
+                            regs_[rdn] = dn + m;
+                        }
+                        break;
+
+                    case 1:
+                        AddWithCarry(dn, ~m, true, true);
+                        break;
+
+                    case 2:
+                        if (rdn == 15) {
+                            BranchTo(m);
+                        }
+                        else {
+                            regs_[rdn] = m;
+                        }
+                        break;
+
+                    case 3:
+                        if (op & 0x80) {
+                            regs_[14] = (pc + 2) | 1;
+                        }
+                        BranchExchange(m);
+                        break;
+                }
+            }
+            break;
+
+        case 0x09:                                  // LDR (literal)
+            address = ((pc + 4) & ~3) + imm8 * 4;
+            regs_[r8] = ReadOrFault(address, 4);
+            cycles_++;
+            break;
+
+        case 0x0a:
+        case 0x0b: {                                // loads and stores, register offset
+            address = regs_[rn] + regs_[(op >> 6) & 7];
+            uint32_t& rt = regs_[rd];
+
+            switch ((op >> 9) & 7) {
+                case 0: WriteOrFault(address, 4, rt);                           break;  // STR
+                case 1: WriteOrFault(address, 2, rt);                           break;  // STRH
+                case 2: WriteOrFault(address, 1, rt);                           break;  // STRB
+                case 3: rt = (int32_t)(int8_t)ReadOrFault(address, 1);          break;  // LDRSB
+                case 4: rt = ReadOrFault(address, 4);                           break;  // LDR
+                case 5: rt = ReadOrFault(address, 2);                           break;  // LDRH
+                case 6: rt = ReadOrFault(address, 1);                           break;  // LDRB
+                case 7: rt = (int32_t)(int16_t)ReadOrFault(address, 2);         break;  // LDRSH
+            }
+            cycles_ += !isIop(address);
+            break;
+        }
+
+        case 0x0c:                                  // STR #imm
+            address = regs_[rn] + imm5 * 4;
+            WriteOrFault(address, 4, regs_[rd]);
+            cycles_ += !isIop(address);
+            break;
+
+        case 0x0d:                                  // LDR #imm
+            address = regs_[rn] + imm5 * 4;
+            regs_[rd] = ReadOrFault(address, 4);
+            cycles_ += !isIop(address);
+            break;
+
+        case 0x0e:                                  // STRB #imm
+            address = regs_[rn] + imm5;
+            WriteOrFault(address, 1, regs_[rd]);
+            cycles_ += !isIop(address);
+            break;
+
+        case 0x0f:                                  // LDRB #imm
+            address = regs_[rn] + imm5;
+            regs_[rd] = ReadOrFault(address, 1);
+            cycles_ += !isIop(address);
+            break;
+
+        case 0x10:                                  // STRH #imm
+            address = regs_[rn] + imm5 * 2;
+            WriteOrFault(address, 2, regs_[rd]);
+            cycles_ += !isIop(address);
+            break;
+
+        case 0x11:                                  // LDRH #imm
+            address = regs_[rn] + imm5 * 2;
+            regs_[rd] = ReadOrFault(address, 2);
+            cycles_ += !isIop(address);
+            break;
+
+        case 0x12:                                  // STR SP-relative
+            WriteOrFault(regs_[13] + imm8 * 4, 4, regs_[r8]);
+            cycles_++;
+            break;
+
+        case 0x13:                                  // LDR SP-relative
+            regs_[r8] = ReadOrFault(regs_[13] + imm8 * 4, 4);
+            cycles_++;
+            break;
+
+        case 0x14:                                  // ADR
+            regs_[r8] = ((pc + 4) & ~3) + imm8 * 4;
+            break;
+
+        case 0x15:                                  // ADD Rd, SP, #imm8
+            regs_[r8] = regs_[13] + imm8 * 4;
+            break;
+
+        case 0x16:
+        case 0x17:
+            ExecuteMisc(op);
+            break;
+
+        case 0x18: {                                // STM Rn!
+            address = regs_[r8];
+            for (int r = 0; r < 8; r++) {
+                if (op & (1 << r)) {
+                    WriteOrFault(address, 4, regs_[r]);
+                    address += 4;
+                    cycles_++;
+                }
+            }
+            regs_[r8] = address;
+            break;
+        }
+
+        case 0x19: {                                // LDM Rn, with writeback unless loaded
+            address = regs_[r8];
+            for (int r = 0; r < 8; r++) {
+                if (op & (1 << r)) {
+                    regs_[r] = ReadOrFault(address, 4);
+                    address += 4;
+                    cycles_++;
+                }
+            }
+            if (!(op & (1 << r8))) {
+                regs_[r8] = address;
+            }
+            break;
+        }
+
+        case 0x1a:
+        case 0x1b: {                                // B<cond>, UDF and SVC
+            int cond = (op >> 8) & 15;
+            if (cond == 15) {
+                SetPending(EXCEPTION_SVCALL);
+            }
+            else if (cond == 14) {
+                fault_ = "undefined instruction";
+            }
+            else if (conditionPassed(cond, n_, z_, c_, v_)) {
+                BranchTo(pc + 4 + ((int32_t)(int8_t)imm8 << 1));
+            }
+            break;
+        }
+
+        case 0x1c: {                                // B
+            int32_t offset = (int32_t)((uint32_t)(op & 0x7ff) << 21) >> 20;
+            BranchTo(pc + 4 + offset);
+            break;
+        }
+
+        case 0x1e:
+        case 0x1f:
+            Execute32(op, ReadOrFault(pc + 2, 2));
+            break;
+
+        default:
+            fault_ = "undefined instruction";
+            break;
+    }
+}
+
+void CortexM0::Step() {
+    took_exception_ = false;
+    returned_from_exception_ = false;
+
+    if (fault_) {
+        return;
+    }
+
+    int exception = PendingException(false);
+    if (exception != NO_EXCEPTION) {
+        EnterException(exception);
+        took_exception_ = true;
+        return;
+    }
+
+    if (sleeping_) {
+        return;
+    }
+
+    uint32_t pc = regs_[15];
+    uint16_t op = ReadOrFault(pc, 2);
+    if (fault_) {
+        return;
+    }
+
+    next_pc_ = pc + 2;
+    Execute(op);
+
+    // A faulting instruction is left at the PC, for the report
+    if (!fault_) {
+        regs_[15] = next_pc_;
+    }
+}
@@ -0,0 +1,125 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* Cortex-M0+ core header - ARMv6-M instruction set simulator, with cycle counts */
+
+#if !defined(__CORTEX_M0_H__)
+#define __CORTEX_M0_H__
+
+#include <stdint.h>
+
+#define EXCEPTION_HARD_FAULT    3
+#define EXCEPTION_SVCALL        11
+#define EXCEPTION_PENDSV        14
+#define EXCEPTION_SYSTICK       15
+#define EXCEPTION_IRQ0          16
+#define EXCEPTION_COUNT         48
+
+class CortexM0;
+
+// Everything outside the core: memory, and peripherals other than the NVIC
+// and SCB. Accesses are 1, 2 or 4 bytes, aligned; returning false faults.
+class CortexM0Bus {
+    public:
+        virtual bool Read(uint32_t address, int size, uint32_t& value) = 0;
+        virtual bool Write(uint32_t address, int size, uint32_t value) = 0;
+
+        // BKPT: stands in for code the bus models natively, such as a ROM routine
+        virtual bool Breakpoint(CortexM0& cpu, int number) = 0;
+};
+
+class CortexM0 {
+    public:
+        CortexM0(CortexM0Bus& bus);
+
+        // Stack pointer and reset vector from the table at address 0
+        void Reset();
+
+        // Executes an instruction or takes an exception; does nothing when
+        // sleeping or stopped
+        void Step();
+
+        // Level sensitive interrupt request lines, one bit per IRQ
+        void SetIrqLines(uint32_t lines)        { irq_lines_ = lines; }
+        void SetPending(int exception)          { pending_ |= 1ULL << exception; }
+
+        bool IsSleeping() const                 { return sleeping_; }
+        bool IsSleepDeep() const                { return scr_ & SCR_SLEEPDEEP; }
+        // Whether an interrupt would end a sleep, even if PRIMASK holds it off
+        bool CanWake();
+        void Wake()                             { sleeping_ = false; }
+
+        const char* Fault() const               { return fault_; }
+        void SetFault(const char* fault)        { fault_ = fault; }
+
+        uint32_t Register(int n) const          { return regs_[n]; }
+        void SetRegister(int n, uint32_t value) { regs_[n] = value; }
+        uint32_t Pc() const                     { return regs_[15]; }
+
+        // Charges extra cycles, e.g. for a modelled ROM routine
+        void AddCycles(uint32_t cycles)         { cycles_ += cycles; }
+        uint64_t Cycles() const                 { return cycles_; }
+
+        // What the last step did, for a profiler following calls
+        bool TookException() const              { return took_exception_; }
+        bool ReturnedFromException() const      { return returned_from_exception_; }
+
+        bool Read(uint32_t address, int size, uint32_t& value);
+        bool Write(uint32_t address, int size, uint32_t value);
+
+    private:
+        enum { SCR_SLEEPDEEP = 0x04 };
+
+        uint32_t ReadOrFault(uint32_t address, int size);
+        void WriteOrFault(uint32_t address, int size, uint32_t value);
+        bool ReadScs(uint32_t offset, uint32_t& value);
+        bool WriteScs(uint32_t offset, uint32_t value);
+
+        int Priority(int exception) const;
+        int ExecutionPriority() const;
+        int PendingException(bool ignore_primask);
+        void EnterException(int exception);
+        void ReturnFromException(uint32_t exc_return);
+        void BranchTo(uint32_t address);
+        void BranchExchange(uint32_t address);
+
+        uint32_t AddWithCarry(uint32_t x, uint32_t y, bool carry_in, bool set_flags);
+        void SetNZ(uint32_t result);
+        uint32_t ShiftRegister(int type, uint32_t value, uint32_t amount);
+
+        void ExecuteDataProcessing(uint16_t op);
+        void ExecuteMisc(uint16_t op);
+        void Execute32(uint16_t hw1, uint16_t hw2);
+        void Execute(uint16_t op);
+
+        CortexM0Bus&    bus_;
+
+        uint32_t    regs_[16];
+        uint32_t    other_sp_;              // the banked stack pointer not in use
+        bool        n_, z_, c_, v_;
+        bool        primask_;
+        uint32_t    control_;
+        int         ipsr_;                  // current exception, 0 in thread mode
+
+        uint64_t    pending_;
+        uint64_t    active_;
+        uint32_t    irq_lines_;
+        uint32_t    nvic_enabled_;
+        uint8_t     nvic_priority_[32];
+        uint32_t    shpr2_, shpr3_;
+        uint32_t    scr_;
+        uint32_t    vtor_;
+
+        bool        sleeping_;
+        const char* fault_;
+        uint64_t    cycles_;
+        uint32_t    next_pc_;
+        bool        took_exception_;
+        bool        returned_from_exception_;
+};
+
+#endif // #if !defined(__CORTEX_M0_H__)
@@ -0,0 +1,168 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * ELF image loader
+ *
+ * Functions are the symbol table's STT_FUNC entries. Those without a size,
+ * as from hand written assembly, run to the next function or section end.
+ */
+
+#include "elf_image.h"
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cxxabi.h>
+
+#include <algorithm>
+
+static bool byAddress(const ElfFunction& a, const ElfFunction& b) {
+    return a.address < b.address;
+}
+
+static std::string demangle(const char* name) {
+    int status;
+    char* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+
+    if (status != 0 || !demangled) {
+        return name;
+    }
+
+    std::string result(demangled);
+    free(demangled);
+    return result;
+}
+
+static bool readFile(const char* path, std::vector<uint8_t>& contents) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    uint8_t buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.insert(contents.end(), buffer, buffer + length);
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool ElfImage::Load(const char* path, std::string& error) {
+    std::vector<uint8_t> file;
+
+    chunks_.clear();
+    functions_.clear();
+
+    if (!readFile(path, file)) {
+        error = std::string("can't read ") + path;
+        return false;
+    }
+
+    const Elf32_Ehdr* header = (const Elf32_Ehdr*)&file[0];
+    if (file.size() < sizeof(Elf32_Ehdr) || memcmp(header->e_ident, ELFMAG, SELFMAG) ||
+        header->e_ident[EI_CLASS] != ELFCLASS32 || header->e_ident[EI_DATA] != ELFDATA2LSB || header->e_machine != EM_ARM) {
+        error = std::string(path) + " isn't a little endian 32 bit ARM ELF file";
+        return false;
+    }
+
+    if (header->e_shoff + (uint64_t)header->e_shnum * sizeof(Elf32_Shdr) > file.size() ||
+        header->e_phoff + (uint64_t)header->e_phnum * sizeof(Elf32_Phdr) > file.size()) {
+        error = std::string(path) + " is truncated";
+        return false;
+    }
+
+    const Elf32_Shdr* sections = (const Elf32_Shdr*)&file[header->e_shoff];
+
+    if (header->e_type == ET_EXEC) {
+        const Elf32_Phdr* segments = (const Elf32_Phdr*)&file[header->e_phoff];
+
+        for (int i = 0; i < header->e_phnum; i++) {
+            const Elf32_Phdr& segment = segments[i];
+
+            if (segment.p_type == PT_LOAD && segment.p_filesz && segment.p_offset + segment.p_filesz <= file.size()) {
+                ElfChunk chunk;
+                chunk.address = segment.p_paddr;
+                chunk.data.assign(&file[segment.p_offset], &file[segment.p_offset] + segment.p_filesz);
+                chunks_.push_back(chunk);
+            }
+        }
+    }
+    else {
+        for (int i = 0; i < header->e_shnum; i++) {
+            const Elf32_Shdr& section = sections[i];
+
+            if (section.sh_type == SHT_PROGBITS && (section.sh_flags & SHF_ALLOC) && section.sh_size &&
+                section.sh_offset + section.sh_size <= file.size()) {
+                ElfChunk chunk;
+                chunk.address = section.sh_addr;
+                chunk.data.assign(&file[section.sh_offset], &file[section.sh_offset] + section.sh_size);
+                chunks_.push_back(chunk);
+            }
+        }
+    }
+
+    for (int i = 0; i < header->e_shnum; i++) {
+        if (sections[i].sh_type != SHT_SYMTAB || sections[i].sh_link >= header->e_shnum) {
+            continue;
+        }
+
+        const Elf32_Shdr& symtab = sections[i];
+        const Elf32_Shdr& strtab = sections[symtab.sh_link];
+        const Elf32_Sym* symbols = (const Elf32_Sym*)&file[symtab.sh_offset];
+        const char* names = (const char*)&file[strtab.sh_offset];
+        int count = symtab.sh_size / sizeof(Elf32_Sym);
+
+        for (int s = 0; s < count; s++) {
+            const Elf32_Sym& symbol = symbols[s];
+
+            if (ELF32_ST_TYPE(symbol.st_info) == STT_FUNC && symbol.st_shndx != SHN_UNDEF && symbol.st_name < strtab.sh_size) {
+                ElfFunction function;
+                function.address = symbol.st_value & ~1;
+                function.size = symbol.st_size;
+                function.name = demangle(names + symbol.st_name);
+                functions_.push_back(function);
+            }
+        }
+    }
+
+    std::sort(functions_.begin(), functions_.end(), byAddress);
+
+    // Aliases, e.g. the startup code's weak handlers, share one entry
+    std::vector<ElfFunction> unique;
+    for (size_t i = 0; i < functions_.size(); i++) {
+        if (!unique.empty() && unique.back().address == functions_[i].address) {
+            unique.back().name += "/" + functions_[i].name;
+            if (functions_[i].size > unique.back().size) {
+                unique.back().size = functions_[i].size;
+            }
+        }
+        else {
+            unique.push_back(functions_[i]);
+        }
+    }
+    functions_.swap(unique);
+
+    for (size_t i = 0; i < functions_.size(); i++) {
+        if (!functions_[i].size) {
+            uint32_t end = i + 1 < functions_.size() ? functions_[i + 1].address : functions_[i].address + 2;
+            for (size_t c = 0; c < chunks_.size(); c++) {
+                uint32_t chunk_end = chunks_[c].address + chunks_[c].data.size();
+                if (functions_[i].address >= chunks_[c].address && functions_[i].address < chunk_end && chunk_end < end) {
+                    end = chunk_end;
+                }
+            }
+            functions_[i].size = end - functions_[i].address;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,45 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* ELF image header - loadable contents and function symbols of an ARM ELF file */
+
+#if !defined(__ELF_IMAGE_H__)
+#define __ELF_IMAGE_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+struct ElfChunk {
+    uint32_t                address;        // load address
+    std::vector<uint8_t>    data;
+};
+
+struct ElfFunction {
+    uint32_t    address;                    // without the Thumb bit
+    uint32_t    size;
+    std::string name;                       // demangled
+};
+
+class ElfImage {
+    public:
+        // False with error set if the file isn't a 32 bit little endian
+        // ARM ELF file. Executables load by their program headers, at the
+        // load address; relocatable objects, e.g. straight from the
+        // assembler, by their sections' addresses.
+        bool Load(const char* path, std::string& error);
+
+        const std::vector<ElfChunk>& Chunks() const         { return chunks_; }
+        const std::vector<ElfFunction>& Functions() const   { return functions_; }
+
+    private:
+        std::vector<ElfChunk>       chunks_;
+        std::vector<ElfFunction>    functions_;
+};
+
+#endif // #if !defined(__ELF_IMAGE_H__)
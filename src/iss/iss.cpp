@@ -0,0 +1,409 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * LPC810 instruction set simulator
+ *
+ * Runs the firmware image, as built for the device, on the modelled core and
+ * peripherals, with the display and button expander models from the device
+ * simulator attached, and profiles it by the image's symbol table.
+ *
+ * Each step's cycles count as the self time of the function holding the PC,
+ * an exception entry's of its handler. Calls are followed with a shadow
+ * stack: landing on a function's first instruction enters it, with the link
+ * register as its return address, and reaching that address at or above the
+ * stack pointer it was entered with leaves it, along with any function tail
+ * called from it. Inclusive times leave out interrupts taken meanwhile.
+ *
+ * Usage: lpc810_iss [-t run_ms] [-b delay_ms:buttons,...] [-n count] [-f filter] [-v vcd] firmware.elf
+ *  -t  virtual time to run for; default 10000 ms
+ *  -b  a button script, as the device simulator's SIM_BUTTONS
+ *  -n  functions to list, by self time; default 30, 0 for all
+ *  -f  list only functions whose names contain this
+ *  -v  dump the I2C bus, GPIOs and power state to this file, as a VCD waveform
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "elf_image.h"
+#include "lpc810.h"
+#include "sim/lcd_model.h"
+#include "sim/mcp_model.h"
+#include "sim/vcd.h"
+
+// As wired, and as used by the firmware
+#define LCD_I2C_ADDR        0x27
+#define LCD_POWER_GPIO      0
+#define INPUT_I2C_ADDR      0x20
+#define INPUT_IRQ_GPIO      1
+#define BUZZER_GPIO         4
+
+#define DEFAULT_RUN_MS      10000
+#define DEFAULT_LIST_COUNT  30
+#define MAX_CALL_DEPTH      64
+
+struct Function {
+    uint32_t    address;
+    uint32_t    size;
+    std::string name;
+
+    uint32_t    calls;
+    uint64_t    self;
+    uint64_t    inclusive;
+    uint64_t    max;                    // inclusive, in one call
+    int         active;                 // frames on the shadow stack
+};
+
+struct Frame {
+    int         function;
+    uint32_t    return_address;         // without the Thumb bit, or EXC_RETURN
+    uint32_t    sp;
+    uint64_t    start;
+    uint64_t    preempted_start;
+    bool        exception;
+};
+
+struct ScriptStep {
+    uint32_t    delay_ms;
+    uint8_t     buttons;
+};
+
+static std::vector<Function>    functions;
+static std::vector<Frame>       frames;
+static uint64_t                 preempted = 0;          // cycles in exception handlers, nested ones once
+static uint64_t                 unknown_cycles = 0;
+
+static std::vector<ScriptStep>  script;
+static size_t                   script_step = 0;
+
+static void usage() {
+    fprintf(stderr, "usage: lpc810_iss [-t run_ms] [-b delay_ms:buttons,...] [-n count] [-f filter] [-v vcd] firmware.elf\n");
+    exit(2);
+}
+
+//----------------------------------------------------------------------------------------
+// Button script
+//
+
+static bool parseScript(const char* text) {
+    while (*text) {
+        char* end;
+        ScriptStep step;
+
+        step.delay_ms = strtoul(text, &end, 0);
+        if (*end != ':') {
+            return false;
+        }
+        step.buttons = strtoul(end + 1, &end, 16);
+        if (*end && *end != ',') {
+            return false;
+        }
+
+        script.push_back(step);
+        text = *end ? end + 1 : end;
+    }
+
+    return true;
+}
+
+static void runStep(void*) {
+    mcpModelSetButtons(script[script_step++].buttons);
+
+    if (script_step < script.size()) {
+        hostSchedule(hostTicks() + (uint64_t)script[script_step].delay_ms * HOST_TICKS_PER_MS, runStep, NULL);
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Profile
+//
+
+static bool byAddress(const Function& a, const Function& b) {
+    return a.address < b.address;
+}
+
+static bool bySelf(const Function* a, const Function* b) {
+    return a->self > b->self;
+}
+
+static void addFunction(uint32_t address, uint32_t size, const std::string& name) {
+    Function function = { address, size, name, 0, 0, 0, 0, 0 };
+    functions.push_back(function);
+}
+
+// The function holding address, or -1
+static int findFunction(uint32_t address) {
+    int low = 0, high = (int)functions.size() - 1;
+
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        const Function& function = functions[middle];
+
+        if (address < function.address) {
+            high = middle - 1;
+        }
+        else if (address >= function.address + function.size) {
+            low = middle + 1;
+        }
+        else {
+            return middle;
+        }
+    }
+
+    return -1;
+}
+
+static void enter(int function, uint32_t return_address, uint32_t sp, uint64_t now, bool exception) {
+    if (frames.size() == MAX_CALL_DEPTH) {
+        return;
+    }
+
+    Frame frame = { function, return_address, sp, now, preempted, exception };
+    frames.push_back(frame);
+    functions[function].calls++;
+    functions[function].active++;
+}
+
+static void leave(uint64_t now) {
+    Frame frame = frames.back();
+    Function& function = functions[frame.function];
+    uint64_t nested = preempted - frame.preempted_start;
+    uint64_t cycles = now - frame.start - nested;
+
+    frames.pop_back();
+
+    // Recursion counts once, in the outermost call
+    if (--function.active == 0) {
+        function.inclusive += cycles;
+    }
+    if (cycles > function.max) {
+        function.max = cycles;
+    }
+    if (frame.exception) {
+        preempted += cycles;
+    }
+}
+
+// Follows calls and returns after a step that began at pc
+static void trace(CortexM0& cpu, uint32_t pc, uint64_t cycles) {
+    uint64_t now = cpu.Cycles();
+    uint32_t new_pc = cpu.Pc();
+    int function = findFunction(cpu.TookException() ? new_pc : pc);
+
+    if (function >= 0) {
+        functions[function].self += cycles;
+    }
+    else {
+        unknown_cycles += cycles;
+    }
+
+    if (cpu.TookException()) {
+        int handler = findFunction(new_pc);
+        if (handler >= 0) {
+            enter(handler, cpu.Register(14), cpu.Register(13), now - cycles, true);
+        }
+        return;
+    }
+
+    if (cpu.ReturnedFromException()) {
+        while (!frames.empty()) {
+            bool exception = frames.back().exception;
+            leave(now);
+            if (exception) {
+                break;
+            }
+        }
+        return;
+    }
+
+    if (new_pc == pc) {
+        return;
+    }
+
+    while (!frames.empty() && frames.back().return_address == new_pc && cpu.Register(13) >= frames.back().sp) {
+        leave(now);
+    }
+
+    int callee = findFunction(new_pc);
+    if (callee >= 0 && functions[callee].address == new_pc && callee != findFunction(pc)) {
+        enter(callee, cpu.Register(14) & ~1, cpu.Register(13), now, false);
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Report
+//
+
+static void reportState(const char* name, const HostStats& stats, HostPowerState state) {
+    double ms = (double)stats.state_ticks[state] / HOST_TICKS_PER_MS;
+
+    printf("%-16s %14.3f ms %8.4f%% %10u entries\n", name, ms,
+           stats.ticks ? 100.0 * stats.state_ticks[state] / stats.ticks : 0.0, stats.state_entries[state]);
+}
+
+static void report(Lpc810& board, int count, const char* filter) {
+    const HostStats& stats = board.Stats();
+    uint64_t total = board.Cpu().Cycles();
+    uint64_t ms = board.Ticks() / HOST_TICKS_PER_MS;
+
+    while (!frames.empty()) {
+        leave(total);
+    }
+
+    printf("\nended            %s\n", board.StopReason());
+    printf("virtual time     %u:%02u:%02u.%03u\n", (unsigned)(ms / 3600000), (unsigned)(ms / 60000 % 60),
+           (unsigned)(ms / 1000 % 60), (unsigned)(ms % 1000));
+    printf("cycles           %llu\n", (unsigned long long)total);
+
+    reportState("awake", stats, HOST_AWAKE);
+    reportState("sleep", stats, HOST_SLEEP);
+    reportState("deep sleep", stats, HOST_DEEP_SLEEP);
+    reportState("power down", stats, HOST_POWER_DOWN);
+
+    printf("i2c              %u transactions, %u bytes, %.3f ms on the bus\n",
+           stats.i2c_transfers, stats.i2c_bytes, (double)stats.i2c_ticks / HOST_TICKS_PER_MS);
+
+    std::vector<const Function*> listed;
+    for (size_t i = 0; i < functions.size(); i++) {
+        if (functions[i].self && (!filter || functions[i].name.find(filter) != std::string::npos)) {
+            listed.push_back(&functions[i]);
+        }
+    }
+    std::sort(listed.begin(), listed.end(), bySelf);
+    if (count && (int)listed.size() > count) {
+        listed.resize(count);
+    }
+
+    printf("\n%10s %12s %7s %12s %10s %10s  %s\n", "calls", "self", "self%", "inclusive", "per call", "max", "function");
+    for (size_t i = 0; i < listed.size(); i++) {
+        const Function& function = *listed[i];
+
+        printf("%10u %12llu %6.2f%% %12llu %10.1f %10llu  %s\n", function.calls, (unsigned long long)function.self,
+               total ? 100.0 * function.self / total : 0.0, (unsigned long long)function.inclusive,
+               function.calls ? (double)function.inclusive / function.calls : 0.0, (unsigned long long)function.max,
+               function.name.c_str());
+    }
+    if (unknown_cycles && !filter) {
+        printf("%10s %12llu %6.2f%% %12s %10s %10s  %s\n", "", (unsigned long long)unknown_cycles,
+               total ? 100.0 * unknown_cycles / total : 0.0, "", "", "", "(no symbol)");
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Main
+//
+
+int main(int argc, char* argv[]) {
+    uint32_t run_ms = DEFAULT_RUN_MS;
+    int count = DEFAULT_LIST_COUNT;
+    const char* filter = NULL;
+    const char* vcd = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "t:b:n:f:v:")) != -1) {
+        switch (option) {
+            case 't':
+                run_ms = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'b':
+                if (!parseScript(optarg)) {
+                    fprintf(stderr, "lpc810_iss: bad button script step at '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'n':
+                count = atoi(optarg);
+                break;
+
+            case 'f':
+                filter = optarg;
+                break;
+
+            case 'v':
+                vcd = optarg;
+                break;
+
+            default:
+                usage();
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage();
+    }
+
+    ElfImage image;
+    std::string error;
+    if (!image.Load(argv[optind], error)) {
+        fprintf(stderr, "lpc810_iss: %s\n", error.c_str());
+        return 1;
+    }
+
+    Lpc810 board;
+    for (size_t i = 0; i < image.Chunks().size(); i++) {
+        const ElfChunk& chunk = image.Chunks()[i];
+
+        if (!board.LoadFlash(chunk.address, &chunk.data[0], chunk.data.size())) {
+            fprintf(stderr, "lpc810_iss: %u bytes at 0x%08x don't fit in flash\n", (unsigned)chunk.data.size(), chunk.address);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < image.Functions().size(); i++) {
+        const ElfFunction& function = image.Functions()[i];
+        addFunction(function.address, function.size, function.name);
+    }
+    for (size_t i = 0; i < board.RomRoutines().size(); i++) {
+        addFunction(board.RomRoutines()[i].address, 4, board.RomRoutines()[i].name);
+    }
+    std::sort(functions.begin(), functions.end(), byAddress);
+
+    board.Reset();
+    board.SetRunLimit((uint64_t)run_ms * HOST_TICKS_PER_MS);
+
+    lcdModelAttach(LCD_I2C_ADDR, LCD_POWER_GPIO);
+    mcpModelAttach(INPUT_I2C_ADDR, INPUT_IRQ_GPIO);
+    if (!script.empty()) {
+        hostSchedule((uint64_t)script[0].delay_ms * HOST_TICKS_PER_MS, runStep, NULL);
+    }
+    if (vcd && !vcdOpen(vcd, LCD_POWER_GPIO, INPUT_IRQ_GPIO, BUZZER_GPIO)) {
+        fprintf(stderr, "lpc810_iss: can't write %s\n", vcd);
+        return 1;
+    }
+
+    CortexM0& cpu = board.Cpu();
+    int reset = findFunction(cpu.Pc());
+    if (reset >= 0) {
+        enter(reset, 0xffffffff, cpu.Register(13), 0, false);
+    }
+
+    for (;;) {
+        uint32_t pc = cpu.Pc();
+        uint64_t cycles = cpu.Cycles();
+        bool sleeping = cpu.IsSleeping();
+
+        if (!board.Step()) {
+            break;
+        }
+        if (!sleeping) {
+            trace(cpu, pc, cpu.Cycles() - cycles);
+        }
+    }
+
+    vcdClose();
+    report(board, count, filter);
+    return 0;
+}
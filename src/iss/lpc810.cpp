@@ -0,0 +1,1050 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * LPC810 model
+ *
+ * Flash, RAM and enough of the peripherals for the firmware: GPIO, pin
+ * interrupts, the MRT, SysTick, the WKT and USART0 output, with SYSCON, SWM,
+ * IOCON, PMU and the rest of the APB peripherals taken as plain registers.
+ * Anything else faults, to show what the firmware touched that isn't modelled.
+ *
+ * The ROM API table points at stubs of BKPT and BX LR, and each BKPT runs
+ * the routine here: the I2C driver's set up calls and polled transfers, the
+ * transfers handed to attached device models and charged the bus time at
+ * the set bit rate, as that is what their poll loops spend. Interrupts due
+ * in a transfer are taken after it.
+ *
+ * Deep sleep and power-down stop the main clock, so the MRT and SysTick hold;
+ * a pin interrupt enabled in STARTERP0, or the WKT running out with its
+ * wake-up enabled in STARTERP1, wakes the device.
+ */
+
+#include "lpc810.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define NEVER                   UINT64_MAX
+
+#define APB_BASE                0x40000000
+#define APB_END                 0x40080000
+#define MRT_BASE                0x40004000
+#define WKT_BASE                0x40008000
+#define SYSCON_BASE             0x40048000
+#define USART0_BASE             0x40064000
+#define GPIO_BASE               0xa0000000
+#define PIN_INT_BASE            0xa0004000
+#define PIN_INT_END             0xa0004030
+#define SYSTICK_BASE            0xe000e010
+#define SYSTICK_END             0xe000e020
+
+#define SYSCON_PINTSEL          0x178
+#define SYSCON_STARTERP0        0x204
+#define SYSCON_STARTERP1        0x214
+#define STARTERP1_WKT           (1 << 15)
+#define SYSCON_DEVICE_ID        0x3f8
+#define LPC810M021FN8_ID        0x00008100
+
+#define PMU_PCON                (0x40020000 + 0x00)
+#define PCON_PM_MASK            0x03
+#define PCON_POWER_DOWN         0x02
+#define PCON_DEEP_POWER_DOWN    0x03
+
+#define MRT_IRQ                 10
+#define WKT_IRQ                 15
+#define PININT0_IRQ             24
+
+#define MRT_INTVAL_LOAD         (1UL << 31)
+#define MRT_INTVAL_MASK         0x7fffffff
+#define MRT_CTRL_INTEN          0x01
+#define MRT_CTRL_ONE_SHOT       0x02
+#define MRT_STAT_INTFLAG        0x01
+#define MRT_STAT_RUN            0x02
+
+#define SYSTICK_ENABLE          0x01
+#define SYSTICK_TICKINT         0x02
+#define SYSTICK_COUNTFLAG       (1 << 16)
+#define SYSTICK_MASK            0x00ffffff
+
+#define WKT_CTRL_ALARMFLAG      0x02
+#define WKT_CTRL_CLEARCTR       0x04
+#define WKT_CLOCK_HZ            10000
+
+#define USART_STAT_TXRDY        0x04
+#define USART_STAT_TXIDLE       0x08
+#define USART_TXDATA            0x1c
+
+#define GPIO_PINS               18
+#define GPIO_PIN_MASK           ((1 << GPIO_PINS) - 1)
+
+// ROM layout, within the ROM from LPC810_ROM_BASE
+#define ROM_STUBS               0x1fff1000
+#define ROM_I2CD_TABLE          0x1fff1e00
+#define ROM_API_TABLE           0x1fff1f00
+#define ROM_API_POINTER         0x1fff1ff8
+#define ROM_API_I2CD_ENTRY      5
+
+#define BKPT                    0xbe00
+#define BX_LR                   0x4770
+
+#define LPC_OK                  0
+#define ERR_I2C_NAK             0x00060001
+#define ERR_NOT_MODELLED        0x00060007      // ERR_I2C_GENERAL_FAILURE
+
+#define I2C_BYTE_BITS           9
+#define I2C_CONDITION_BITS      1
+#define ROM_CALL_CYCLES         20              // a guess at the driver's own overhead
+
+// The I2C driver's table, in order
+enum I2cRoutine {
+    I2C_ISR_HANDLER,
+    I2C_MASTER_TRANSMIT_POLL,
+    I2C_MASTER_RECEIVE_POLL,
+    I2C_MASTER_TX_RX_POLL,
+    I2C_MASTER_TRANSMIT_INTR,
+    I2C_MASTER_RECEIVE_INTR,
+    I2C_MASTER_TX_RX_INTR,
+    I2C_SLAVE_RECEIVE_POLL,
+    I2C_SLAVE_TRANSMIT_POLL,
+    I2C_SLAVE_RECEIVE_INTR,
+    I2C_SLAVE_TRANSMIT_INTR,
+    I2C_SET_SLAVE_ADDR,
+    I2C_GET_MEM_SIZE,
+    I2C_SETUP,
+    I2C_SET_BITRATE,
+    I2C_GET_FIRMWARE_VERSION,
+    I2C_GET_STATUS,
+    I2C_SET_TIMEOUT,
+    I2C_ROUTINES
+};
+
+static const char* i2c_routine_names[I2C_ROUTINES] = {
+    "i2c_isr_handler",
+    "i2c_master_transmit_poll",
+    "i2c_master_receive_poll",
+    "i2c_master_tx_rx_poll",
+    "i2c_master_transmit_intr",
+    "i2c_master_receive_intr",
+    "i2c_master_tx_rx_intr",
+    "i2c_slave_receive_poll",
+    "i2c_slave_transmit_poll",
+    "i2c_slave_receive_intr",
+    "i2c_slave_transmit_intr",
+    "i2c_set_slave_addr",
+    "i2c_get_mem_size",
+    "i2c_setup",
+    "i2c_set_bitrate",
+    "i2c_get_firmware_version",
+    "i2c_get_status",
+    "i2c_set_timeout",
+};
+
+// I2C_PARAM_T, as in rom_i2c_8xx.h
+#define PARAM_NUM_BYTES_SEND    0x00
+#define PARAM_NUM_BYTES_REC     0x04
+#define PARAM_BUFFER_PTR_SEND   0x08
+#define PARAM_BUFFER_PTR_REC    0x0c
+#define RESULT_N_BYTES_SENT     0x00
+#define RESULT_N_BYTES_RECD     0x04
+#define I2C_MAX_TRANSFER        64
+
+static Lpc810* board = NULL;
+
+Lpc810::Lpc810() : cpu_(*this) {
+    memset(flash_, 0xff, sizeof(flash_));
+    memset(ram_, 0, sizeof(ram_));
+    BuildRom();
+
+    board = this;
+    Reset();
+}
+
+bool Lpc810::LoadFlash(uint32_t address, const uint8_t* data, uint32_t length) {
+    if (address > LPC810_FLASH_SIZE || length > LPC810_FLASH_SIZE - address) {
+        return false;
+    }
+
+    memcpy(flash_ + address, data, length);
+    return true;
+}
+
+void Lpc810::Reset() {
+    time_ = clock_ = synced_cycles_ = 0;
+    run_limit_          = NEVER;
+    next_timer_         = NEVER;
+    next_scheduled_     = NEVER;
+    stop_reason_        = NULL;
+    power_state_        = HOST_AWAKE;
+    i2c_bitrate_        = 100000;
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.state_entries[HOST_AWAKE] = 1;
+
+    plain_registers_.clear();
+    memset(mrt_, 0, sizeof(mrt_));
+    systick_ctrl_ = systick_load_ = systick_val_ = 0;
+    systick_deadline_ = NEVER;
+    gpio_out_ = gpio_dir_ = gpio_mask_ = 0;
+    gpio_in_ = GPIO_PIN_MASK;           // pulled up
+    pin_int_isel_ = pin_int_ienr_ = pin_int_ienf_ = pin_int_rise_ = pin_int_fall_ = 0;
+    wkt_ctrl_ = wkt_count_ = 0;
+    wkt_start_ = 0;
+    wkt_running_ = false;
+
+    cpu_.Reset();
+}
+
+//----------------------------------------------------------------------------------------
+// ROM
+//
+
+void Lpc810::BuildRom() {
+    memset(rom_, 0xff, sizeof(rom_));
+    rom_routines_.clear();
+
+    uint32_t api_table[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint32_t i2cd_table[I2C_ROUTINES];
+
+    for (int i = 0; i < I2C_ROUTINES; i++) {
+        uint32_t stub = ROM_STUBS + i * 4;
+        uint16_t code[2] = { (uint16_t)(BKPT | i), BX_LR };
+
+        memcpy(rom_ + stub - LPC810_ROM_BASE, code, sizeof(code));
+        i2cd_table[i] = stub | 1;
+
+        Lpc810RomRoutine routine = { stub, std::string("rom ") + i2c_routine_names[i] };
+        rom_routines_.push_back(routine);
+    }
+
+    api_table[ROM_API_I2CD_ENTRY] = ROM_I2CD_TABLE;
+    uint32_t api_pointer = ROM_API_TABLE;
+
+    memcpy(rom_ + ROM_I2CD_TABLE - LPC810_ROM_BASE, i2cd_table, sizeof(i2cd_table));
+    memcpy(rom_ + ROM_API_TABLE - LPC810_ROM_BASE, api_table, sizeof(api_table));
+    memcpy(rom_ + ROM_API_POINTER - LPC810_ROM_BASE, &api_pointer, sizeof(api_pointer));
+}
+
+bool Lpc810::Breakpoint(CortexM0& cpu, int number) {
+    uint32_t pc = cpu.Pc();
+    if (pc < ROM_STUBS || pc >= ROM_STUBS + I2C_ROUTINES * 4) {
+        return false;
+    }
+
+    uint32_t result = LPC_OK;
+    cpu.AddCycles(ROM_CALL_CYCLES);
+
+    switch (number) {
+        case I2C_MASTER_TRANSMIT_POLL:
+            result = I2cTransfer(cpu, true, false) ? LPC_OK : ERR_I2C_NAK;
+            break;
+
+        case I2C_MASTER_RECEIVE_POLL:
+            result = I2cTransfer(cpu, false, true) ? LPC_OK : ERR_I2C_NAK;
+            break;
+
+        case I2C_MASTER_TX_RX_POLL:
+            result = I2cTransfer(cpu, true, true) ? LPC_OK : ERR_I2C_NAK;
+            break;
+
+        case I2C_GET_MEM_SIZE:
+            result = 96;
+            break;
+
+        case I2C_SETUP:
+            result = cpu.Register(1);           // the handle is the RAM it was given
+            break;
+
+        case I2C_SET_BITRATE:
+            if (cpu.Register(2)) {
+                i2c_bitrate_ = cpu.Register(2);
+            }
+            else {
+                result = ERR_NOT_MODELLED;
+            }
+            break;
+
+        case I2C_GET_FIRMWARE_VERSION:
+            result = 0x00010000;
+            break;
+
+        case I2C_GET_STATUS:
+        case I2C_SET_TIMEOUT:
+            break;
+
+        default:
+            fprintf(stderr, "iss: ROM %s isn't modelled\n", i2c_routine_names[number]);
+            result = ERR_NOT_MODELLED;
+            break;
+    }
+
+    cpu.SetRegister(0, result);
+    return true;
+}
+
+// A polled master transfer: the address byte leads the send buffer, or the
+// receive buffer for a read alone, and received bytes follow it
+bool Lpc810::I2cTransfer(CortexM0& cpu, bool send, bool receive) {
+    uint32_t param = cpu.Register(1);
+    uint32_t result = cpu.Register(2);
+    uint32_t send_count = 0, receive_count = 0, send_buffer = 0, receive_buffer = 0;
+
+    Read(param + PARAM_NUM_BYTES_SEND, 4, send_count);
+    Read(param + PARAM_NUM_BYTES_REC, 4, receive_count);
+    Read(param + PARAM_BUFFER_PTR_SEND, 4, send_buffer);
+    Read(param + PARAM_BUFFER_PTR_REC, 4, receive_buffer);
+
+    if (!send) {
+        send_count = 0;
+    }
+    if (!receive) {
+        receive_count = 0;
+    }
+    if (send_count > I2C_MAX_TRANSFER || receive_count > I2C_MAX_TRANSFER || (send_count == 0 && receive_count == 0)) {
+        cpu.SetFault("bad I2C transfer parameters");
+        return false;
+    }
+
+    uint8_t sent[I2C_MAX_TRANSFER];
+    uint8_t received[I2C_MAX_TRANSFER];
+    uint32_t byte;
+    for (uint32_t i = 0; i < send_count; i++) {
+        Read(send_buffer + i, 1, byte);
+        sent[i] = byte;
+    }
+
+    uint32_t addr_byte;
+    Read(send_count ? send_buffer : receive_buffer, 1, addr_byte);
+    const HostI2cDevice* device = FindDevice(addr_byte >> 1);
+
+    // The devices see the transfer once the bus time has passed
+    SyncTime();
+    uint64_t start = time_;
+    BusTime(send_count + receive_count, send_count && receive_count ? 3 : 2);
+    SyncTime();
+
+    bool ack = true;
+    if (send_count > 1 && device) {
+        ack = device->write(sent + 1, send_count - 1);
+    }
+
+    memset(received, 0, sizeof(received));
+    if (receive_count > 1) {
+        if (ack && device) {
+            ack = device->read(received + 1, receive_count - 1);
+        }
+        for (uint32_t i = 1; i < receive_count; i++) {
+            Write(receive_buffer + i, 1, received[i]);
+        }
+    }
+
+    Write(result + RESULT_N_BYTES_SENT, 4, send_count);
+    Write(result + RESULT_N_BYTES_RECD, 4, receive_count);
+
+    HostI2cTransfer transfer = { start, i2c_bitrate_, (uint8_t)(addr_byte >> 1),
+                                 sent + 1, send_count ? (int)send_count - 1 : 0,
+                                 received + 1, receive_count ? (int)receive_count - 1 : 0, !ack };
+    for (size_t i = 0; i < i2c_watchers_.size(); i++) {
+        i2c_watchers_[i](transfer);
+    }
+
+    return ack;
+}
+
+void Lpc810::BusTime(int bytes, int conditions) {
+    uint32_t bits = bytes * I2C_BYTE_BITS + conditions * I2C_CONDITION_BITS;
+    uint32_t ticks = (uint64_t)bits * FIXED_CLOCK_RATE_HZ / i2c_bitrate_;
+
+    stats_.i2c_transfers++;
+    stats_.i2c_bytes += bytes;
+    stats_.i2c_ticks += ticks;
+    cpu_.AddCycles(ticks);
+}
+
+const HostI2cDevice* Lpc810::FindDevice(uint8_t addr) const {
+    for (size_t i = 0; i < i2c_devices_.size(); i++) {
+        if (i2c_devices_[i]->addr == addr) {
+            return i2c_devices_[i];
+        }
+    }
+
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------
+// Memory map
+//
+
+bool Lpc810::Read(uint32_t address, int size, uint32_t& value) {
+    const uint8_t* memory = NULL;
+
+    if (address < LPC810_FLASH_SIZE) {
+        memory = flash_ + address;
+    }
+    else if (address - LPC810_RAM_BASE < LPC810_RAM_SIZE) {
+        memory = ram_ + (address - LPC810_RAM_BASE);
+    }
+    else if (address - LPC810_ROM_BASE < LPC810_ROM_SIZE) {
+        memory = rom_ + (address - LPC810_ROM_BASE);
+    }
+
+    if (memory) {
+        switch (size) {
+            case 1:  value = *memory;                           break;
+            case 2:  value = memory[0] | (memory[1] << 8);      break;
+            default: memcpy(&value, memory, 4);                 break;
+        }
+        return true;
+    }
+
+    // GPIO has byte registers; the rest are words, read in part
+    uint32_t word;
+    if (address >= GPIO_BASE && address < GPIO_BASE + 0x4000) {
+        if (!ReadGpio(address - GPIO_BASE, value)) {
+            return false;
+        }
+    }
+    else if (!ReadPeripheral(address & ~3, word)) {
+        return false;
+    }
+    else {
+        value = word >> ((address & 3) * 8);
+    }
+
+    if (size < 4) {
+        value &= (1UL << (size * 8)) - 1;
+    }
+
+    return true;
+}
+
+bool Lpc810::Write(uint32_t address, int size, uint32_t value) {
+    if (address - LPC810_RAM_BASE < LPC810_RAM_SIZE) {
+        uint8_t* memory = ram_ + (address - LPC810_RAM_BASE);
+
+        switch (size) {
+            case 1:  *memory = value;                                   break;
+            case 2:  memory[0] = value; memory[1] = value >> 8;         break;
+            default: memcpy(memory, &value, 4);                         break;
+        }
+        return true;
+    }
+
+    if (address >= GPIO_BASE && address < GPIO_BASE + 0x4000) {
+        return WriteGpio(address - GPIO_BASE, value, size);
+    }
+
+    if (size < 4) {
+        uint32_t word;
+        int shift = (address & 3) * 8;
+        uint32_t mask = ((1UL << (size * 8)) - 1) << shift;
+
+        if (!ReadPeripheral(address & ~3, word)) {
+            return false;
+        }
+        value = (word & ~mask) | ((value << shift) & mask);
+    }
+
+    return WritePeripheral(address & ~3, value);
+}
+
+static bool isPlainRegister(uint32_t address) {
+    return address >= APB_BASE && address < APB_END && (address < MRT_BASE || address >= MRT_BASE + 0x4000) &&
+           (address < WKT_BASE || address >= WKT_BASE + 0x4000) && (address < USART0_BASE || address >= USART0_BASE + 0x4000);
+}
+
+bool Lpc810::ReadPeripheral(uint32_t address, uint32_t& value) {
+    if (address >= PIN_INT_BASE && address < PIN_INT_END) {
+        return ReadPinInt(address - PIN_INT_BASE, value);
+    }
+    if (address >= MRT_BASE && address < MRT_BASE + LPC810_MRT_CHANNELS * 0x10) {
+        return ReadMrt(address - MRT_BASE, value);
+    }
+    if (address >= SYSTICK_BASE && address < SYSTICK_END) {
+        return ReadSysTick(address - SYSTICK_BASE, value);
+    }
+
+    switch (address) {
+        case WKT_BASE + 0x00:
+            value = wkt_ctrl_;
+            return true;
+
+        case WKT_BASE + 0x0c: {
+            uint64_t elapsed = (time_ - wkt_start_) * WKT_CLOCK_HZ / FIXED_CLOCK_RATE_HZ;
+            value = !wkt_running_ ? wkt_count_ : elapsed < wkt_count_ ? wkt_count_ - elapsed : 0;
+            return true;
+        }
+
+        case USART0_BASE + 0x08:
+            value = USART_STAT_TXRDY | USART_STAT_TXIDLE;
+            return true;
+
+        case SYSCON_BASE + SYSCON_DEVICE_ID:
+            value = LPC810M021FN8_ID;
+            return true;
+    }
+
+    if (address >= USART0_BASE && address < USART0_BASE + 0x30) {
+        value = plain_registers_[address];
+        return true;
+    }
+
+    if (isPlainRegister(address)) {
+        value = plain_registers_[address];
+        return true;
+    }
+
+    return false;
+}
+
+bool Lpc810::WritePeripheral(uint32_t address, uint32_t value) {
+    if (address >= PIN_INT_BASE && address < PIN_INT_END) {
+        return WritePinInt(address - PIN_INT_BASE, value);
+    }
+    if (address >= MRT_BASE && address < MRT_BASE + LPC810_MRT_CHANNELS * 0x10) {
+        return WriteMrt(address - MRT_BASE, value);
+    }
+    if (address >= SYSTICK_BASE && address < SYSTICK_END) {
+        return WriteSysTick(address - SYSTICK_BASE, value);
+    }
+
+    switch (address) {
+        case WKT_BASE + 0x00:
+            if (value & WKT_CTRL_CLEARCTR) {
+                wkt_running_ = false;
+                wkt_count_ = 0;
+            }
+            wkt_ctrl_ = (value & 0x01) | (wkt_ctrl_ & WKT_CTRL_ALARMFLAG & ~value);
+            Reschedule();
+            UpdateIrqLines();
+            return true;
+
+        case WKT_BASE + 0x0c:
+            wkt_count_ = value;
+            wkt_start_ = time_;
+            wkt_running_ = true;
+            Reschedule();
+            return true;
+
+        case USART0_BASE + USART_TXDATA:
+            putchar(value & 0xff);
+            return true;
+    }
+
+    if ((address >= USART0_BASE && address < USART0_BASE + 0x30) || isPlainRegister(address)) {
+        plain_registers_[address] = value;
+        return true;
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------------------
+// MRT and SysTick
+//
+
+bool Lpc810::ReadMrt(uint32_t offset, uint32_t& value) {
+    MrtChannel& channel = mrt_[offset >> 4];
+
+    switch (offset & 0x0c) {
+        case 0x0: value = channel.intval;                                               break;
+        case 0x4: value = channel.running ? (uint32_t)(channel.deadline - clock_) : 0;  break;
+        case 0x8: value = channel.ctrl;                                                 break;
+        default:  value = (channel.flag ? MRT_STAT_INTFLAG : 0) | (channel.running ? MRT_STAT_RUN : 0); break;
+    }
+
+    return true;
+}
+
+bool Lpc810::WriteMrt(uint32_t offset, uint32_t value) {
+    MrtChannel& channel = mrt_[offset >> 4];
+
+    switch (offset & 0x0c) {
+        case 0x0:
+            // Loads at once with LOAD set or when idle; 0 stops the channel
+            channel.intval = value & MRT_INTVAL_MASK;
+            if ((value & MRT_INTVAL_LOAD) || !channel.running) {
+                channel.running = channel.intval != 0;
+                channel.deadline = clock_ + channel.intval;
+            }
+            break;
+
+        case 0x4:
+            return false;
+
+        case 0x8:
+            channel.ctrl = value & 0x07;
+            break;
+
+        default:
+            if (value & MRT_STAT_INTFLAG) {
+                channel.flag = false;
+            }
+            break;
+    }
+
+    Reschedule();
+    UpdateIrqLines();
+    return true;
+}
+
+bool Lpc810::ReadSysTick(uint32_t offset, uint32_t& value) {
+    switch (offset) {
+        case 0x0:
+            value = systick_ctrl_;
+            systick_ctrl_ &= ~SYSTICK_COUNTFLAG;
+            return true;
+
+        case 0x4:
+            value = systick_load_;
+            return true;
+
+        case 0x8:
+            if (systick_ctrl_ & SYSTICK_ENABLE) {
+                uint64_t remaining = systick_deadline_ - clock_;
+                value = remaining > systick_load_ ? 0 : (uint32_t)remaining;
+            }
+            else {
+                value = systick_val_;
+            }
+            return true;
+
+        default:
+            value = 0;                          // CALIB: no reference clock
+            return true;
+    }
+}
+
+bool Lpc810::WriteSysTick(uint32_t offset, uint32_t value) {
+    uint32_t val;
+
+    switch (offset) {
+        case 0x0:
+            ReadSysTick(0x8, val);
+            if ((value & SYSTICK_ENABLE) && !(systick_ctrl_ & SYSTICK_ENABLE)) {
+                // From zero, the counter reloads on the first clock
+                systick_deadline_ = clock_ + (systick_val_ ? systick_val_ : systick_load_ + 1);
+            }
+            else if (!(value & SYSTICK_ENABLE) && (systick_ctrl_ & SYSTICK_ENABLE)) {
+                systick_val_ = val;
+                systick_deadline_ = NEVER;
+            }
+            systick_ctrl_ = (systick_ctrl_ & SYSTICK_COUNTFLAG) | (value & 0x07);
+            break;
+
+        case 0x4:
+            systick_load_ = value & SYSTICK_MASK;
+            break;
+
+        case 0x8:
+            systick_val_ = 0;
+            systick_ctrl_ &= ~SYSTICK_COUNTFLAG;
+            if (systick_ctrl_ & SYSTICK_ENABLE) {
+                systick_deadline_ = clock_ + systick_load_ + 1;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    Reschedule();
+    return true;
+}
+
+//----------------------------------------------------------------------------------------
+// GPIO and pin interrupts
+//
+
+bool Lpc810::PinLevel(int pin) const {
+    uint32_t levels = (gpio_out_ & gpio_dir_) | (gpio_in_ & ~gpio_dir_);
+    return (levels >> pin) & 1;
+}
+
+bool Lpc810::ReadGpio(uint32_t offset, uint32_t& value) {
+    uint32_t levels = ((gpio_out_ & gpio_dir_) | (gpio_in_ & ~gpio_dir_)) & GPIO_PIN_MASK;
+
+    if (offset < GPIO_PINS) {
+        value = (levels >> offset) & 1;                         // B0
+    }
+    else if (offset >= 0x1000 && offset < 0x1000 + GPIO_PINS * 4) {
+        value = (levels >> ((offset - 0x1000) / 4)) & 1 ? 0xffffffff : 0;   // W0
+    }
+    else {
+        switch (offset) {
+            case 0x2000: value = gpio_dir_;                     break;
+            case 0x2080: value = gpio_mask_;                    break;
+            case 0x2100: value = levels;                        break;
+            case 0x2180: value = levels & ~gpio_mask_;          break;
+            case 0x2200: value = gpio_out_;                     break;
+            default:     return false;
+        }
+    }
+
+    return true;
+}
+
+bool Lpc810::WriteGpio(uint32_t offset, uint32_t value, int size) {
+    uint32_t out = gpio_out_;
+    uint32_t dir = gpio_dir_;
+
+    if (offset < GPIO_PINS) {
+        out = (out & ~(1 << offset)) | ((value & 1) << offset);
+    }
+    else if (offset >= 0x1000 && offset < 0x1000 + GPIO_PINS * 4 && size == 4) {
+        int pin = (offset - 0x1000) / 4;
+        out = (out & ~(1 << pin)) | ((value ? 1 : 0) << pin);
+    }
+    else if (size != 4) {
+        return false;
+    }
+    else {
+        switch (offset) {
+            case 0x2000: dir = value & GPIO_PIN_MASK;                               break;
+            case 0x2080: gpio_mask_ = value & GPIO_PIN_MASK;                        break;
+            case 0x2100: out = value & GPIO_PIN_MASK;                               break;
+            case 0x2180: out = (out & gpio_mask_) | (value & ~gpio_mask_ & GPIO_PIN_MASK); break;
+            case 0x2200: out |= value & GPIO_PIN_MASK;                              break;
+            case 0x2280: out &= ~value;                                             break;
+            case 0x2300: out ^= value & GPIO_PIN_MASK;                              break;
+            default:     return false;
+        }
+    }
+
+    SetOutputs(out, dir);
+    return true;
+}
+
+void Lpc810::SetOutputs(uint32_t out, uint32_t dir) {
+    uint32_t before = (gpio_out_ & gpio_dir_) | (gpio_in_ & ~gpio_dir_);
+
+    gpio_out_ = out;
+    gpio_dir_ = dir;
+    PinsChanged(before);
+}
+
+void Lpc810::SetPin(int pin, bool level) {
+    uint32_t before = (gpio_out_ & gpio_dir_) | (gpio_in_ & ~gpio_dir_);
+
+    gpio_in_ = (gpio_in_ & ~(1 << pin)) | ((uint32_t)level << pin);
+    PinsChanged(before);
+}
+
+// Latch edges for the pin interrupts, and tell the watchers
+void Lpc810::PinsChanged(uint32_t before) {
+    uint32_t levels = (gpio_out_ & gpio_dir_) | (gpio_in_ & ~gpio_dir_);
+    uint32_t changed = (levels ^ before) & GPIO_PIN_MASK;
+
+    if (!changed) {
+        return;
+    }
+
+    for (int i = 0; i < LPC810_PIN_INTS; i++) {
+        int pin = plain_registers_[SYSCON_BASE + SYSCON_PINTSEL + i * 4] & 0x3f;
+
+        if (pin < GPIO_PINS && (changed >> pin) & 1) {
+            if ((levels >> pin) & 1) {
+                pin_int_rise_ |= pin_int_ienr_ & (1 << i);
+            }
+            else {
+                pin_int_fall_ |= pin_int_ienf_ & (1 << i);
+            }
+        }
+    }
+
+    for (int pin = 0; pin < GPIO_PINS; pin++) {
+        if ((changed >> pin) & 1) {
+            for (size_t i = 0; i < gpio_watchers_.size(); i++) {
+                gpio_watchers_[i](pin, (levels >> pin) & 1);
+            }
+        }
+    }
+
+    UpdateIrqLines();
+}
+
+// Edge sensitive only: ISEL's level mode isn't modelled
+bool Lpc810::ReadPinInt(uint32_t offset, uint32_t& value) {
+    switch (offset) {
+        case 0x00: value = pin_int_isel_;                   break;
+        case 0x04: value = pin_int_ienr_;                   break;
+        case 0x10: value = pin_int_ienf_;                   break;
+        case 0x1c: value = pin_int_rise_;                   break;
+        case 0x20: value = pin_int_fall_;                   break;
+        case 0x24: value = pin_int_rise_ | pin_int_fall_;   break;
+        default:   value = 0;                               break;
+    }
+
+    return true;
+}
+
+bool Lpc810::WritePinInt(uint32_t offset, uint32_t value) {
+    value &= (1 << LPC810_PIN_INTS) - 1;
+
+    switch (offset) {
+        case 0x00: pin_int_isel_ = value;                   break;
+        case 0x04: pin_int_ienr_ = value;                   break;
+        case 0x08: pin_int_ienr_ |= value;                  break;
+        case 0x0c: pin_int_ienr_ &= ~value;                 break;
+        case 0x10: pin_int_ienf_ = value;                   break;
+        case 0x14: pin_int_ienf_ |= value;                  break;
+        case 0x18: pin_int_ienf_ &= ~value;                 break;
+        case 0x1c: pin_int_rise_ &= ~value;                 break;
+        case 0x20: pin_int_fall_ &= ~value;                 break;
+        case 0x24: pin_int_rise_ &= ~value;
+                   pin_int_fall_ &= ~value;                 break;
+        default:   return false;
+    }
+
+    UpdateIrqLines();
+    return true;
+}
+
+//----------------------------------------------------------------------------------------
+// Time
+//
+
+void Lpc810::UpdateIrqLines() {
+    uint32_t lines = (pin_int_rise_ | pin_int_fall_) << PININT0_IRQ;
+
+    if (wkt_ctrl_ & WKT_CTRL_ALARMFLAG) {
+        lines |= 1 << WKT_IRQ;
+    }
+
+    for (int i = 0; i < LPC810_MRT_CHANNELS; i++) {
+        if (mrt_[i].flag && (mrt_[i].ctrl & MRT_CTRL_INTEN)) {
+            lines |= 1 << MRT_IRQ;
+        }
+    }
+
+    cpu_.SetIrqLines(lines);
+}
+
+// When a running WKT reaches zero, in time_ as it runs in every mode
+uint64_t Lpc810::WktDeadline() const {
+    return wkt_running_ ? wkt_start_ + (uint64_t)wkt_count_ * (FIXED_CLOCK_RATE_HZ / WKT_CLOCK_HZ) : NEVER;
+}
+
+void Lpc810::Reschedule() {
+    next_timer_ = systick_deadline_;
+
+    for (int i = 0; i < LPC810_MRT_CHANNELS; i++) {
+        if (mrt_[i].running && mrt_[i].deadline < next_timer_) {
+            next_timer_ = mrt_[i].deadline;
+        }
+    }
+
+    // The WKT runs in every mode, so is timed like the scheduled events
+    next_scheduled_ = WktDeadline();
+    for (size_t i = 0; i < scheduled_.size(); i++) {
+        if (scheduled_[i].at < next_scheduled_) {
+            next_scheduled_ = scheduled_[i].at;
+        }
+    }
+}
+
+// Latch whatever has come due, and run scheduled events
+void Lpc810::Update() {
+    for (int i = 0; i < LPC810_MRT_CHANNELS; i++) {
+        MrtChannel& channel = mrt_[i];
+
+        if (channel.running && channel.deadline <= clock_) {
+            channel.flag = true;
+            if (channel.ctrl & MRT_CTRL_ONE_SHOT) {
+                channel.running = false;
+            }
+            else {
+                uint64_t periods = (clock_ - channel.deadline) / channel.intval + 1;
+                channel.deadline += periods * channel.intval;
+            }
+        }
+    }
+
+    if (systick_deadline_ <= clock_) {
+        uint64_t period = systick_load_ + 1;
+
+        systick_ctrl_ |= SYSTICK_COUNTFLAG;
+        if (systick_ctrl_ & SYSTICK_TICKINT) {
+            cpu_.SetPending(EXCEPTION_SYSTICK);
+        }
+        systick_deadline_ = systick_load_ ? systick_deadline_ + period * ((clock_ - systick_deadline_) / period + 1) : NEVER;
+    }
+
+    if (WktDeadline() <= time_) {
+        wkt_ctrl_ |= WKT_CTRL_ALARMFLAG;
+        wkt_running_ = false;
+        wkt_count_ = 0;
+    }
+
+    for (size_t i = 0; i < scheduled_.size(); ) {
+        if (scheduled_[i].at <= time_) {
+            ScheduledEvent due = scheduled_[i];
+            scheduled_.erase(scheduled_.begin() + i);
+            due.event(due.context);
+            i = 0;
+        }
+        else {
+            i++;
+        }
+    }
+
+    Reschedule();
+    UpdateIrqLines();
+}
+
+void Lpc810::SyncTime() {
+    uint64_t ticks = cpu_.Cycles() - synced_cycles_;
+
+    synced_cycles_ = cpu_.Cycles();
+    time_ += ticks;
+    clock_ += ticks;
+    stats_.ticks = time_;
+    stats_.state_ticks[HOST_AWAKE] += ticks;
+}
+
+void Lpc810::SetPowerState(HostPowerState state) {
+    power_state_ = state;
+    stats_.state_entries[state]++;
+
+    for (size_t i = 0; i < power_watchers_.size(); i++) {
+        power_watchers_[i](state);
+    }
+}
+
+// Sleep to the next event that could wake the device, or until one has
+bool Lpc810::Sleep() {
+    bool deep = cpu_.IsSleepDeep();
+    uint32_t pm = plain_registers_[PMU_PCON] & PCON_PM_MASK;
+    HostPowerState state = !deep ? HOST_SLEEP : pm == PCON_POWER_DOWN ? HOST_POWER_DOWN : HOST_DEEP_SLEEP;
+
+    if (deep && pm == PCON_DEEP_POWER_DOWN) {
+        stop_reason_ = "deep power-down, which only a reset ends";
+        return false;
+    }
+
+    uint32_t start_logic = plain_registers_[SYSCON_BASE + SYSCON_STARTERP0];
+    bool wkt_wake = (wkt_ctrl_ & WKT_CTRL_ALARMFLAG) && (plain_registers_[SYSCON_BASE + SYSCON_STARTERP1] & STARTERP1_WKT);
+    bool woken = deep ? ((pin_int_rise_ | pin_int_fall_) & start_logic) || wkt_wake : cpu_.CanWake();
+
+    if (woken) {
+        cpu_.Wake();
+        if (power_state_ != HOST_AWAKE) {
+            SetPowerState(HOST_AWAKE);
+        }
+        return true;
+    }
+
+    if (power_state_ != state) {
+        SetPowerState(state);
+    }
+
+    uint64_t next = next_scheduled_;
+    if (!deep && next_timer_ != NEVER && time_ + (next_timer_ - clock_) < next) {
+        next = time_ + (next_timer_ - clock_);
+    }
+
+    if (next == NEVER) {
+        stop_reason_ = !deep ? "asleep with nothing to wake it" :
+                       state == HOST_POWER_DOWN ? "powered down with nothing to wake it" : "in deep sleep with nothing to wake it";
+        return false;
+    }
+
+    uint64_t target = next < run_limit_ ? next : run_limit_;
+    uint64_t ticks = target - time_;
+
+    time_ = target;
+    if (!deep) {
+        clock_ += ticks;
+    }
+    stats_.ticks = time_;
+    stats_.state_ticks[state] += ticks;
+
+    Update();
+    return true;
+}
+
+bool Lpc810::Step() {
+    if (time_ >= run_limit_) {
+        stop_reason_ = "run limit reached";
+        return false;
+    }
+
+    if (cpu_.IsSleeping()) {
+        return Sleep();
+    }
+
+    cpu_.Step();
+    SyncTime();
+
+    if (cpu_.Fault()) {
+        stop_reason_ = cpu_.Fault();
+        return false;
+    }
+
+    if (clock_ >= next_timer_ || time_ >= next_scheduled_) {
+        Update();
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------------
+// Device side
+//
+
+void Lpc810::Schedule(uint64_t at, void (*event)(void* context), void* context) {
+    ScheduledEvent scheduled_event = { at, event, context };
+    scheduled_.push_back(scheduled_event);
+    Reschedule();
+}
+
+void Lpc810::WatchGpio(void (*changed)(int pin, bool level)) {
+    gpio_watchers_.push_back(changed);
+}
+
+void Lpc810::AttachI2c(const HostI2cDevice* device) {
+    i2c_devices_.push_back(device);
+}
+
+void Lpc810::WatchI2c(void (*transfer)(const HostI2cTransfer& transfer)) {
+    i2c_watchers_.push_back(transfer);
+}
+
+void Lpc810::WatchPower(void (*changed)(HostPowerState state)) {
+    power_watchers_.push_back(changed);
+}
+
+uint64_t hostTicks() {
+    return board->Ticks();
+}
+
+void hostSchedule(uint64_t at, void (*event)(void* context), void* context) {
+    board->Schedule(at, event, context);
+}
+
+void hostPinSet(int pin, bool level) {
+    board->SetPin(pin, level);
+}
+
+bool hostGpioRead(int pin) {
+    return board->PinLevel(pin);
+}
+
+void hostGpioWatch(void (*changed)(int pin, bool level)) {
+    board->WatchGpio(changed);
+}
+
+void hostI2cAttach(const HostI2cDevice* device) {
+    board->AttachI2c(device);
+}
+
+void hostI2cWatch(void (*transfer)(const HostI2cTransfer& transfer)) {
+    board->WatchI2c(transfer);
+}
+
+void hostPowerWatch(void (*changed)(HostPowerState state)) {
+    board->WatchPower(changed);
+}
@@ -0,0 +1,168 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * LPC810 model header - memory map, peripherals and ROM, around the core
+ *
+ * Also provides hal_host.h's device API (hostTicks, hostPinSet, hostI2cAttach
+ * and the rest) so the simulator's device models attach here unchanged.
+ */
+
+#if !defined(__LPC810_H__)
+#define __LPC810_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hal/hal.h"
+#include "cortex_m0.h"
+
+#define LPC810_FLASH_SIZE       4096
+#define LPC810_RAM_SIZE         1024
+#define LPC810_ROM_SIZE         8192
+#define LPC810_RAM_BASE         0x10000000
+#define LPC810_ROM_BASE         0x1fff0000
+
+#define LPC810_MRT_CHANNELS     4
+#define LPC810_PIN_INTS         8
+
+// A modelled ROM routine, for naming in a profile
+struct Lpc810RomRoutine {
+    uint32_t    address;
+    std::string name;
+};
+
+class Lpc810 : public CortexM0Bus {
+    public:
+        Lpc810();
+
+        // Program flash, before Reset
+        bool LoadFlash(uint32_t address, const uint8_t* data, uint32_t length);
+        void Reset();
+
+        // Runs an instruction, or sleeps through to the next event; false once
+        // the run is over, with StopReason saying why
+        bool Step();
+        const char* StopReason() const          { return stop_reason_; }
+        void SetRunLimit(uint64_t ticks)        { run_limit_ = ticks; }
+
+        CortexM0& Cpu()                         { return cpu_; }
+        // Including the cycles of an instruction still running
+        uint64_t Ticks() const                  { return time_ + cpu_.Cycles() - synced_cycles_; }
+        const HostStats& Stats() const          { return stats_; }
+        const std::vector<Lpc810RomRoutine>& RomRoutines() const { return rom_routines_; }
+
+        // CortexM0Bus
+        virtual bool Read(uint32_t address, int size, uint32_t& value);
+        virtual bool Write(uint32_t address, int size, uint32_t value);
+        virtual bool Breakpoint(CortexM0& cpu, int number);
+
+        // Device side, for hal_host.h's API
+        void Schedule(uint64_t at, void (*event)(void* context), void* context);
+        void SetPin(int pin, bool level);
+        bool PinLevel(int pin) const;
+        void WatchGpio(void (*changed)(int pin, bool level));
+        void AttachI2c(const HostI2cDevice* device);
+        void WatchI2c(void (*transfer)(const HostI2cTransfer& transfer));
+        void WatchPower(void (*changed)(HostPowerState state));
+
+    private:
+        struct MrtChannel {
+            uint32_t    intval;
+            uint32_t    ctrl;
+            bool        running;
+            bool        flag;
+            uint64_t    deadline;           // in clock ticks
+        };
+
+        struct ScheduledEvent {
+            uint64_t    at;
+            void        (*event)(void* context);
+            void*       context;
+        };
+
+        void BuildRom();
+        void SyncTime();
+        void Update();
+        void UpdateIrqLines();
+        void Reschedule();
+        uint64_t WktDeadline() const;
+        bool Sleep();
+        void SetPowerState(HostPowerState state);
+
+        bool ReadPeripheral(uint32_t address, uint32_t& value);
+        bool WritePeripheral(uint32_t address, uint32_t value);
+        bool ReadMrt(uint32_t offset, uint32_t& value);
+        bool WriteMrt(uint32_t offset, uint32_t value);
+        bool ReadSysTick(uint32_t offset, uint32_t& value);
+        bool WriteSysTick(uint32_t offset, uint32_t value);
+        bool ReadGpio(uint32_t offset, uint32_t& value);
+        bool WriteGpio(uint32_t offset, uint32_t value, int size);
+        bool ReadPinInt(uint32_t offset, uint32_t& value);
+        bool WritePinInt(uint32_t offset, uint32_t value);
+        void SetOutputs(uint32_t out, uint32_t dir);
+        void PinsChanged(uint32_t before);
+
+        bool I2cTransfer(CortexM0& cpu, bool send, bool receive);
+        void BusTime(int bytes, int conditions);
+        const HostI2cDevice* FindDevice(uint8_t addr) const;
+
+        CortexM0        cpu_;
+
+        uint8_t         flash_[LPC810_FLASH_SIZE];
+        uint8_t         ram_[LPC810_RAM_SIZE];
+        uint8_t         rom_[LPC810_ROM_SIZE];
+        std::vector<Lpc810RomRoutine> rom_routines_;
+
+        // Virtual time, the main clock (stopped in deep sleep) and the CPU
+        // cycles already accounted for
+        uint64_t        time_;
+        uint64_t        clock_;
+        uint64_t        synced_cycles_;
+        uint64_t        run_limit_;
+        uint64_t        next_timer_;
+        uint64_t        next_scheduled_;
+        const char*     stop_reason_;
+        HostPowerState  power_state_;
+        HostStats       stats_;
+
+        std::vector<ScheduledEvent>         scheduled_;
+        std::vector<const HostI2cDevice*>   i2c_devices_;
+        std::vector<void (*)(int, bool)>    gpio_watchers_;
+        std::vector<void (*)(const HostI2cTransfer&)> i2c_watchers_;
+        std::vector<void (*)(HostPowerState)> power_watchers_;
+        uint32_t        i2c_bitrate_;
+
+        // Registers with no behaviour to model, by address
+        std::map<uint32_t, uint32_t>        plain_registers_;
+
+        MrtChannel      mrt_[LPC810_MRT_CHANNELS];
+
+        uint32_t        systick_ctrl_;
+        uint32_t        systick_load_;
+        uint32_t        systick_val_;       // while stopped
+        uint64_t        systick_deadline_;
+
+        uint32_t        gpio_out_;
+        uint32_t        gpio_dir_;
+        uint32_t        gpio_in_;           // levels driven from outside
+        uint32_t        gpio_mask_;
+
+        uint32_t        pin_int_isel_;
+        uint32_t        pin_int_ienr_;
+        uint32_t        pin_int_ienf_;
+        uint32_t        pin_int_rise_;
+        uint32_t        pin_int_fall_;
+
+        uint32_t        wkt_ctrl_;
+        uint32_t        wkt_count_;         // while stopped
+        uint64_t        wkt_start_;
+        bool            wkt_running_;
+};
+
+#endif // #if !defined(__LPC810_H__)
@@ -0,0 +1,667 @@
+/*=======================================================================
+ * Copyright Nicholas Tuckett 2015.
+ * Distributed under the MIT License.
+ * (See accompanying file license.txt or copy at
+ *  http://opensource.org/licenses/MIT)
+ *=======================================================================*/
+
+/*
+ * Instruction set simulator self-test
+ *
+ * A reference image for the simulated core, checking itself: flags and
+ * carries from the adds, subtracts and shifts, BL/BLX/BX and their return
+ * addresses, exception entry and return (stacked frames, EXC_RETURN values,
+ * stack alignment, PRIMASK, preemption by priority, the process stack), and
+ * instruction timings from the Cortex-M0+ TRM, measured with SysTick. It
+ * prints "pass" or the failing check over USART0, then sleeps with nothing
+ * to wake it, ending the run. make iss-check runs it and compares the
+ * report, cycle totals included, with selftest.expected.
+ *
+ * Assembled on its own, with no linker, so the image is the .text section
+ * at address 0: addresses are written as offsets from the vector table,
+ * which the assembler resolves, rather than as relocations.
+ *
+ *   llvm-mc -triple=thumbv6m-none-eabi -mcpu=cortex-m0plus -filetype=obj selftest.s -o selftest.o
+ */
+
+    .syntax unified
+    .cpu cortex-m0plus
+    .thumb
+
+    .equ RAM_TOP,           0x10000400
+    .equ PROCESS_STACK,     0x10000300
+    .equ SAVED_LR,          0x10000000      @ as the handlers found them
+    .equ SAVED_IPSR,        0x10000004
+    .equ SAVED_FRAME,       0x10000008
+    .equ SAVED_PENDSVS,     0x1000000c
+    .equ SAVED_LOG,         0x10000010      @ exception order: handler numbers, 0x80 | on leaving
+    .equ SAVED_LOG_NEXT,    0x10000020
+
+    .equ USART0_TXDATA,     0x4006401c
+    .equ GPIO_PIN0,         0xa0002100
+    .equ GPIO_CLR0,         0xa0002280
+    .equ SYST_CSR,          0xe000e010
+    .equ ICSR,              0xe000ed04
+    .equ SHPR2,             0xe000ed1c
+    .equ SHPR3,             0xe000ed20
+
+    .equ ICSR_PENDSVSET,    1 << 28
+    .equ ICSR_PENDSTSET,    1 << 26
+    .equ N,                 0x80000000
+    .equ Z,                 0x40000000
+    .equ C,                 0x20000000
+    .equ V,                 0x10000000
+    .equ XPSR_T,            0x01000000
+    .equ XPSR_ALIGNED,      0x00000200
+
+    @ Fails check r7 unless reg holds value; uses r3
+    .macro expect reg, value
+    ldr     r3, =\value
+    cmp     \reg, r3
+    beq     1f
+    mov     r0, \reg
+    bl      fail
+1:
+    .endm
+
+    @ Runs insn on r0 and r1 from the given flags, checking r0 and the flags after
+    .macro flags_case n, flags_in, a, b, insn, result, flags_out
+    movs    r7, #\n
+    ldr     r0, =\a
+    ldr     r1, =\b
+    ldr     r2, =\flags_in
+    msr     APSR, r2
+    \insn
+    mrs     r2, APSR
+    expect  r0, \result
+    expect  r2, \flags_out
+    .endm
+
+    @ SysTick counts down each cycle; r4 is read at the start of the
+    @ measured instructions, and each case then reads r5 after them
+    .macro cycles_start n
+    movs    r7, #\n
+    ldr     r4, [r6, #8]
+    .endm
+
+    .macro cycles_end expected
+    ldr     r5, [r6, #8]
+    subs    r0, r4, r5
+    subs    r0, #2                          @ the first read's own cycles
+    expect  r0, \expected
+    .endm
+
+    .text
+
+//----------------------------------------------------------------------------------------
+// Vectors
+//
+
+vectors:
+    .word   RAM_TOP
+    .word   reset - vectors
+    .word   0                               @ NMI
+    .word   hard_fault - vectors
+    .rept   7
+    .word   0
+    .endr
+    .word   svc_handler - vectors           @ 11
+    .word   0
+    .word   0
+    .word   pendsv_handler - vectors        @ 14
+    .word   systick_handler - vectors       @ 15
+
+    .type   reset, %function
+    .thumb_func
+reset:
+    bl      test_flags
+    bl      test_branches
+    bl      test_exceptions
+    bl      test_cycles
+
+    ldr     r0, =pass_text - vectors
+    bl      puts
+
+    @ Nothing left to wake it, so the simulator stops and reports
+1:
+    wfi
+    b       1b
+    .size   reset, . - reset
+    .ltorg
+
+//----------------------------------------------------------------------------------------
+// Flags and carries
+//
+
+    .type   test_flags, %function
+    .thumb_func
+test_flags:
+    push    {lr}
+    flags_case  1, C,     0xffffffff, 0,          "adcs r0, r1",      0,          Z|C
+    flags_case  2, C,     0x7fffffff, 0,          "adcs r0, r1",      0x80000000, N|V
+    flags_case  3, 0,     1,          1,          "adcs r0, r1",      2,          0
+    flags_case  4, 0,     0,          0,          "sbcs r0, r1",      0xffffffff, N
+    flags_case  5, C,     5,          3,          "sbcs r0, r1",      2,          C
+    flags_case  6, C,     0x80000000, 1,          "sbcs r0, r1",      0x7fffffff, C|V
+    flags_case  7, 0,     0x80000001, 0,          "lsls r0, r0, #1",  2,          C
+    flags_case  8, V,     0x80000000, 0,          "lsrs r0, r0, #32", 0,          Z|C|V
+    flags_case  9, 0,     0x80000000, 0,          "asrs r0, r0, #32", 0xffffffff, N|C
+    flags_case 10, C,     1,          0,          "lsls r0, r1",      1,          C
+    flags_case 11, 0,     1,          32,         "lsls r0, r1",      0,          Z|C
+    flags_case 12, C,     1,          33,         "lsls r0, r1",      0,          Z
+    flags_case 13, C,     0x80000000, 33,         "lsrs r0, r1",      0,          Z
+    flags_case 14, 0,     0x80000000, 32,         "rors r0, r1",      0x80000000, N|C
+    flags_case 15, 0,     0x0000000f, 4,          "rors r0, r1",      0xf0000000, N|C
+    flags_case 16, C,     0x40000000, 40,         "asrs r0, r1",      0,          Z
+    flags_case 17, 0,     0x40000000, 0x101,      "lsls r0, r1",      0x80000000, N
+    flags_case 18, 0,     5,          0,          "negs r0, r1",      0,          Z|C
+    flags_case 19, 0,     5,          1,          "negs r0, r1",      0xffffffff, N
+    flags_case 20, 0,     1,          0xffffffff, "cmn r0, r1",       1,          Z|C
+    flags_case 21, C|V,   0x10000,    0x10000,    "muls r0, r1",      0,          Z|C|V
+    flags_case 22, 0,     0xffffffff, 1,          "cmp r0, r1",       0xffffffff, N|C
+    pop     {pc}
+    .size   test_flags, . - test_flags
+    .ltorg
+
+//----------------------------------------------------------------------------------------
+// Branches
+//
+
+    .type   get_lr, %function
+    .thumb_func
+get_lr:
+    mov     r0, lr
+    bx      lr
+    .size   get_lr, . - get_lr
+
+    .type   test_branches, %function
+    .thumb_func
+test_branches:
+    push    {lr}
+
+    @ BL and BLX leave the return address with the Thumb bit in LR
+    movs    r7, #30
+    bl      get_lr
+return_bl:
+    expect  r0, (return_bl - vectors) | 1
+
+    movs    r7, #31
+    ldr     r2, =(get_lr - vectors) | 1
+    blx     r2
+return_blx:
+    expect  r0, (return_blx - vectors) | 1
+
+    @ BX to a Thumb address
+    movs    r7, #32
+    ldr     r2, =(bx_target - vectors) | 1
+    bx      r2
+    bl      fail
+bx_target:
+
+    @ Signed and unsigned conditions on -1 against 1
+    movs    r7, #33
+    movs    r0, #0
+    subs    r0, #1
+    cmp     r0, #1
+    bge     2f
+    bhi     1f
+2:
+    bl      fail
+1:
+    pop     {pc}
+    .size   test_branches, . - test_branches
+    .ltorg
+
+//----------------------------------------------------------------------------------------
+// Exceptions
+//
+
+    .type   test_exceptions, %function
+    .thumb_func
+test_exceptions:
+    push    {r4-r6, lr}
+
+    @ SysTick preempts PendSV, and SVCall sits between them
+    ldr     r0, =SHPR2
+    ldr     r1, =0x80 << 24
+    str     r1, [r0]
+    ldr     r0, =SHPR3
+    ldr     r1, =0xc0 << 16
+    str     r1, [r0]
+
+    @ SVC from thread mode on the main stack: the frame, EXC_RETURN and
+    @ flags, and r0 as returned through the frame
+    movs    r7, #40
+    movs    r0, #0xa0
+    movs    r1, #0xa1
+    movs    r2, #0xa2
+    movs    r3, #0xac
+    mov     r12, r3
+    movs    r3, #0xa3
+    mov     r5, sp
+    ldr     r4, =N|C
+    msr     APSR, r4
+    svc     #1
+return_svc:
+    mrs     r4, APSR
+    expect  r4, N|C
+    expect  r0, 0x5c
+    expect  r1, 0xa1
+    expect  r2, 0xa2
+    movs    r7, #41
+    mov     r4, r12
+    expect  r4, 0xac
+    mov     r4, sp
+    cmp     r4, r5
+    beq     1f
+    bl      fail
+1:
+    ldr     r0, =SAVED_LR
+    ldr     r4, [r0]
+    expect  r4, 0xfffffff9
+    ldr     r0, =SAVED_IPSR
+    ldr     r4, [r0]
+    expect  r4, 11
+    movs    r7, #42
+    ldr     r0, =SAVED_FRAME
+    ldr     r0, [r0]
+    subs    r4, r5, r0
+    expect  r4, 32
+    ldr     r4, [r0, #0x04]
+    expect  r4, 0xa1
+    ldr     r4, [r0, #0x0c]
+    expect  r4, 0xa3
+    ldr     r4, [r0, #0x10]
+    expect  r4, 0xac
+    ldr     r4, [r0, #0x18]
+    expect  r4, return_svc - vectors
+    ldr     r4, [r0, #0x1c]
+    expect  r4, N|C|XPSR_T
+
+    @ From a stack pointer off 8 byte alignment, the frame is aligned and
+    @ the xPSR says so, for the return to put it back
+    movs    r7, #43
+    sub     sp, #4
+    mov     r5, sp
+    movs    r0, #0
+    msr     APSR, r0
+    svc     #2
+    mov     r4, sp
+    add     sp, #4
+    cmp     r4, r5
+    beq     1f
+    bl      fail
+1:
+    ldr     r0, =SAVED_FRAME
+    ldr     r0, [r0]
+    subs    r4, r5, r0
+    expect  r4, 36
+    ldr     r4, [r0, #0x1c]
+    expect  r4, XPSR_T|XPSR_ALIGNED
+
+    @ PRIMASK holds off a pended PendSV, though WFI still wakes for it;
+    @ it's taken as soon as interrupts are enabled
+    movs    r7, #44
+    ldr     r5, =SAVED_PENDSVS
+    ldr     r6, [r5]
+    cpsid   i
+    ldr     r0, =ICSR
+    ldr     r1, =ICSR_PENDSVSET
+    str     r1, [r0]
+    wfi
+    ldr     r4, [r5]
+    cmp     r4, r6
+    beq     1f
+    bl      fail
+1:
+    cpsie   i
+    ldr     r4, [r5]
+    subs    r4, r6
+    expect  r4, 1
+    movs    r7, #45
+    ldr     r0, =SAVED_LR
+    ldr     r4, [r0]
+    expect  r4, 0xfffffff9
+
+    @ A SysTick pended in PendSV's handler preempts it at once, and
+    @ returns to it in handler mode
+    movs    r7, #46
+    ldr     r0, =SAVED_LOG_NEXT
+    ldr     r1, =SAVED_LOG
+    str     r1, [r0]
+    ldr     r0, =ICSR
+    ldr     r1, =ICSR_PENDSVSET
+    str     r1, [r0]
+    ldr     r0, =SAVED_LOG
+    ldr     r4, [r0, #0]
+    expect  r4, 14
+    ldr     r4, [r0, #4]
+    expect  r4, 15
+    ldr     r4, [r0, #8]
+    expect  r4, 0x80 | 15
+    ldr     r4, [r0, #12]
+    expect  r4, 0x80 | 14
+    ldr     r0, =SAVED_LR
+    ldr     r4, [r0]
+    expect  r4, 0xfffffff1
+
+    @ SVC from thread mode on the process stack: the frame goes there,
+    @ and the return switches back to it
+    movs    r7, #47
+    ldr     r0, =PROCESS_STACK
+    msr     PSP, r0
+    movs    r0, #2
+    msr     CONTROL, r0
+    isb
+    mov     r5, sp
+    svc     #3
+    mov     r4, sp
+    cmp     r4, r5
+    beq     1f
+    bl      fail
+1:
+    mrs     r4, CONTROL
+    expect  r4, 2
+    ldr     r0, =SAVED_LR
+    ldr     r4, [r0]
+    expect  r4, 0xfffffffd
+    ldr     r0, =SAVED_FRAME
+    ldr     r4, [r0]
+    expect  r4, PROCESS_STACK - 32
+    movs    r0, #0
+    msr     CONTROL, r0
+    isb
+    mrs     r4, PSP
+    mov     r5, sp
+    ldr     r0, =PROCESS_STACK
+    cmp     r4, r0
+    beq     1f
+    bl      fail
+1:
+    pop     {r4-r6, pc}
+    .size   test_exceptions, . - test_exceptions
+    .ltorg
+
+    @ Records what it was entered with, and returns 0x5c in r0
+    .type   svc_handler, %function
+    .thumb_func
+svc_handler:
+    ldr     r0, =SAVED_LR
+    mov     r1, lr
+    str     r1, [r0]
+    mrs     r1, IPSR
+    str     r1, [r0, #4]
+    movs    r2, #4
+    mov     r1, lr
+    tst     r1, r2
+    beq     1f
+    mrs     r2, PSP
+    b       2f
+1:
+    mov     r2, sp
+2:
+    str     r2, [r0, #8]
+    movs    r1, #0x5c
+    str     r1, [r2]
+    bx      lr
+    .size   svc_handler, . - svc_handler
+
+    @ Logs its entry and exit, pending SysTick in between when check 46
+    @ is running; returns by popping EXC_RETURN to the PC
+    .type   pendsv_handler, %function
+    .thumb_func
+pendsv_handler:
+    push    {r4, lr}
+    ldr     r0, =SAVED_LR
+    mov     r1, lr
+    str     r1, [r0]
+    ldr     r0, =SAVED_PENDSVS
+    ldr     r1, [r0]
+    adds    r1, #1
+    str     r1, [r0]
+    cmp     r7, #46
+    bne     1f
+    movs    r0, #14
+    bl      log_exception
+    ldr     r0, =ICSR
+    ldr     r1, =ICSR_PENDSTSET
+    str     r1, [r0]
+    movs    r0, #0x80 | 14
+    bl      log_exception
+1:
+    pop     {r4, pc}
+    .size   pendsv_handler, . - pendsv_handler
+
+    .type   systick_handler, %function
+    .thumb_func
+systick_handler:
+    push    {lr}
+    ldr     r0, =SAVED_LR
+    mov     r1, lr
+    str     r1, [r0]
+    movs    r0, #15
+    bl      log_exception
+    movs    r0, #0x80 | 15
+    bl      log_exception
+    pop     {pc}
+    .size   systick_handler, . - systick_handler
+
+    .type   log_exception, %function
+    .thumb_func
+log_exception:
+    ldr     r1, =SAVED_LOG_NEXT
+    ldr     r2, [r1]
+    str     r0, [r2]
+    adds    r2, #4
+    str     r2, [r1]
+    bx      lr
+    .size   log_exception, . - log_exception
+
+    .type   hard_fault, %function
+    .thumb_func
+hard_fault:
+    movs    r7, #99
+    movs    r0, #0
+    movs    r3, #0
+    bl      fail
+    .size   hard_fault, . - hard_fault
+    .ltorg
+
+//----------------------------------------------------------------------------------------
+// Cycles, as the Cortex-M0+ TRM gives them for zero wait state memory
+//
+
+    .type   empty, %function
+    .thumb_func
+empty:
+    bx      lr
+    .size   empty, . - empty
+
+    .type   pop_pc, %function
+    .thumb_func
+pop_pc:
+    push    {lr}
+    pop     {pc}
+    .size   pop_pc, . - pop_pc
+
+    .type   test_cycles, %function
+    .thumb_func
+test_cycles:
+    push    {r4-r6, lr}
+    ldr     r6, =SYST_CSR
+    ldr     r0, =0xffffff
+    str     r0, [r6, #4]                    @ reload
+    str     r0, [r6, #8]                    @ clears the count
+    movs    r0, #5
+    str     r0, [r6]                        @ on the core clock, no interrupt
+
+    cycles_start 50
+    cycles_end 0
+
+    cycles_start 51
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    cycles_end 8
+
+    cycles_start 52
+    b       1f                              @ taken: 2
+1:
+    cmp     r0, r0
+    bne     1f                              @ not taken: 1
+1:
+    cycles_end 4
+
+    cycles_start 53
+    bl      empty                           @ 3, and BX LR 2
+    cycles_end 5
+
+    ldr     r2, =(empty - vectors) | 1
+    cycles_start 54
+    blx     r2                              @ 2, and BX LR 2
+    cycles_end 4
+
+    cycles_start 55
+    push    {r0-r3}                         @ 1 + N
+    pop     {r0-r3}
+    cycles_end 10
+
+    cycles_start 56
+    bl      pop_pc                          @ 3, PUSH 2, POP to the PC 3 + N
+    cycles_end 9
+
+    cycles_start 57
+    muls    r0, r1                          @ the single cycle multiplier
+    muls    r0, r1
+    muls    r0, r1
+    muls    r0, r1
+    cycles_end 4
+
+    cycles_start 58
+    ldr     r0, =0x12345678                 @ 2
+    sub     sp, #8
+    str     r0, [sp]                        @ 2
+    ldr     r1, [sp]                        @ 2
+    add     sp, #8
+    cycles_end 8
+
+    ldr     r1, =GPIO_CLR0
+    ldr     r2, =GPIO_PIN0
+    movs    r0, #0
+    cycles_start 59
+    str     r0, [r1]                        @ the I/O port: single cycle
+    ldr     r3, [r2]
+    cycles_end 2
+
+    cycles_start 60
+    mrs     r0, PRIMASK                     @ 3
+    msr     PRIMASK, r0                     @ 3
+    cycles_end 6
+
+    movs    r0, #0
+    str     r0, [r6]
+    pop     {r4-r6, pc}
+    .size   test_cycles, . - test_cycles
+    .ltorg
+
+//----------------------------------------------------------------------------------------
+// Output
+//
+
+    @ r0: the NUL terminated string
+    .type   puts, %function
+    .thumb_func
+puts:
+    ldr     r2, =USART0_TXDATA
+1:
+    ldrb    r1, [r0]
+    cmp     r1, #0
+    beq     2f
+    str     r1, [r2]
+    adds    r0, #1
+    b       1b
+2:
+    bx      lr
+    .size   puts, . - puts
+
+    @ r0 in hex, 8 digits
+    .type   put_hex, %function
+    .thumb_func
+put_hex:
+    ldr     r2, =USART0_TXDATA
+    movs    r3, #8
+1:
+    movs    r1, #28
+    mov     r12, r0
+    lsrs    r0, r1
+    cmp     r0, #10
+    blo     2f
+    adds    r0, #'a' - '0' - 10
+2:
+    adds    r0, #'0'
+    str     r0, [r2]
+    mov     r0, r12
+    lsls    r0, #4
+    subs    r3, #1
+    bne     1b
+    bx      lr
+    .size   put_hex, . - put_hex
+
+    @ r0 in decimal, 2 digits
+    .type   put_decimal, %function
+    .thumb_func
+put_decimal:
+    ldr     r2, =USART0_TXDATA
+    movs    r1, #'0'
+1:
+    cmp     r0, #10
+    blo     2f
+    subs    r0, #10
+    adds    r1, #1
+    b       1b
+2:
+    str     r1, [r2]
+    adds    r0, #'0'
+    str     r0, [r2]
+    bx      lr
+    .size   put_decimal, . - put_decimal
+
+    @ Reports check r7 failing with r0 where r3 was expected, and stops
+    .type   fail, %function
+    .thumb_func
+fail:
+    mov     r4, r0
+    mov     r5, r3
+    ldr     r0, =fail_text - vectors
+    bl      puts
+    mov     r0, r7
+    bl      put_decimal
+    ldr     r0, =got_text - vectors
+    bl      puts
+    mov     r0, r4
+    bl      put_hex
+    ldr     r0, =expected_text - vectors
+    bl      puts
+    mov     r0, r5
+    bl      put_hex
+    ldr     r0, =newline_text - vectors
+    bl      puts
+    bkpt    #0
+    .size   fail, . - fail
+    .ltorg
+
+pass_text:
+    .asciz  "iss selftest: pass\n"
+fail_text:
+    .asciz  "iss selftest: FAIL at check "
+got_text:
+    .asciz  ": got "
+expected_text:
+    .asciz  ", expected "
+newline_text:
+    .asciz  "\n"
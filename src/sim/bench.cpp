@@ -0,0 +1,335 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Benchmark suite
+ *
+ * Runs each benchmark scenario in a forked child, so every run starts from
+ * a fresh device, and collects the figures the child sends back. Results go
+ * to a JSON file, and are compared with a stored baseline: a gated figure
+ * more than the tolerance above its baseline is a regression, and fails the
+ * suite, as does any figure over its limit. Virtual time makes the figures
+ * exact, so the tolerance is only there to let small changes through.
+ *
+ * Environment:
+ *  SIM_BENCH_RESULTS   where to write the results; default bench_results.json
+ *  SIM_BENCH_BASELINE  the baseline to compare with; default ../sim/bench_baseline.json
+ *  SIM_BENCH_TOLERANCE allowed growth in a gated figure, in percent; default 1
+ */
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define RESULTS_FILE        "bench_results.json"
+#define BASELINE_FILE       "../sim/bench_baseline.json"
+#define TOLERANCE_PERCENT   1.0
+
+typedef std::map<std::string, double> Figures;
+typedef std::map<std::string, Figures> Results;
+
+struct Run {
+    std::string name;
+    std::string ended;
+    Figures     figures;
+};
+
+static const char* setting(const char* name, const char* fallback) {
+    const char* value = getenv(name);
+    return value ? value : fallback;
+}
+
+//----------------------------------------------------------------------------------------
+// Running
+//
+
+static bool runScenario(const char* name, Run& run) {
+    int fds[2];
+    if (pipe(fds)) {
+        perror("bench: pipe");
+        exit(1);
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("bench: fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        // Back to the firmware, with the scenario's report going down the pipe
+        close(fds[0]);
+        if (!freopen("/dev/null", "w", stdout)) {
+            exit(1);
+        }
+        simSelectScenario(name, fds[1]);
+        return false;
+    }
+
+    close(fds[1]);
+    run.name = name;
+
+    FILE* results = fdopen(fds[0], "r");
+    char line[128];
+    while (fgets(line, sizeof(line), results)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (!strncmp(line, "ended ", 6)) {
+            run.ended = line + 6;
+        }
+        else {
+            char* value = strchr(line, ' ');
+            if (value) {
+                *value++ = '\0';
+                run.figures[line] = strtod(value, NULL);
+            }
+        }
+    }
+    fclose(results);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) || run.figures.empty()) {
+        fprintf(stderr, "bench: scenario %s failed\n", name);
+        exit(1);
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------------
+// Results files
+//
+
+static void writeResults(const char* path, const std::vector<Run>& runs) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+
+    fprintf(file, "{\n  \"scenarios\": {");
+    for (size_t i = 0; i < runs.size(); i++) {
+        fprintf(file, "%s\n    \"%s\": {", i ? "," : "", runs[i].name.c_str());
+
+        const char* separator = "";
+        for (Figures::const_iterator figure = runs[i].figures.begin(); figure != runs[i].figures.end(); ++figure) {
+            fprintf(file, "%s\n      \"%s\": %.17g", separator, figure->first.c_str(), figure->second);
+            separator = ",";
+        }
+        fprintf(file, "\n    }");
+    }
+    fprintf(file, "\n  }\n}\n");
+
+    fclose(file);
+}
+
+static void skipSpace(const char*& text) {
+    while (*text && strchr(" \t\r\n", *text)) {
+        text++;
+    }
+}
+
+static bool readString(const char*& text, std::string& value) {
+    skipSpace(text);
+    if (*text != '"') {
+        return false;
+    }
+
+    const char* end = strchr(++text, '"');
+    if (!end) {
+        return false;
+    }
+
+    value.assign(text, end);
+    text = end + 1;
+    return true;
+}
+
+static bool expect(const char*& text, char c) {
+    skipSpace(text);
+    if (*text != c) {
+        return false;
+    }
+    text++;
+    return true;
+}
+
+// Reads back what writeResults writes: objects of objects of numbers, no more
+static bool parseResults(const char* text, Results& results) {
+    std::string key;
+
+    if (!expect(text, '{') || !readString(text, key) || key != "scenarios" || !expect(text, ':') || !expect(text, '{')) {
+        return false;
+    }
+
+    skipSpace(text);
+    while (*text == '"') {
+        std::string scenario;
+        if (!readString(text, scenario) || !expect(text, ':') || !expect(text, '{')) {
+            return false;
+        }
+
+        skipSpace(text);
+        while (*text == '"') {
+            if (!readString(text, key) || !expect(text, ':')) {
+                return false;
+            }
+
+            char* end;
+            results[scenario][key] = strtod(text, &end);
+            if (end == text) {
+                return false;
+            }
+            text = end;
+
+            skipSpace(text);
+            if (*text == ',') {
+                text++;
+                skipSpace(text);
+            }
+        }
+
+        if (!expect(text, '}')) {
+            return false;
+        }
+        skipSpace(text);
+        if (*text == ',') {
+            text++;
+            skipSpace(text);
+        }
+    }
+
+    return expect(text, '}') && expect(text, '}');
+}
+
+static bool readBaseline(const char* path, Results& baseline) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+
+    std::string text;
+    char buffer[1024];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        text.append(buffer, length);
+    }
+    fclose(file);
+
+    if (!parseResults(text.c_str(), baseline)) {
+        fprintf(stderr, "bench: can't read baseline %s\n", path);
+        exit(1);
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------------
+// Comparison
+//
+
+// Returns the number of regressions
+static int compare(const std::vector<Run>& runs, const Results& baseline, double tolerance) {
+    SimMetric metrics[SIM_MAX_METRICS];
+    int metric_count = simGetMetrics(metrics);
+    int regressions = 0;
+
+    for (size_t i = 0; i < runs.size(); i++) {
+        const Run& run = runs[i];
+        Results::const_iterator base = baseline.find(run.name);
+
+        printf("\n%s (ended %s)\n", run.name.c_str(), run.ended.c_str());
+
+        for (int m = 0; m < metric_count; m++) {
+            Figures::const_iterator figure = run.figures.find(metrics[m].name);
+            if (figure == run.figures.end()) {
+                continue;
+            }
+
+            printf("  %-20s %16.3f", metrics[m].name, figure->second);
+
+            Figures::const_iterator was;
+            if (base == baseline.end() || (was = base->second.find(metrics[m].name)) == base->second.end()) {
+                bool over = metrics[m].limit && figure->second > metrics[m].limit;
+                printf("    (new)%s\n", over ? "  OVER LIMIT" : "");
+                regressions += over;
+                continue;
+            }
+
+            double change = figure->second - was->second;
+            double percent = was->second ? 100.0 * change / was->second : (change ? 100.0 : 0.0);
+            const char* verdict = "";
+
+            if (metrics[m].limit && figure->second > metrics[m].limit) {
+                verdict = "  OVER LIMIT";
+                regressions++;
+            }
+            else if (metrics[m].gated && percent > tolerance) {
+                verdict = "  REGRESSION";
+                regressions++;
+            }
+            else if (metrics[m].gated && percent < -tolerance) {
+                verdict = "  improved";
+            }
+
+            printf(" %16.3f %+9.2f%%%s\n", was->second, percent, verdict);
+        }
+    }
+
+    return regressions;
+}
+
+void benchRun() {
+    const char* results_path = setting("SIM_BENCH_RESULTS", RESULTS_FILE);
+    const char* baseline_path = setting("SIM_BENCH_BASELINE", BASELINE_FILE);
+    double tolerance = getenv("SIM_BENCH_TOLERANCE") ? strtod(getenv("SIM_BENCH_TOLERANCE"), NULL) : TOLERANCE_PERCENT;
+
+    std::vector<Run> runs;
+    for (int i = 0; i < simGetScenarioCount(); i++) {
+        const SimScenario& scenario = simGetScenario(i);
+        if (!scenario.bench) {
+            continue;
+        }
+
+        Run run;
+        if (!runScenario(scenario.name, run)) {
+            return;                         // the child, off to run it
+        }
+        runs.push_back(run);
+    }
+
+    writeResults(results_path, runs);
+    printf("results in %s\n", results_path);
+
+    Results baseline;
+    if (!readBaseline(baseline_path, baseline)) {
+        printf("no baseline at %s; nothing to compare with\n", baseline_path);
+        exit(0);
+    }
+
+    printf("compared with %s, gated figures allowed %.2f%% growth\n", baseline_path, tolerance);
+    printf("  %-20s %16s %16s %10s\n", "", "now", "baseline", "change");
+
+    int regressions = compare(runs, baseline, tolerance);
+    if (regressions) {
+        printf("\n%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+        exit(1);
+    }
+
+    printf("\nno regressions\n");
+    exit(0);
+}
@@ -0,0 +1,210 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Energy model
+ *
+ * The current drawn is the microcontroller's for its power state, plus the
+ * rest of the board's, plus the display's (switched on or off), with its
+ * backlight, plus the buzzer's while its pin is high. It's worked out again
+ * at each change of power state, GPIO or I2C transfer (which may switch the
+ * backlight), and the charge drawn at the last current added up first.
+ *
+ * The config file has a name = value line per current, in mA, and the
+ * battery's capacity in mAh; # starts a comment. Currents left out draw
+ * nothing, so a file can isolate one part.
+ */
+
+#include "energy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal/hal.h"
+#include "lcd_model.h"
+
+#define TICKS_PER_HOUR      ((double)HOST_TICKS_PER_MS * 3600000)
+#define MAX_LINE            256
+
+struct Setting {
+    const char* name;
+    double      value;
+};
+
+enum {
+    ACTIVE_MA,
+    SLEEP_MA,
+    DEEP_SLEEP_MA,
+    POWER_DOWN_MA,
+    BOARD_MA,
+    LCD_ON_MA,
+    LCD_OFF_MA,
+    BACKLIGHT_MA,
+    BUZZER_MA,
+    BATTERY_MAH,
+    SETTINGS
+};
+
+// In HostPowerState order, to begin with
+static Setting settings[SETTINGS] = {
+    { "active_ma",      0 },
+    { "sleep_ma",       0 },
+    { "deep_sleep_ma",  0 },
+    { "power_down_ma",  0 },
+    { "board_ma",       0 },
+    { "lcd_on_ma",      0 },
+    { "lcd_off_ma",     0 },
+    { "backlight_ma",   0 },
+    { "buzzer_ma",      0 },
+    { "battery_mah",    0 },
+};
+
+static const char* const load_names[ENERGY_LOADS] = {
+    "mcu", "board", "lcd", "backlight", "buzzer"
+};
+
+static bool             opened = false;
+static int              buzzer_pin;
+static HostPowerState   power_state = HOST_AWAKE;
+static double           load_ma[ENERGY_LOADS];
+static uint64_t         start = 0;
+static uint64_t         since = 0;
+static double           load_charge[ENERGY_LOADS];      // in mA ticks
+static EnergyTotals     totals;
+
+//----------------------------------------------------------------------------------------
+// Config
+//
+
+static const char* readConfig(const char* path) {
+    static char error[MAX_LINE + 64];
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        snprintf(error, sizeof(error), "can't read %s", path);
+        return error;
+    }
+
+    char line[MAX_LINE];
+    int number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        char name[MAX_LINE];
+        double value;
+        int i;
+
+        number++;
+        line[strcspn(line, "#\r\n")] = 0;
+        if (line[strspn(line, " \t")] == 0) {
+            continue;
+        }
+
+        if (sscanf(line, " %[a-z_] = %lf", name, &value) != 2) {
+            snprintf(error, sizeof(error), "%s:%d: expected name = value", path, number);
+            fclose(file);
+            return error;
+        }
+
+        for (i = 0; i < SETTINGS && strcmp(settings[i].name, name); i++) {
+        }
+        if (i == SETTINGS) {
+            snprintf(error, sizeof(error), "%s:%d: unknown setting %s", path, number, name);
+            fclose(file);
+            return error;
+        }
+
+        settings[i].value = value;
+    }
+
+    fclose(file);
+    return NULL;
+}
+
+//----------------------------------------------------------------------------------------
+// Integration
+//
+
+static void addCharge() {
+    uint64_t now = hostTicks();
+
+    for (int load = 0; load < ENERGY_LOADS; load++) {
+        load_charge[load] += load_ma[load] * (now - since);
+    }
+    since = now;
+}
+
+static void sampleLoads() {
+    bool lcd = lcdModelIsPowered();
+
+    load_ma[ENERGY_MCU]         = settings[power_state].value;
+    load_ma[ENERGY_BOARD]       = settings[BOARD_MA].value;
+    load_ma[ENERGY_LCD]         = settings[lcd ? LCD_ON_MA : LCD_OFF_MA].value;
+    load_ma[ENERGY_BACKLIGHT]   = lcd && lcdModelIsBacklightOn() ? settings[BACKLIGHT_MA].value : 0;
+    load_ma[ENERGY_BUZZER]      = hostGpioRead(buzzer_pin) ? settings[BUZZER_MA].value : 0;
+}
+
+static void gpioChanged(int pin, bool level) {
+    addCharge();
+    sampleLoads();
+}
+
+static void transferred(const HostI2cTransfer& transfer) {
+    addCharge();
+    sampleLoads();
+}
+
+static void powerChanged(HostPowerState state) {
+    addCharge();
+    power_state = state;
+    sampleLoads();
+}
+
+//----------------------------------------------------------------------------------------
+// Interface
+//
+
+const char* energyOpen(const char* config_path, int buzzer_gpio) {
+    const char* error = readConfig(config_path);
+    if (error) {
+        return error;
+    }
+
+    buzzer_pin = buzzer_gpio;
+    start = since = hostTicks();
+    sampleLoads();
+    opened = true;
+
+    hostGpioWatch(gpioChanged);
+    hostI2cWatch(transferred);
+    hostPowerWatch(powerChanged);
+    return NULL;
+}
+
+bool energyIsOpen() {
+    return opened;
+}
+
+const EnergyTotals& energyGetTotals() {
+    addCharge();
+
+    double hours = (since - start) / TICKS_PER_HOUR;
+
+    totals.charge_mah = 0;
+    for (int load = 0; load < ENERGY_LOADS; load++) {
+        totals.load_mah[load] = load_charge[load] / TICKS_PER_HOUR;
+        totals.charge_mah += totals.load_mah[load];
+    }
+
+    totals.average_ma = hours > 0 ? totals.charge_mah / hours : 0;
+    totals.battery_mah = settings[BATTERY_MAH].value;
+    totals.battery_days = totals.average_ma > 0 ? totals.battery_mah / totals.average_ma / 24 : 0;
+    return totals;
+}
+
+const char* energyGetLoadName(int load) {
+    return load_names[load];
+}
@@ -0,0 +1,45 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* Energy model header - charge drawn over a simulated run, and battery life */
+
+#if !defined(__ENERGY_H__)
+#define __ENERGY_H__
+
+#include "lpc_types.h"
+
+// What draws the current, for a breakdown
+enum EnergyLoad {
+    ENERGY_MCU,
+    ENERGY_BOARD,
+    ENERGY_LCD,
+    ENERGY_BACKLIGHT,
+    ENERGY_BUZZER,
+    ENERGY_LOADS
+};
+
+struct EnergyTotals {
+    double  charge_mah;
+    double  load_mah[ENERGY_LOADS];
+    double  average_ma;
+    double  battery_mah;
+    double  battery_days;           // at the average current
+};
+
+// Read the currents from a config file (see energy.conf) and start adding
+// up charge from the current virtual time; returns an error, or NULL. The
+// display's state comes from its model, so attach that first.
+extern const char* energyOpen(const char* config_path, int buzzer_gpio);
+
+extern bool energyIsOpen();
+
+// Totals up to the current virtual time
+extern const EnergyTotals& energyGetTotals();
+
+extern const char* energyGetLoadName(int load);
+
+#endif // #if !defined(__ENERGY_H__)
@@ -0,0 +1,227 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * LCD model - PCF8574 backpack and HD44780 controller
+ *
+ * Each byte written to the backpack sets its outputs (wired as in
+ * util/lcd.cpp); the controller latches D4-D7 on the falling edge of EN.
+ * It starts in 8-bit mode, where each nybble is a whole instruction, until
+ * a function set selects 4-bit mode. Only writes are modelled, and execution
+ * times are checked rather than reported through the busy flag.
+ */
+
+#include "lcd_model.h"
+
+#include <string.h>
+
+#include "hal/hal.h"
+
+#define PIN_RS          0x01
+#define PIN_EN          0x04
+#define PIN_BACKLIGHT   0x08
+
+#define DDRAM_SIZE      0x80
+#define CGRAM_SIZE      0x40
+#define ROW_ADDR        0x40
+#define ROW_LENGTH      0x28
+
+#define CLEAR_TIME_US   1520
+#define COMMAND_TIME_US 37
+#define TICKS_PER_US    (FIXED_CLOCK_RATE_HZ / 1000000)
+
+static HostI2cDevice    device;
+static int              power_pin;
+
+static bool     powered = true;
+static uint8_t  outputs = 0;
+static bool     four_bit;
+static bool     high_nybble_pending;
+static uint8_t  high_nybble;
+static uint8_t  ddram[DDRAM_SIZE];
+static uint8_t  cgram[CGRAM_SIZE];
+static uint8_t  address;
+static bool     cgram_selected;
+static bool     increment;
+static bool     display_on;
+static uint64_t busy_until;
+
+static LcdModelStats stats;
+
+static void reset() {
+    four_bit            = false;
+    high_nybble_pending = false;
+    address             = 0;
+    cgram_selected      = false;
+    increment           = true;
+    display_on          = false;
+    busy_until          = 0;
+    memset(ddram, ' ', sizeof(ddram));
+    memset(cgram, 0, sizeof(cgram));
+}
+
+static void advanceAddress() {
+    if (cgram_selected) {
+        address = (address + (increment ? 1 : -1)) & (CGRAM_SIZE - 1);
+    }
+    else if (increment) {
+        address = address == ROW_LENGTH - 1 ? ROW_ADDR : address == ROW_ADDR + ROW_LENGTH - 1 ? 0 : address + 1;
+    }
+    else {
+        address = address == 0 ? ROW_ADDR + ROW_LENGTH - 1 : address == ROW_ADDR ? ROW_LENGTH - 1 : address - 1;
+    }
+}
+
+static void execute(uint8_t value, bool data) {
+    uint64_t now = hostTicks();
+
+    if (now < busy_until) {
+        stats.busy_violations++;
+    }
+    busy_until = now + COMMAND_TIME_US * TICKS_PER_US;
+
+    if (data) {
+        stats.data++;
+        if (cgram_selected) {
+            cgram[address] = value;
+        }
+        else {
+            ddram[address & (DDRAM_SIZE - 1)] = value;
+        }
+        advanceAddress();
+        return;
+    }
+
+    stats.commands++;
+
+    if (value & 0x80) {                     // set DDRAM address
+        address = value & 0x7f;
+        cgram_selected = false;
+    }
+    else if (value & 0x40) {                // set CGRAM address
+        address = value & (CGRAM_SIZE - 1);
+        cgram_selected = true;
+    }
+    else if (value & 0x20) {                // function set
+        four_bit = !(value & 0x10);
+    }
+    else if (value & 0x10) {                // cursor or display shift: not used
+    }
+    else if (value & 0x08) {                // display control
+        display_on = value & 0x04;
+    }
+    else if (value & 0x04) {                // entry mode
+        increment = value & 0x02;
+    }
+    else if (value & 0x02) {                // return home
+        address = 0;
+        cgram_selected = false;
+        busy_until = now + CLEAR_TIME_US * TICKS_PER_US;
+    }
+    else if (value & 0x01) {                // clear
+        memset(ddram, ' ', sizeof(ddram));
+        address = 0;
+        cgram_selected = false;
+        increment = true;
+        busy_until = now + CLEAR_TIME_US * TICKS_PER_US;
+    }
+}
+
+static bool backpackWrite(const uint8_t* data, int length) {
+    if (!powered) {
+        return false;
+    }
+
+    for (int i = 0; i < length; i++) {
+        uint8_t value = data[i];
+
+        if ((outputs & PIN_EN) && !(value & PIN_EN)) {
+            uint8_t nybble = value >> 4;
+            bool rs = value & PIN_RS;
+
+            if (!four_bit) {
+                execute(nybble << 4, rs);
+            }
+            else if (!high_nybble_pending) {
+                high_nybble = nybble;
+                high_nybble_pending = true;
+            }
+            else {
+                high_nybble_pending = false;
+                execute((high_nybble << 4) | nybble, rs);
+            }
+        }
+
+        outputs = value;
+    }
+
+    return true;
+}
+
+static bool backpackRead(uint8_t* data, int length) {
+    memset(data, outputs, length);
+    return powered;
+}
+
+static void powerChanged(int pin, bool level) {
+    if (pin == power_pin && level != powered) {
+        powered = level;
+        outputs = 0;
+        if (powered) {
+            stats.power_ups++;
+            reset();
+        }
+    }
+}
+
+void lcdModelAttach(uint8_t addr, int power_gpio) {
+    power_pin       = power_gpio;
+    powered         = hostGpioRead(power_gpio);
+    device.addr     = addr;
+    device.write    = backpackWrite;
+    device.read     = backpackRead;
+    reset();
+
+    hostI2cAttach(&device);
+    hostGpioWatch(powerChanged);
+}
+
+void lcdModelGetRow(int row, char* text) {
+    for (int i = 0; i < LCD_MODEL_COLUMNS; i++) {
+        uint8_t c = ddram[row * ROW_ADDR + i];
+
+        if (!powered || !display_on) {
+            c = ' ';
+        }
+        else if (c < 0x10) {
+            // Custom glyph: shown if any of its rows are set
+            const uint8_t* glyph = cgram + (c & 0x07) * 8;
+            c = ' ';
+            for (int r = 0; r < 8; r++) {
+                if (glyph[r]) {
+                    c = '#';
+                }
+            }
+        }
+
+        text[i] = c;
+    }
+
+    text[LCD_MODEL_COLUMNS] = '\0';
+}
+
+bool lcdModelIsBacklightOn() {
+    return powered && (outputs & PIN_BACKLIGHT);
+}
+
+bool lcdModelIsPowered() {
+    return powered;
+}
+
+const LcdModelStats& lcdModelGetStats() {
+    return stats;
+}
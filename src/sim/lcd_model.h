@@ -0,0 +1,37 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* LCD model header - PCF8574 backpack and HD44780 controller, for the simulator */
+
+#if !defined(__LCD_MODEL_H__)
+#define __LCD_MODEL_H__
+
+#include "lpc_types.h"
+
+struct LcdModelStats {
+    uint32_t    commands;
+    uint32_t    data;
+    uint32_t    busy_violations;    // instructions sent before the last had finished
+    uint32_t    power_ups;
+};
+
+// Attach at the backpack's I2C address, powered from a GPIO. While that is
+// low the backpack NACKs, and when it rises the controller is reset.
+extern void lcdModelAttach(uint8_t addr, int power_gpio);
+
+// Row of the display as it appears, custom glyphs shown as '#', or blank
+// while off; text needs LCD_MODEL_COLUMNS + 1 chars
+#define LCD_MODEL_COLUMNS       16
+#define LCD_MODEL_ROWS          2
+
+extern void lcdModelGetRow(int row, char* text);
+extern bool lcdModelIsBacklightOn();
+extern bool lcdModelIsPowered();
+
+extern const LcdModelStats& lcdModelGetStats();
+
+#endif // #if !defined(__LCD_MODEL_H__)
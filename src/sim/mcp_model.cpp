@@ -0,0 +1,156 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * MCP23008 model
+ *
+ * Registers as in util/mcp.h, with sequential addressing. Interrupts are
+ * modelled for interrupt-on-change from the previous value (INTCON clear),
+ * active low: a change on an enabled input captures GPIO into INTCAP and
+ * asserts the output, until GPIO or INTCAP is read.
+ */
+
+#include "mcp_model.h"
+
+#include <string.h>
+
+#include "hal/hal.h"
+#include "util/mcp.h"
+
+#define REGISTER_COUNT  (MCP23008_OLAT + 1)
+
+static HostI2cDevice    device;
+static int              interrupt_pin;
+
+static uint8_t  registers[REGISTER_COUNT];
+static uint8_t  pointer = 0;
+static uint8_t  pins = 0xff;            // pulled up, with nothing held
+static bool     interrupting = false;
+static uint64_t interrupt_since;
+static McpModelStats stats;
+
+static uint8_t gpioValue() {
+    return (pins ^ registers[MCP23008_IPOL]) & registers[MCP23008_IODIR];
+}
+
+static void setInterrupt(bool active) {
+    if (active) {
+        interrupt_since = hostTicks();
+        stats.interrupts++;
+    }
+    else {
+        registers[MCP23008_INTF] = 0;
+
+        if (hostTicks() - interrupt_since > stats.max_service_ticks) {
+            stats.max_service_ticks = hostTicks() - interrupt_since;
+        }
+    }
+
+    interrupting = active;
+    hostPinSet(interrupt_pin, !active);
+}
+
+static uint8_t readRegister(uint8_t reg) {
+    switch (reg) {
+        case MCP23008_GPIO:
+            if (interrupting) {
+                setInterrupt(false);
+            }
+            return gpioValue() | (registers[MCP23008_OLAT] & ~registers[MCP23008_IODIR]);
+
+        case MCP23008_INTCAP:
+            if (interrupting) {
+                setInterrupt(false);
+            }
+            return registers[reg];
+
+        default:
+            return registers[reg];
+    }
+}
+
+static void writeRegister(uint8_t reg, uint8_t value) {
+    switch (reg) {
+        case MCP23008_GPIO:
+            registers[MCP23008_OLAT] = value;
+            break;
+
+        case MCP23008_INTF:
+        case MCP23008_INTCAP:
+            break;                      // read only
+
+        default:
+            registers[reg] = value;
+            break;
+    }
+}
+
+static void nextRegister() {
+    pointer = pointer == REGISTER_COUNT - 1 ? 0 : pointer + 1;
+}
+
+// The first byte sets the register pointer, the rest are written from there
+static bool expanderWrite(const uint8_t* data, int length) {
+    if (length > 0) {
+        if (data[0] >= REGISTER_COUNT) {
+            return false;
+        }
+        pointer = data[0];
+    }
+
+    for (int i = 1; i < length; i++) {
+        writeRegister(pointer, data[i]);
+        nextRegister();
+    }
+
+    return true;
+}
+
+static bool expanderRead(uint8_t* data, int length) {
+    for (int i = 0; i < length; i++) {
+        data[i] = readRegister(pointer);
+        nextRegister();
+    }
+
+    return true;
+}
+
+void mcpModelAttach(uint8_t addr, int interrupt_gpio) {
+    memset(registers, 0, sizeof(registers));
+    registers[MCP23008_IODIR] = 0xff;
+
+    interrupt_pin   = interrupt_gpio;
+    device.addr     = addr;
+    device.write    = expanderWrite;
+    device.read     = expanderRead;
+
+    hostI2cAttach(&device);
+    hostPinSet(interrupt_pin, true);
+}
+
+void mcpModelSetButtons(uint8_t buttons) {
+    uint8_t changed = pins ^ (uint8_t)~buttons;
+
+    pins = ~buttons;
+
+    uint8_t flagged = changed & registers[MCP23008_GPINTEN] & registers[MCP23008_IODIR];
+    if (flagged) {
+        registers[MCP23008_INTF] |= flagged;
+        if (!interrupting) {
+            registers[MCP23008_INTCAP] = gpioValue();
+            setInterrupt(true);
+        }
+    }
+}
+
+uint8_t mcpModelGetButtons() {
+    return ~pins;
+}
+
+const McpModelStats& mcpModelGetStats() {
+    return stats;
+}
@@ -0,0 +1,30 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* MCP23008 model header - GPIO expander with the buttons, for the simulator */
+
+#if !defined(__MCP_MODEL_H__)
+#define __MCP_MODEL_H__
+
+#include "lpc_types.h"
+
+// Attach at the expander's I2C address, its active low interrupt output
+// driving a GPIO input
+extern void mcpModelAttach(uint8_t addr, int interrupt_gpio);
+
+// A bit per button held down; each pulls its input low
+extern void mcpModelSetButtons(uint8_t buttons);
+extern uint8_t mcpModelGetButtons();
+
+struct McpModelStats {
+    uint32_t    interrupts;
+    uint64_t    max_service_ticks;  // longest from asserting the interrupt to it being cleared by a read
+};
+
+extern const McpModelStats& mcpModelGetStats();
+
+#endif // #if !defined(__MCP_MODEL_H__)
@@ -0,0 +1,565 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Device simulator
+ *
+ * Runs the firmware, main loop and all, against the HAL's host backend with
+ * the display and button expander modelled, pressing buttons to a script in
+ * virtual time. Reports the run's totals when it ends.
+ *
+ * Environment:
+ *  SIM_SCENARIO    a built-in script, listed by an unknown name; default
+ *                  countdown. "bench" runs the benchmark suite (bench.cpp).
+ *  SIM_BUTTONS     a script instead: comma separated delay_ms:buttons steps,
+ *                  each setting the buttons held (hex) once delay_ms has passed
+ *  SIM_SESSION     a button session recorded by the firmware (app/session_log.h)
+ *                  to replay instead: a serial capture, other lines ignored
+ *  HOST_RUN_MS     virtual time limit, overriding the scenario's
+ *  SIM_VCD         a file to dump the I2C bus, GPIOs and power state to, as
+ *                  a VCD waveform
+ *  SIM_ENERGY      the energy model's currents (energy.cpp); default
+ *                  ../sim/energy.conf, if it's there
+ */
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "hal/hal.h"
+#include "app/session_log.h"
+#include "lcd_model.h"
+#include "mcp_model.h"
+#include "energy.h"
+#include "vcd.h"
+
+// As wired, and as used by the firmware
+#define LCD_I2C_ADDR        0x27
+#define LCD_POWER_GPIO      0
+#define INPUT_I2C_ADDR      0x20
+#define INPUT_IRQ_GPIO      1
+#define BUZZER_GPIO         4
+
+#define ENERGY_CONFIG       "../sim/energy.conf"
+
+// Button interrupts are to be serviced within this, whatever the display is
+// doing; as INPUT_LATENCY_BUDGET_MS in app/main.cpp
+#define INPUT_BUDGET_US     5000
+
+// A press is to be heard within this, which is longer: its key beep waits
+// out the chord window (CHORD_WINDOW_MS in app/button_input.h) unless it's
+// started from the interrupt, then the buzzer's pin is first driven a 25ms
+// SysTick period after that (app/buzzer.cpp)
+#define BEEP_BUDGET_MS      (80 + 25 + INPUT_BUDGET_US / 1000)
+
+// The buzzer pin rising this soon after a press is taken as its key beep.
+// Presses are only timed once the buzzer has been quiet a while, so an
+// alarm's beeps aren't.
+#define BEEP_MATCH_MS       500
+#define BEEP_QUIET_MS       250
+
+// Buttons, by timer; as in app/timer_controller.cpp
+#define TIMER1(buttons)     ((buttons) << 4)
+#define TIMER2(buttons)     (buttons)
+#define BUTTON_H            0x08
+#define BUTTON_M            0x01
+#define BUTTON_S            0x02
+#define BUTTON_START        0x04
+
+#define PRESS_MS            100
+#define RELEASE_MS          100
+
+// From a release to the next press: the backlight's time on and a little
+#define SHORT_IDLE_WAIT_MS  (2000 + 50 - RELEASE_MS)
+
+#define MINUTE_MS           60000
+#define HOUR_MS             (60 * MINUTE_MS)
+
+struct ScriptStep {
+    uint32_t    delay_ms;
+    uint8_t     buttons;
+};
+
+typedef std::vector<ScriptStep> Script;
+
+struct Scenario {
+    SimScenario info;
+    void        (*build)(Script& script);
+};
+
+static const char*  scenario_name;
+static Script       script;
+static size_t       script_step = 0;
+static int          result_fd = -1;
+static timespec     host_start;
+static uint8_t      buttons_held = 0;
+static bool         beep_pending = false;
+static uint64_t     beep_press_at;
+static uint64_t     buzzer_changed_at = 0;
+static uint64_t     beep_latency_max = 0;
+
+//----------------------------------------------------------------------------------------
+// Scenarios
+//
+
+static void wait(Script& script, uint32_t ms) {
+    ScriptStep step = { ms, 0 };
+    script.push_back(step);
+}
+
+static void hold(Script& script, uint8_t buttons, uint32_t ms) {
+    ScriptStep down = { RELEASE_MS, buttons };
+    ScriptStep up = { ms, 0 };
+    script.push_back(down);
+    script.push_back(up);
+}
+
+static void press(Script& script, uint8_t buttons, int count = 1) {
+    for (int i = 0; i < count; i++) {
+        hold(script, buttons, PRESS_MS);
+    }
+}
+
+// Nothing pressed: start up, then sleep once the backlight times out
+static void buildIdle(Script& script) {
+}
+
+// Timer 1 set to 9:59:59 and run down, its alarm left ringing a minute
+static void buildCountdown(Script& script) {
+    wait(script, 400);
+    press(script, TIMER1(BUTTON_H), 9);
+    press(script, TIMER1(BUTTON_M), 59);
+    press(script, TIMER1(BUTTON_S), 59);
+    press(script, TIMER1(BUTTON_START));
+    wait(script, (9 * 3600 + 59 * 60 + 59 + 60) * 1000);
+    press(script, TIMER1(BUTTON_START));
+}
+
+// Timer 1 run for 30 minutes, its alarm stopped after a minute
+static void buildTimer30(Script& script) {
+    wait(script, 400);
+    press(script, TIMER1(BUTTON_M), 30);
+    press(script, TIMER1(BUTTON_START));
+    wait(script, 31 * MINUTE_MS);
+    press(script, TIMER1(BUTTON_START));
+}
+
+// Timer 1 for an hour and timer 2 for 45 minutes, both alarms stopped at the end
+static void buildBothTimers(Script& script) {
+    wait(script, 400);
+    press(script, TIMER1(BUTTON_H));
+    press(script, TIMER2(BUTTON_M), 45);
+    press(script, TIMER1(BUTTON_START));
+    press(script, TIMER2(BUTTON_START));
+    wait(script, HOUR_MS + MINUTE_MS);
+    press(script, TIMER1(BUTTON_START));
+    press(script, TIMER2(BUTTON_START));
+}
+
+// A one minute timer whose alarm rings for 10 minutes
+static void buildAlarm(Script& script) {
+    wait(script, 400);
+    press(script, TIMER1(BUTTON_M));
+    press(script, TIMER1(BUTTON_START));
+    wait(script, 11 * MINUTE_MS);
+    press(script, TIMER1(BUTTON_START));
+}
+
+// Timer 2 set while timer 1's alarm blinks, the presses drifting through
+// the blink phase so some land while the display is being written
+static void buildAlarmInput(Script& script) {
+    wait(script, 400);
+    press(script, TIMER1(BUTTON_M));
+    press(script, TIMER1(BUTTON_START));
+    wait(script, MINUTE_MS);
+
+    for (int i = 0; i < 150; i++) {
+        press(script, TIMER2(BUTTON_S));
+        wait(script, 807);
+    }
+
+    press(script, TIMER1(BUTTON_START));
+}
+
+// Presses landing just after the timer goes idle, then an hour untouched:
+// the short idle periods mustn't leave it in deep-sleep, with the display
+// on, for the long one
+static void buildShortIdle(Script& script) {
+    wait(script, 400);
+
+    for (int i = 0; i < 8; i++) {
+        press(script, TIMER1(BUTTON_S));
+        wait(script, SHORT_IDLE_WAIT_MS);
+    }
+
+    press(script, TIMER1(BUTTON_S));
+}
+
+// Rounds of setting, running and clearing both timers, with auto-repeat,
+// a stopwatch and mode changes
+static void buildButtons(Script& script) {
+    wait(script, 400);
+
+    for (int round = 0; round < 20; round++) {
+        press(script, TIMER1(BUTTON_H));
+        press(script, TIMER1(BUTTON_M), 5);
+        press(script, TIMER1(BUTTON_S), 10);
+        press(script, TIMER1(BUTTON_START));
+        wait(script, 3000);
+        press(script, TIMER1(BUTTON_START));
+        press(script, TIMER1(BUTTON_START | BUTTON_H));     // clear
+        hold(script, TIMER2(BUTTON_M), 7000);               // into the faster repeats
+        press(script, TIMER2(BUTTON_START | BUTTON_M));     // clear
+        press(script, TIMER2(BUTTON_START));                // stopwatch
+        wait(script, 2000);
+        press(script, TIMER2(BUTTON_START));
+        press(script, TIMER2(BUTTON_START | BUTTON_S));     // clear
+        press(script, TIMER1(BUTTON_START) | TIMER2(BUTTON_START), 2);  // mode there and back
+    }
+}
+
+static const Scenario scenarios[] = {
+    { { "countdown",    10 * HOUR_MS + 5 * MINUTE_MS,   false }, buildCountdown },
+    { { "idle",         HOUR_MS,                        true }, buildIdle },
+    { { "timer30",      35 * MINUTE_MS,                 true }, buildTimer30 },
+    { { "both",         HOUR_MS + 5 * MINUTE_MS,        true }, buildBothTimers },
+    { { "alarm",        15 * MINUTE_MS,                 true }, buildAlarm },
+    { { "buttons",      6 * MINUTE_MS,                  true }, buildButtons },
+    { { "alarm_input",  4 * MINUTE_MS,                  true }, buildAlarmInput },
+    { { "short_idle",   HOUR_MS + MINUTE_MS,            true }, buildShortIdle },
+};
+
+#define SCENARIO_COUNT  (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+int simGetScenarioCount() {
+    return SCENARIO_COUNT;
+}
+
+const SimScenario& simGetScenario(int index) {
+    return scenarios[index].info;
+}
+
+void simSelectScenario(const char* name, int fd) {
+    int i = 0;
+    while (i < SCENARIO_COUNT && strcmp(scenarios[i].info.name, name)) {
+        i++;
+    }
+
+    if (i == SCENARIO_COUNT) {
+        fprintf(stderr, "sim: no scenario '%s'; try: bench", name);
+        for (i = 0; i < SCENARIO_COUNT; i++) {
+            fprintf(stderr, " %s", scenarios[i].info.name);
+        }
+        fprintf(stderr, "\n");
+        exit(1);
+    }
+
+    scenario_name = scenarios[i].info.name;
+    result_fd = fd;
+    scenarios[i].build(script);
+
+    if (scenarios[i].info.run_ms && !getenv("HOST_RUN_MS")) {
+        hostSetRunLimit(scenarios[i].info.run_ms);
+    }
+}
+
+static bool parseScript(const char* text, Script& script) {
+    while (*text) {
+        char* end;
+        ScriptStep step;
+
+        step.delay_ms = strtoul(text, &end, 0);
+        if (*end != ':') {
+            return false;
+        }
+        step.buttons = strtoul(end + 1, &end, 16);
+        if (*end && *end != ',') {
+            return false;
+        }
+
+        script.push_back(step);
+        text = *end ? end + 1 : end;
+    }
+
+    return true;
+}
+
+// Each "$" line is an entry, in hex; a gap lost to an overflow in the
+// firmware's buffer is replayed as none
+static bool parseSession(const char* path, Script& script) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[256];
+    int number = 0;
+    int lost = 0;
+    while (fgets(line, sizeof(line), file)) {
+        number++;
+        if (line[0] != '$') {
+            continue;
+        }
+
+        char* end;
+        uint32_t entry = strtoul(line + 1, &end, 16);
+        if (end != line + 9) {
+            fprintf(stderr, "sim: %s:%d: bad session entry\n", path, number);
+            exit(1);
+        }
+
+        ScriptStep step;
+        step.delay_ms = entry & SESSION_DELAY_MASK;
+        step.buttons = entry >> SESSION_BUTTONS_SHIFT;
+        if (step.delay_ms == SESSION_OVERFLOW) {
+            step.delay_ms = 0;
+            lost++;
+        }
+        script.push_back(step);
+    }
+
+    fclose(file);
+
+    if (lost) {
+        fprintf(stderr, "sim: %s: entries were lost in %d places\n", path, lost);
+    }
+    return true;
+}
+
+// Time from a press to its key beep, as heard
+static void notePress(uint8_t buttons) {
+    uint64_t now = hostTicks();
+    bool pressed = buttons & ~buttons_held;
+
+    buttons_held = buttons;
+    if (!pressed || hostGpioRead(BUZZER_GPIO) || now - buzzer_changed_at < (uint64_t)BEEP_QUIET_MS * HOST_TICKS_PER_MS) {
+        return;
+    }
+
+    // Of a chord's presses, the first is timed
+    if (!beep_pending || now - beep_press_at > (uint64_t)BEEP_MATCH_MS * HOST_TICKS_PER_MS) {
+        beep_pending = true;
+        beep_press_at = now;
+    }
+}
+
+static void buzzerChanged(int pin, bool level) {
+    if (pin != BUZZER_GPIO) {
+        return;
+    }
+
+    uint64_t now = hostTicks();
+    buzzer_changed_at = now;
+    if (level && beep_pending) {
+        beep_pending = false;
+        if (now - beep_press_at <= (uint64_t)BEEP_MATCH_MS * HOST_TICKS_PER_MS && now - beep_press_at > beep_latency_max) {
+            beep_latency_max = now - beep_press_at;
+        }
+    }
+}
+
+static void runStep(void*) {
+    notePress(script[script_step].buttons);
+    mcpModelSetButtons(script[script_step++].buttons);
+
+    if (script_step < script.size()) {
+        hostSchedule(hostTicks() + (uint64_t)script[script_step].delay_ms * HOST_TICKS_PER_MS, runStep, NULL);
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// Results
+//
+
+int simGetMetrics(SimMetric* metrics) {
+    const HostStats& stats = hostGetStats();
+    const LcdModelStats& lcd = lcdModelGetStats();
+    const McpModelStats& mcp = mcpModelGetStats();
+    int count = 0;
+
+#define LIMITED(name, value, gated, limit) { SimMetric metric = { name, (double)(value), gated, limit }; metrics[count++] = metric; }
+#define METRIC(name, value, gated)  LIMITED(name, value, gated, 0)
+    METRIC("virtual_ms",            stats.ticks / HOST_TICKS_PER_MS,                        false);
+    METRIC("awake_ms",              (double)stats.state_ticks[HOST_AWAKE] / HOST_TICKS_PER_MS, true);
+    METRIC("wakes",                 stats.state_entries[HOST_AWAKE],                        true);
+    METRIC("sleep_ms",              stats.state_ticks[HOST_SLEEP] / HOST_TICKS_PER_MS,      false);
+    METRIC("deep_sleep_ms",         stats.state_ticks[HOST_DEEP_SLEEP] / HOST_TICKS_PER_MS, false);
+    METRIC("power_down_ms",         stats.state_ticks[HOST_POWER_DOWN] / HOST_TICKS_PER_MS, false);
+    METRIC("mrt_interrupts",        stats.mrt_interrupts,                                   true);
+    METRIC("systick_interrupts",    stats.systick_interrupts,                               true);
+    METRIC("pin_interrupts",        stats.pin_interrupts,                                   true);
+    METRIC("i2c_transactions",      stats.i2c_transfers,                                    true);
+    METRIC("i2c_bytes",             stats.i2c_bytes,                                        true);
+    METRIC("i2c_bus_ms",            (double)stats.i2c_ticks / HOST_TICKS_PER_MS,            true);
+    METRIC("lcd_commands",          lcd.commands,                                           true);
+    METRIC("lcd_data",              lcd.data,                                               true);
+    METRIC("lcd_busy_violations",   lcd.busy_violations,                                    true);
+    LIMITED("input_service_max_us", (double)mcp.max_service_ticks / (HOST_TICKS_PER_MS / 1000), true, INPUT_BUDGET_US);
+    LIMITED("beep_latency_max_ms",  (double)beep_latency_max / HOST_TICKS_PER_MS,           true, BEEP_BUDGET_MS);
+    // Zero without the energy model
+    const EnergyTotals& energy = energyGetTotals();
+    METRIC("charge_mah",            energy.charge_mah,                                      true);
+    METRIC("battery_days",          energy.battery_days,                                    false);
+#undef METRIC
+#undef LIMITED
+
+    return count;
+}
+
+int simCheckLimits(const SimMetric* metrics, int count) {
+    int over = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (metrics[i].limit && metrics[i].value > metrics[i].limit) {
+            fprintf(stderr, "sim: %s %.3f is over its limit of %.3f\n", metrics[i].name, metrics[i].value, metrics[i].limit);
+            over++;
+        }
+    }
+
+    return over;
+}
+
+//----------------------------------------------------------------------------------------
+// Run start and end
+//
+
+void hostRunStart() {
+    const char* buttons = getenv("SIM_BUTTONS");
+    const char* session = getenv("SIM_SESSION");
+    const char* name = getenv("SIM_SCENARIO");
+
+    if (session) {
+        scenario_name = session;
+        if (!parseSession(session, script)) {
+            fprintf(stderr, "sim: can't read %s\n", session);
+            exit(1);
+        }
+    }
+    else if (buttons) {
+        scenario_name = "SIM_BUTTONS";
+        if (!parseScript(buttons, script)) {
+            fprintf(stderr, "sim: bad SIM_BUTTONS step at '%s'\n", buttons);
+            exit(1);
+        }
+    }
+    else if (name && !strcmp(name, "bench")) {
+        // Returns only in each child, with its scenario selected
+        benchRun();
+    }
+    else {
+        simSelectScenario(name ? name : scenarios[0].info.name, -1);
+    }
+
+    lcdModelAttach(LCD_I2C_ADDR, LCD_POWER_GPIO);
+    mcpModelAttach(INPUT_I2C_ADDR, INPUT_IRQ_GPIO);
+    hostGpioWatch(buzzerChanged);
+
+    if (!script.empty()) {
+        hostSchedule((uint64_t)script[0].delay_ms * HOST_TICKS_PER_MS, runStep, NULL);
+    }
+
+    const char* energy = getenv("SIM_ENERGY");
+    const char* error = energyOpen(energy ? energy : ENERGY_CONFIG, BUZZER_GPIO);
+    if (error && energy) {
+        fprintf(stderr, "sim: %s\n", error);
+        exit(1);
+    }
+
+    const char* vcd = getenv("SIM_VCD");
+    if (vcd && result_fd < 0 && !vcdOpen(vcd, LCD_POWER_GPIO, INPUT_IRQ_GPIO, BUZZER_GPIO)) {
+        fprintf(stderr, "sim: can't write %s\n", vcd);
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &host_start);
+}
+
+static void sendResults(const char* reason) {
+    SimMetric metrics[SIM_MAX_METRICS];
+    int count = simGetMetrics(metrics);
+
+    FILE* results = fdopen(result_fd, "w");
+    fprintf(results, "ended %s%s\n", reason, script_step < script.size() ? ", before the script finished" : "");
+    for (int i = 0; i < count; i++) {
+        fprintf(results, "%s %.17g\n", metrics[i].name, metrics[i].value);
+    }
+    fclose(results);
+}
+
+static void reportState(const char* name, const HostStats& stats, HostPowerState state) {
+    double ms = (double)stats.state_ticks[state] / HOST_TICKS_PER_MS;
+
+    printf("%-16s %14.3f ms %8.4f%% %10u entries\n", name, ms,
+           stats.ticks ? 100.0 * stats.state_ticks[state] / stats.ticks : 0.0, stats.state_entries[state]);
+}
+
+void hostRunEnd(const char* reason) {
+    vcdClose();
+
+    if (result_fd >= 0) {
+        sendResults(reason);
+        return;
+    }
+
+    timespec host_end;
+    clock_gettime(CLOCK_MONOTONIC, &host_end);
+
+    const HostStats& stats = hostGetStats();
+    const LcdModelStats& lcd = lcdModelGetStats();
+
+    double host_seconds = (host_end.tv_sec - host_start.tv_sec) + (host_end.tv_nsec - host_start.tv_nsec) / 1e9;
+    double seconds = (double)stats.ticks / FIXED_CLOCK_RATE_HZ;
+    uint64_t ms = stats.ticks / HOST_TICKS_PER_MS;
+
+    printf("\nscenario         %s\n", scenario_name);
+    printf("ended            %s%s\n", reason, script_step < script.size() ? ", before the script finished" : "");
+    printf("virtual time     %u:%02u:%02u.%03u\n", (unsigned)(ms / 3600000), (unsigned)(ms / 60000 % 60),
+           (unsigned)(ms / 1000 % 60), (unsigned)(ms % 1000));
+    printf("host time        %.3fs, %.0fx real time\n", host_seconds, host_seconds > 0 ? seconds / host_seconds : 0.0);
+
+    reportState("awake", stats, HOST_AWAKE);
+    reportState("sleep", stats, HOST_SLEEP);
+    reportState("deep sleep", stats, HOST_DEEP_SLEEP);
+    reportState("power down", stats, HOST_POWER_DOWN);
+
+    printf("interrupts       %u mrt, %u systick, %u pin, %u wkt\n", stats.mrt_interrupts, stats.systick_interrupts, stats.pin_interrupts, stats.wkt_interrupts);
+    printf("i2c              %u transactions, %u bytes, %.3f ms on the bus\n",
+           stats.i2c_transfers, stats.i2c_bytes, (double)stats.i2c_ticks / HOST_TICKS_PER_MS);
+    printf("lcd              %u commands, %u data, %u busy violations, %u power ups\n",
+           lcd.commands, lcd.data, lcd.busy_violations, lcd.power_ups);
+    printf("input            %u interrupts, serviced within %.3f ms, key beeps heard within %.3f ms\n",
+           mcpModelGetStats().interrupts, (double)mcpModelGetStats().max_service_ticks / HOST_TICKS_PER_MS,
+           (double)beep_latency_max / HOST_TICKS_PER_MS);
+
+    if (energyIsOpen()) {
+        const EnergyTotals& energy = energyGetTotals();
+
+        printf("energy           %.4f mAh, %.4f mA average; %.0f mAh battery lasts %.1f days\n",
+               energy.charge_mah, energy.average_ma, energy.battery_mah, energy.battery_days);
+        for (int load = 0; load < ENERGY_LOADS; load++) {
+            printf("  %-14s %.4f mAh %8.4f%%\n", energyGetLoadName(load), energy.load_mah[load],
+                   energy.charge_mah > 0 ? 100.0 * energy.load_mah[load] / energy.charge_mah : 0.0);
+        }
+    }
+
+    for (int row = 0; row < LCD_MODEL_ROWS; row++) {
+        char text[LCD_MODEL_COLUMNS + 1];
+        lcdModelGetRow(row, text);
+        printf("%-16s |%s|\n", row ? "" : "display", text);
+    }
+
+    SimMetric metrics[SIM_MAX_METRICS];
+    if (simCheckLimits(metrics, simGetMetrics(metrics))) {
+        exit(1);
+    }
+}
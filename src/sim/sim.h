@@ -0,0 +1,48 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* Simulator header - scenarios and run results, shared with the benchmark */
+
+#if !defined(__SIM_H__)
+#define __SIM_H__
+
+#include "lpc_types.h"
+
+struct SimScenario {
+    const char* name;
+    uint32_t    run_ms;             // 0 to run until nothing can wake the device
+    bool        bench;              // part of the benchmark suite
+};
+
+extern int simGetScenarioCount();
+extern const SimScenario& simGetScenario(int index);
+
+// Run the scenario in this process, sending results to result_fd as
+// "name value" lines in place of the report
+extern void simSelectScenario(const char* name, int result_fd);
+
+// One figure from a run. Gated figures are costs, which shouldn't grow;
+// one over its limit, if it has one, fails the run whatever the baseline.
+struct SimMetric {
+    const char* name;
+    double      value;
+    bool        gated;
+    double      limit;              // 0 for none
+};
+
+// Metrics over their limits, named in a message to stderr
+extern int simCheckLimits(const SimMetric* metrics, int count);
+
+#define SIM_MAX_METRICS     20
+
+extern int simGetMetrics(SimMetric* metrics);
+
+// Run every benchmark scenario in a child process each, write the results
+// as JSON and compare them with a baseline; exits with the outcome
+extern void benchRun();
+
+#endif // #if !defined(__SIM_H__)
@@ -0,0 +1,626 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Timer soak test
+ *
+ * Drives a TimerController and its timers, on the HAL's host backend with
+ * the display modelled, through random button presses, auto-repeats and
+ * waits of up to ten hours, in virtual time. Invariants are checked at
+ * every tick, after every button event and whenever a frame has been drawn:
+ *
+ *  - times stay within MAX_HOURS, MAX_MINUTES and MAX_SECONDS, so never
+ *    wrap below zero
+ *  - a running count-down loses a second or nothing at each tick, and an
+ *    uninterrupted run lasts its starting time, to within the first tick
+ *  - it alarms once, at the tick that takes it to zero, and nothing else
+ *    alarms; a stopped timer stays put, bar chained mode's hand-off
+ *  - leaving an alarm, or any other reset, restores start_time_
+ *  - a stopwatch gains a tenth at each tick, holding at the maximum
+ *  - the display shows each timer's time once its frame is out, and the
+ *    controller never overruns it
+ *
+ * The first failure is reported with the seed and the recent history, and
+ * exits with 1; otherwise the totals and throughput in simulated hours per
+ * second are reported.
+ *
+ * Usage: timer_soak [-n steps] [-s seed]
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hal/hal.h"
+#include "util/lcd.h"
+#include "util/mrt_interrupt.h"
+#include "util/timers.h"
+#include "app/backlight.h"
+#include "app/buzzer.h"
+#include "app/timer_controller.h"
+#include "lcd_model.h"
+
+extern void TimerInterruptHandler(void);
+
+// As wired, and as used by the firmware
+#define LCD_I2C_ADDR        0x27
+#define LCD_POWER_GPIO      0
+#define BUZZER_GPIO         4
+#define I2C_BITRATE_HZ      100000
+#define MRT_TIMER           1
+
+// As in app/timer.cpp and app/timer_controller.cpp
+#define MAX_HOURS           9
+#define MAX_MINUTES         59
+#define MAX_SECONDS         59
+#define TIMER1(buttons)     ((buttons) << 4)
+#define BUTTON_H            0x08
+#define BUTTON_M            0x01
+#define BUTTON_S            0x02
+#define BUTTON_START        0x04
+
+#define DEFAULT_STEPS       20000
+#define DEFAULT_SEED        1
+#define LOOP_STEP_MS        100
+#define UNATTENDED_STEP_MS  1000
+#define HISTORY_LENGTH      16
+#define HISTORY_TEXT        48
+
+#define TICKS_PER_SECOND    ((uint64_t)HOST_TICKS_PER_MS * 1000)
+#define TICKS_PER_HOUR      (TICKS_PER_SECOND * 3600)
+
+struct Snapshot {
+    Timer::State    state;
+    uint8_t         hours;
+    uint8_t         minutes;
+    uint8_t         seconds;
+    uint8_t         tenths;
+    uint32_t        start;              // start_time_, packed as TimeVal
+    bool            stopwatch;
+    bool            coarse;
+    uint8_t         x;
+    uint8_t         y;
+};
+
+// Uninterrupted count-down runs, for timing
+struct Run {
+    bool        timing;
+    bool        ticked;     // timed from its first tick, not its start
+    uint64_t    started;
+    uint32_t    seconds;
+};
+
+struct Totals {
+    uint64_t    steps;
+    uint64_t    button_events;
+    uint64_t    repeats;
+    uint64_t    ticks;
+    uint64_t    alarms;
+    uint64_t    runs_timed;
+    uint64_t    frames_checked;
+};
+
+class TimerProbe {
+    public:
+        static Timer& GetTimer(TimerController& controller, int i) {
+            return i ? controller.timer2_ : controller.timer1_;
+        }
+
+        static bool IsChained(TimerController& controller) {
+            return controller.mode_ == TimerController::CHAINED;
+        }
+
+        static bool IsFramePending(TimerController& controller) {
+            return controller.IsFramePending();
+        }
+
+        static Snapshot Take(Timer& timer) {
+            Snapshot snapshot;
+
+            snapshot.state      = timer.state_;
+            snapshot.hours      = timer.current_time_.hours;
+            snapshot.minutes    = timer.current_time_.minutes;
+            snapshot.seconds    = timer.current_time_.seconds;
+            snapshot.tenths     = timer.current_time_.tenths;
+            snapshot.start      = timer.start_time_.all;
+            snapshot.stopwatch  = timer.stopwatch_;
+            snapshot.coarse     = timer.IsCoarse();
+            snapshot.x          = timer.x_;
+            snapshot.y          = timer.y_;
+            return snapshot;
+        }
+
+        static uint32_t Packed(Timer& timer) {
+            return timer.current_time_.all;
+        }
+};
+
+static TimerController* controller;
+static Backlight*       backlight;
+static uint64_t         seed = DEFAULT_SEED;
+static uint64_t         random_state;
+static Totals           totals;
+static Run              runs[2];
+static char             history[HISTORY_LENGTH][HISTORY_TEXT];
+static int              history_next = 0;
+static uint8_t          buttons = 0;
+
+//----------------------------------------------------------------------------------------
+// Reporting
+//
+
+static const char* stateName(Timer::State state) {
+    return state == Timer::STOPPED ? "stopped" : state == Timer::RUNNING ? "running" : "alarm";
+}
+
+static void record(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    int length = snprintf(history[history_next], HISTORY_TEXT, "%10.3fs  ", (double)hostTicks() / TICKS_PER_SECOND);
+    vsnprintf(history[history_next] + length, HISTORY_TEXT - length, format, args);
+    history_next = (history_next + 1) % HISTORY_LENGTH;
+
+    va_end(args);
+}
+
+static void fail(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    printf("soak: FAILED at step %llu, %.3fs (seed %llu): ", (unsigned long long)totals.steps,
+           (double)hostTicks() / TICKS_PER_SECOND, (unsigned long long)seed);
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+
+    for (int i = 0; i < 2; i++) {
+        Snapshot timer = TimerProbe::Take(TimerProbe::GetTimer(*controller, i));
+        printf("timer %d: %s%s %u:%02u:%02u.%u, start %08x\n", i + 1, stateName(timer.state),
+               timer.stopwatch ? " stopwatch" : "", timer.hours, timer.minutes, timer.seconds, timer.tenths, timer.start);
+    }
+
+    printf("history, oldest first:\n");
+    for (int i = 0; i < HISTORY_LENGTH; i++) {
+        const char* entry = history[(history_next + i) % HISTORY_LENGTH];
+        if (*entry) {
+            printf("  %s\n", entry);
+        }
+    }
+
+    exit(1);
+}
+
+// Firmware errors, such as from the display driver, fail the soak
+void error(const char* msg) {
+    fail("firmware error: %s", msg);
+}
+
+void errorWithCode(const char* msg, int code) {
+    fail("firmware error: %s %08x", msg, code);
+}
+
+//----------------------------------------------------------------------------------------
+// Invariants
+//
+
+static uint32_t toSeconds(const Snapshot& timer) {
+    return (timer.hours * 60 + timer.minutes) * 60 + timer.seconds;
+}
+
+static uint32_t toTenths(const Snapshot& timer) {
+    return toSeconds(timer) * 10 + timer.tenths;
+}
+
+static bool isAtMaximum(const Snapshot& timer) {
+    return timer.hours == MAX_HOURS && timer.minutes == MAX_MINUTES && timer.seconds == MAX_SECONDS && timer.tenths == 9;
+}
+
+static void checkFields(const Snapshot& timer, int i) {
+    if (timer.hours > MAX_HOURS || timer.minutes > MAX_MINUTES || timer.seconds > MAX_SECONDS || timer.tenths > 9) {
+        fail("timer %d out of range: %u:%02u:%02u.%u", i + 1, timer.hours, timer.minutes, timer.seconds, timer.tenths);
+    }
+
+    if (timer.state == Timer::RUNNING && !timer.stopwatch && toSeconds(timer) == 0) {
+        fail("timer %d running at zero without alarming", i + 1);
+    }
+
+    if (timer.state == Timer::ALARM && toTenths(timer) != 0) {
+        fail("timer %d alarming at %u seconds", i + 1, toSeconds(timer));
+    }
+}
+
+static void startTiming(int i, const Snapshot& timer) {
+    runs[i].timing = timer.state == Timer::RUNNING && !timer.stopwatch;
+    runs[i].ticked = false;
+    runs[i].started = hostTicks();
+    runs[i].seconds = toSeconds(timer);
+}
+
+// Timing from a count-down's first tick, the seconds after it are whole
+static void tickRunTime(int i, const Snapshot& timer) {
+    if (runs[i].timing && !runs[i].ticked) {
+        runs[i].ticked = true;
+        runs[i].started = hostTicks();
+        runs[i].seconds = toSeconds(timer);
+    }
+}
+
+// An uninterrupted count-down lasts its starting time, less up to a second
+// for the first tick coming early in the second already under way. From
+// its first tick it lasts its time exactly, whatever ran alongside: a
+// stopwatch starting mustn't move the seconds.
+static void checkRunTime(int i) {
+    if (!runs[i].timing) {
+        return;
+    }
+
+    uint64_t elapsed = hostTicks() - runs[i].started;
+    uint64_t expected = runs[i].seconds * TICKS_PER_SECOND;
+    uint64_t early = runs[i].ticked ? TICKS_PER_SECOND / 100 : TICKS_PER_SECOND;
+
+    if (elapsed > expected + TICKS_PER_SECOND / 100 || elapsed + early < expected) {
+        fail("timer %d alarmed after %.3fs from %u seconds", i + 1, (double)elapsed / TICKS_PER_SECOND, runs[i].seconds);
+    }
+
+    runs[i].timing = false;
+    totals.runs_timed++;
+}
+
+static void checkTick(const Snapshot* before, const Snapshot* after) {
+    for (int i = 0; i < 2; i++) {
+        const Snapshot& was = before[i];
+        const Snapshot& now = after[i];
+
+        checkFields(now, i);
+
+        switch (was.state) {
+            case Timer::RUNNING:
+                if (was.stopwatch) {
+                    bool counted = now.state == Timer::RUNNING && toTenths(now) == toTenths(was) + 1;
+                    bool held = now.state == Timer::STOPPED && isAtMaximum(now);
+
+                    if (!counted && !held) {
+                        fail("timer %d stopwatch went from %u to %u tenths", i + 1, toTenths(was), toTenths(now));
+                    }
+                }
+                else if (toSeconds(now) == 0) {
+                    if (now.state != Timer::ALARM || toSeconds(was) != 1) {
+                        fail("timer %d reached zero from %u seconds, %s", i + 1, toSeconds(was), stateName(now.state));
+                    }
+                    totals.alarms++;
+                    checkRunTime(i);
+                }
+                else if (now.state != Timer::RUNNING || toSeconds(was) - toSeconds(now) > 1) {
+                    fail("timer %d ticked from %u to %u seconds, %s", i + 1, toSeconds(was), toSeconds(now), stateName(now.state));
+                }
+                else if (toSeconds(now) != toSeconds(was)) {
+                    tickRunTime(i, now);
+                }
+                break;
+
+            case Timer::STOPPED: {
+                // Timer 1 expiring starts timer 2 in the same tick, when chained
+                bool handed_off = i == 1 && TimerProbe::IsChained(*controller) &&
+                                  before[0].state == Timer::RUNNING && after[0].state == Timer::ALARM;
+
+                if (toTenths(now) != toTenths(was) || (now.state != Timer::STOPPED && !handed_off)) {
+                    fail("timer %d changed while stopped: %u to %u tenths, %s", i + 1, toTenths(was), toTenths(now), stateName(now.state));
+                }
+                if (now.state == Timer::RUNNING) {
+                    startTiming(i, now);
+                }
+                break;
+            }
+
+            case Timer::ALARM:
+                if (now.state != Timer::ALARM) {
+                    fail("timer %d left its alarm on a tick", i + 1);
+                }
+                break;
+        }
+    }
+}
+
+static void checkEvent(const Snapshot* before, const Snapshot* after) {
+    for (int i = 0; i < 2; i++) {
+        const Snapshot& was = before[i];
+        const Snapshot& now = after[i];
+
+        checkFields(now, i);
+
+        if (now.state == Timer::ALARM && was.state != Timer::ALARM) {
+            fail("timer %d alarmed on a button event", i + 1);
+        }
+
+        // Leaving an alarm resets, as does clearing the start time; either
+        // may be followed by a start in the same event, in chained mode
+        bool reset = was.state == Timer::ALARM && now.state != Timer::ALARM;
+        bool cleared = now.start == 0 && was.start != 0;
+        if ((reset || cleared) && TimerProbe::Packed(TimerProbe::GetTimer(*controller, i)) != now.start) {
+            fail("timer %d reset to %u:%02u:%02u, not its start time %08x", i + 1, now.hours, now.minutes, now.seconds, now.start);
+        }
+
+        if (now.state != was.state || toTenths(now) != toTenths(was)) {
+            startTiming(i, now);
+        }
+    }
+}
+
+// What Timer::Update draws on its first row, as far as it's known here
+static void expectedText(const Snapshot& timer, char* text) {
+    if (timer.stopwatch && !timer.hours) {
+        sprintf(text, "%02u:%02u.%u", timer.minutes, timer.seconds, timer.tenths);
+    }
+    else if (timer.coarse) {
+        sprintf(text, "%u:%02u", timer.hours, timer.minutes);
+    }
+    else {
+        sprintf(text, "%u:%02u:%02u", timer.hours, timer.minutes, timer.seconds);
+    }
+}
+
+static void checkDisplay() {
+    if (TimerProbe::IsFramePending(*controller)) {
+        return;
+    }
+
+    Snapshot timers[2];
+    for (int i = 0; i < 2; i++) {
+        timers[i] = TimerProbe::Take(TimerProbe::GetTimer(*controller, i));
+    }
+
+    // Both alarming blink the whole display
+    if (timers[0].state == Timer::ALARM && timers[1].state == Timer::ALARM) {
+        return;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        char row[LCD_MODEL_COLUMNS + 1];
+        char expected[16];
+
+        lcdModelGetRow(timers[i].y, row);
+        expectedText(timers[i], expected);
+
+        if (strncmp(row + timers[i].x, expected, strlen(expected))) {
+            fail("timer %d shows '%.7s', not '%s'", i + 1, row + timers[i].x, expected);
+        }
+    }
+
+    if (lcdModelGetStats().busy_violations) {
+        fail("display sent instructions while busy");
+    }
+
+    totals.frames_checked++;
+}
+
+//----------------------------------------------------------------------------------------
+// Driving
+//
+
+static void takeAll(Snapshot* snapshots) {
+    for (int i = 0; i < 2; i++) {
+        snapshots[i] = TimerProbe::Take(TimerProbe::GetTimer(*controller, i));
+    }
+}
+
+static void soakTick() {
+    Snapshot before[2], after[2];
+
+    takeAll(before);
+    TimerInterruptHandler();
+    takeAll(after);
+
+    totals.ticks++;
+    checkTick(before, after);
+}
+
+// xorshift64*: fast, and the same sequence for a seed everywhere
+static uint32_t randomBelow(uint32_t limit) {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (uint32_t)((random_state * 0x2545f4914f6cdd1dULL) >> 32) % limit;
+}
+
+// Mostly nothing or one button per timer, sometimes a reset chord or a
+// pair of time buttons
+static uint8_t randomTimerButtons() {
+    static const uint8_t singles[] = { BUTTON_H, BUTTON_M, BUTTON_S, BUTTON_START };
+    static const uint8_t pairs[] = { BUTTON_H | BUTTON_M, BUTTON_M | BUTTON_S, BUTTON_H | BUTTON_S };
+    uint32_t pick = randomBelow(100);
+
+    if (pick < 50) {
+        return 0;
+    }
+    if (pick < 90) {
+        return singles[randomBelow(4)];
+    }
+    if (pick < 97) {
+        return BUTTON_START | singles[randomBelow(3)];
+    }
+    return pairs[randomBelow(3)];
+}
+
+static void render() {
+    controller->Update();
+    lcdFlush();
+    checkDisplay();
+}
+
+static void buttonEvent(uint8_t state) {
+    Snapshot before[2], after[2];
+
+    record("buttons %02x", state);
+    takeAll(before);
+    controller->ProcessButtons(state);
+    takeAll(after);
+
+    buttons = state;
+    totals.button_events++;
+    checkEvent(before, after);
+    render();
+}
+
+static void repeat(uint8_t step) {
+    Snapshot before[2], after[2];
+
+    record("repeat %02x step %u", buttons, step);
+    takeAll(before);
+    controller->ProcessRepeat(buttons, step);
+    takeAll(after);
+
+    totals.repeats++;
+    checkEvent(before, after);
+    render();
+}
+
+// In steps, as the main loop would wake to draw; unattended, running
+// timers are only redrawn once a minute, so the steps can be longer
+static void wait(uint64_t ms) {
+    record("wait %llums", (unsigned long long)ms);
+
+    while (ms) {
+        uint32_t loop_ms = backlight->IsOn() ? LOOP_STEP_MS : UNATTENDED_STEP_MS;
+        uint32_t step = ms < loop_ms ? ms : loop_ms;
+
+        hostAdvance(step * HOST_TICKS_PER_MS);
+        render();
+        ms -= step;
+    }
+}
+
+// Waits are mostly short, as between presses; the longer ones let timers
+// run out, and sometimes to ten hours
+static uint64_t randomWait() {
+    uint32_t pick = randomBelow(100);
+
+    if (pick < 60) {
+        return 1 + randomBelow(1000);
+    }
+    if (pick < 90) {
+        return 1000 + randomBelow(120000);
+    }
+    if (pick < 98) {
+        return 120000 + randomBelow(3600000);
+    }
+    return 3600000 + randomBelow(9 * 3600000);
+}
+
+static void step() {
+    uint32_t pick = randomBelow(100);
+
+    if (pick < 2) {
+        buttonEvent(TIMER1(BUTTON_START) | BUTTON_START);           // mode chord
+    }
+    else if (pick < 40) {
+        buttonEvent(TIMER1(randomTimerButtons()) | randomTimerButtons());
+    }
+    else if (pick < 50 && buttons) {
+        static const uint8_t steps[] = { 1, 1, 5, 10 };
+        repeat(steps[randomBelow(4)]);
+    }
+    else {
+        wait(randomWait());
+    }
+
+    totals.steps++;
+}
+
+//----------------------------------------------------------------------------------------
+// Run
+//
+
+void hostRunStart() {
+    lcdModelAttach(LCD_I2C_ADDR, LCD_POWER_GPIO);
+}
+
+void hostRunEnd(const char* reason) {
+    fail("run ended: %s", reason);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: timer_soak [-n steps] [-s seed]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t steps = DEFAULT_STEPS;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:s:")) != -1) {
+        switch (option) {
+            case 'n':
+                steps = strtoull(optarg, NULL, 0);
+                break;
+
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+
+            default:
+                usage();
+        }
+    }
+
+    if (optind != argc) {
+        usage();
+    }
+
+    random_state = seed ? seed : DEFAULT_SEED;
+
+    timespec host_start;
+    clock_gettime(CLOCK_MONOTONIC, &host_start);
+
+    // As main() brings the firmware up, less button input
+    halBoardInit();
+    timersInit();
+    if (halI2cInit(I2C_BITRATE_HZ)) {
+        fail("i2c init");
+    }
+    halGpioSetOutput(LCD_POWER_GPIO);
+    halGpioWrite(LCD_POWER_GPIO, 1);
+
+    Buzzer::Initialise();
+    Timer::Initialise();
+    Backlight::Initialise();
+    lcdInit();
+
+    Backlight       timer_backlight;
+    Buzzer          buzzer(BUZZER_GPIO);
+    TimerController timer_controller(buzzer, timer_backlight);
+
+    controller = &timer_controller;
+    backlight = &timer_backlight;
+    mrt_interrupt_set_timer_callback(MRT_TIMER, soakTick);
+    mrt_interrupt_control(true);
+    backlight->DelayedOff(BACKLIGHT_ON_TIME_MS);
+
+    while (totals.steps < steps) {
+        step();
+    }
+
+    timespec host_end;
+    clock_gettime(CLOCK_MONOTONIC, &host_end);
+
+    double host_seconds = (host_end.tv_sec - host_start.tv_sec) + (host_end.tv_nsec - host_start.tv_nsec) / 1e9;
+    double hours = (double)hostTicks() / TICKS_PER_HOUR;
+
+    printf("soak: passed, seed %llu\n", (unsigned long long)seed);
+    printf("steps            %llu: %llu button events, %llu repeats\n", (unsigned long long)totals.steps,
+           (unsigned long long)totals.button_events, (unsigned long long)totals.repeats);
+    printf("ticks            %llu, %llu alarms, %llu runs timed\n", (unsigned long long)totals.ticks,
+           (unsigned long long)totals.alarms, (unsigned long long)totals.runs_timed);
+    printf("frames checked   %llu\n", (unsigned long long)totals.frames_checked);
+    printf("virtual time     %.1f hours\n", hours);
+    printf("host time        %.3fs, %.1f simulated hours per second\n", host_seconds,
+           host_seconds > 0 ? hours / host_seconds : 0.0);
+    return 0;
+}
@@ -0,0 +1,265 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * VCD waveform dump
+ *
+ * Value Change Dump (IEEE 1364) of a run, through the host device API, so
+ * it works for the device simulator and the instruction set simulator alike.
+ * Time is in nanoseconds.
+ *
+ * Transfers are only reported once they're over, so the I2C lines are drawn
+ * from each transfer's bytes at its bit rate: a start, the address and send
+ * data, a repeated start, the address and received data, then a stop, with
+ * each bit a quarter period setting SDA, SCL rising at the half and falling
+ * at the end. A refused transfer shows a NACK to its address. Changes are
+ * held back a while and sorted, as other signals may change during a transfer
+ * before it's reported.
+ */
+
+#include "vcd.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "hal/hal.h"
+
+// Changes held back from the file, at least for longer than any transfer
+#define MIN_HELD            65536
+#define HOLD_NS             100000000ULL
+
+#define TICKS_PER_US        (FIXED_CLOCK_RATE_HZ / 1000000)
+
+enum Signal {
+    SCL,
+    SDA,
+    LCD_POWER,
+    INPUT_IRQ,
+    BUZZER,
+    POWER_STATE,
+    SIGNALS
+};
+
+static const char* const signal_names[SIGNALS] = {
+    "scl", "sda", "lcd_power", "input_irq", "buzzer", "power_state"
+};
+
+struct Change {
+    uint64_t    ns;
+    uint8_t     signal;
+    uint8_t     value;
+};
+
+static FILE*                vcd = NULL;
+static int                  gpios[SIGNALS];
+static std::vector<Change>  held;
+static size_t               flush_at = MIN_HELD;
+static uint64_t             latest_ns = 0;
+static uint64_t             written_ns = 0;
+static uint8_t              written[SIGNALS];
+
+static uint64_t ticksToNs(uint64_t ticks) {
+    return ticks * 1000 / TICKS_PER_US;
+}
+
+static bool byTime(const Change& a, const Change& b) {
+    return a.ns < b.ns;
+}
+
+static void writeChange(const Change& change) {
+    if (change.signal == POWER_STATE) {
+        fprintf(vcd, "b%d%d %c\n", (change.value >> 1) & 1, change.value & 1, '!' + change.signal);
+    }
+    else {
+        fprintf(vcd, "%d%c\n", change.value, '!' + change.signal);
+    }
+}
+
+// Write out the changes older than before_ns. Any older still than those
+// already written, held back too short a time, are put with the last.
+static void flush(uint64_t before_ns) {
+    std::stable_sort(held.begin(), held.end(), byTime);
+
+    size_t i = 0;
+    for (; i < held.size() && held[i].ns < before_ns; i++) {
+        const Change& change = held[i];
+
+        if (written[change.signal] == change.value) {
+            continue;
+        }
+        if (change.ns > written_ns) {
+            written_ns = change.ns;
+            fprintf(vcd, "#%llu\n", (unsigned long long)written_ns);
+        }
+
+        writeChange(change);
+        written[change.signal] = change.value;
+    }
+
+    held.erase(held.begin(), held.begin() + i);
+}
+
+static void record(uint64_t ns, Signal signal, int value) {
+    if (!vcd) {
+        return;
+    }
+
+    Change change = { ns, (uint8_t)signal, (uint8_t)value };
+    held.push_back(change);
+
+    if (ns > latest_ns) {
+        latest_ns = ns;
+    }
+    if (held.size() >= flush_at && latest_ns > HOLD_NS) {
+        flush(latest_ns - HOLD_NS);
+        flush_at = held.size() * 2 > MIN_HELD ? held.size() * 2 : MIN_HELD;
+    }
+}
+
+//----------------------------------------------------------------------------------------
+// I2C
+//
+
+struct BusDrawing {
+    uint64_t    start_ns;
+    uint32_t    bitrate_hz;
+    uint32_t    quarter;                // quarter bit periods so far
+};
+
+static void edge(BusDrawing& bus, int quarter, Signal signal, int value) {
+    uint64_t at = bus.quarter + quarter;
+    record(bus.start_ns + at * 250000000ULL / bus.bitrate_hz, signal, value);
+}
+
+static void condition(BusDrawing& bus, bool stop) {
+    edge(bus, 1, SDA, stop ? 0 : 1);
+    edge(bus, 2, SCL, 1);
+    edge(bus, 3, SDA, stop ? 1 : 0);
+    if (!stop) {
+        edge(bus, 4, SCL, 0);
+    }
+    bus.quarter += 4;
+}
+
+static void bit(BusDrawing& bus, int value) {
+    edge(bus, 1, SDA, value);
+    edge(bus, 2, SCL, 1);
+    edge(bus, 4, SCL, 0);
+    bus.quarter += 4;
+}
+
+static void byte(BusDrawing& bus, uint8_t value, bool ack) {
+    for (int i = 7; i >= 0; i--) {
+        bit(bus, (value >> i) & 1);
+    }
+    bit(bus, ack ? 0 : 1);
+}
+
+static void drawTransfer(const HostI2cTransfer& transfer) {
+    BusDrawing bus = { ticksToNs(transfer.start), transfer.bitrate_hz, 0 };
+    bool write = transfer.send_length || !transfer.receive_length;
+
+    if (write) {
+        condition(bus, false);
+        byte(bus, transfer.addr << 1, !transfer.nack);
+        if (!transfer.nack) {
+            for (int i = 0; i < transfer.send_length; i++) {
+                byte(bus, transfer.send[i], true);
+            }
+        }
+    }
+
+    if (transfer.receive_length && !(write && transfer.nack)) {
+        condition(bus, false);
+        byte(bus, (transfer.addr << 1) | 1, !transfer.nack);
+        if (!transfer.nack) {
+            // The master acknowledges all but the last byte
+            for (int i = 0; i < transfer.receive_length; i++) {
+                byte(bus, transfer.receive[i], i < transfer.receive_length - 1);
+            }
+        }
+    }
+
+    condition(bus, true);
+}
+
+//----------------------------------------------------------------------------------------
+// GPIO and power state
+//
+
+static void gpioChanged(int pin, bool level) {
+    for (int signal = LCD_POWER; signal <= BUZZER; signal++) {
+        if (gpios[signal] == pin) {
+            record(ticksToNs(hostTicks()), (Signal)signal, level);
+        }
+    }
+}
+
+static void powerChanged(HostPowerState state) {
+    record(ticksToNs(hostTicks()), POWER_STATE, state);
+}
+
+//----------------------------------------------------------------------------------------
+// File
+//
+
+bool vcdOpen(const char* path, int lcd_power_gpio, int input_irq_gpio, int buzzer_gpio) {
+    vcd = fopen(path, "w");
+    if (!vcd) {
+        return false;
+    }
+
+    gpios[LCD_POWER] = lcd_power_gpio;
+    gpios[INPUT_IRQ] = input_irq_gpio;
+    gpios[BUZZER] = buzzer_gpio;
+
+    fprintf(vcd, "$version lpc810 timer simulator $end\n");
+    fprintf(vcd, "$comment power_state: 0 awake, 1 sleep, 2 deep sleep, 3 power-down $end\n");
+    fprintf(vcd, "$timescale 1ns $end\n");
+    fprintf(vcd, "$scope module lpc810 $end\n");
+    for (int signal = 0; signal < SIGNALS; signal++) {
+        fprintf(vcd, "$var wire %d %c %s $end\n", signal == POWER_STATE ? 2 : 1, '!' + signal, signal_names[signal]);
+    }
+    fprintf(vcd, "$upscope $end\n");
+    fprintf(vcd, "$enddefinitions $end\n");
+
+    written[SCL] = written[SDA] = 1;
+    written[LCD_POWER] = hostGpioRead(lcd_power_gpio);
+    written[INPUT_IRQ] = hostGpioRead(input_irq_gpio);
+    written[BUZZER] = hostGpioRead(buzzer_gpio);
+    written[POWER_STATE] = HOST_AWAKE;
+
+    latest_ns = written_ns = ticksToNs(hostTicks());
+    fprintf(vcd, "#%llu\n$dumpvars\n", (unsigned long long)latest_ns);
+    for (int signal = 0; signal < SIGNALS; signal++) {
+        Change change = { latest_ns, (uint8_t)signal, written[signal] };
+        writeChange(change);
+    }
+    fprintf(vcd, "$end\n");
+
+    hostGpioWatch(gpioChanged);
+    hostI2cWatch(drawTransfer);
+    hostPowerWatch(powerChanged);
+    return true;
+}
+
+void vcdClose() {
+    if (!vcd) {
+        return;
+    }
+
+    uint64_t end_ns = ticksToNs(hostTicks());
+
+    flush(UINT64_MAX);
+    if (end_ns > written_ns) {
+        fprintf(vcd, "#%llu\n", (unsigned long long)end_ns);
+    }
+    fclose(vcd);
+    vcd = NULL;
+}
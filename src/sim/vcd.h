@@ -0,0 +1,22 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* VCD header - waveform dump of a simulated run, for a waveform viewer */
+
+#if !defined(__VCD_H__)
+#define __VCD_H__
+
+#include "lpc_types.h"
+
+// Start dumping the I2C bus, the given GPIOs and the power state, from the
+// current virtual time; false if the file can't be created
+extern bool vcdOpen(const char* path, int lcd_power_gpio, int input_irq_gpio, int buzzer_gpio);
+
+// Finish the dump at the current virtual time, e.g. as the run ends
+extern void vcdClose();
+
+#endif // #if !defined(__VCD_H__)
@@ -0,0 +1,440 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Event correlator - host tool
+ *
+ * Aligns the firmware event log (built with EVENT_LOG, see util/event_log.h)
+ * with a scope capture of supply current, and attributes the charge drawn
+ * to the firmware events.
+ *
+ * Each trace in the capture is correlated on its own: a scope in trigger
+ * mode leaves gaps between them, as in hardware/traces/R100_power_in.csv.
+ * Current above the trace's median baseline is binned, and the log's events
+ * are cross-correlated against it to place the trace in the log. A single
+ * trace is searched for within max_lag of the start of the log; with several,
+ * each is searched for within the second of its stamp, counted from
+ * offset_s into the log at the first trace's stamp, and max_lag either side.
+ * Each bin's charge above baseline is then attributed to the I2C burst in
+ * progress, or else to the latest event within a window before it. All
+ * charge is also split by the power state the log was in.
+ *
+ * The log's stamps keep counting through deep-sleep and power-down, so
+ * stay on the same time base as the capture whatever the firmware did.
+ *
+ * Usage: event_correlate [-r ohms] [-t type] [-f clock_hz] [-b bin_us] [-l max_lag_ms] [-w window_us] [-o offset_s] log.txt capture.csv
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "trace_reader.h"
+
+#define DEFAULT_SENSE_OHMS      100.0
+#define DEFAULT_TRACE_TYPE      0
+#define DEFAULT_CLOCK_HZ        12000000.0
+#define DEFAULT_BIN_US          10.0
+#define DEFAULT_MAX_LAG_MS      10.0
+#define DEFAULT_WINDOW_US       200.0
+#define DEFAULT_OFFSET_S        0.0
+
+#define STAMP_RESOLUTION_S      1.0
+#define SECONDS_PER_DAY         86400
+
+// As packed by util/event_log.cpp
+#define EVENT_CODE_SHIFT        28
+#define EVENT_TIME_MASK         0x0fffffff
+#define EVENT_TIME_SHIFT        3
+
+// Codes from util/event_log.h
+enum {
+    EVENT_TICK          = 1,
+    EVENT_I2C_START,
+    EVENT_I2C_END,
+    EVENT_SLEEP,
+    EVENT_DEEP_SLEEP,
+    EVENT_POWER_DOWN,
+    EVENT_WAKE,
+    EVENT_BUZZER_ON,
+    EVENT_BUZZER_OFF,
+    EVENT_OVERFLOW      = 15,
+    EVENT_CODES
+};
+
+static const char* const event_names[EVENT_CODES] = {
+    "(none)", "tick", "i2c burst", "i2c end", "sleep", "deep sleep", "power down",
+    "wake", "buzzer on", "buzzer off", "", "", "", "", "", "overflow"
+};
+
+enum {
+    STATE_ACTIVE,
+    STATE_SLEEP,
+    STATE_DEEP_SLEEP,
+    STATE_POWER_DOWN,
+    STATE_COUNT
+};
+
+static const char* const state_names[STATE_COUNT] = { "active", "sleep", "deep sleep", "power down" };
+
+struct LogEntry {
+    int     code;
+    double  seconds;        // since the first entry
+};
+
+struct Capture {
+    long                trigger;
+    double              stamp_s;    // after the first capture's stamp
+    std::vector<double> charge;     // per bin: all of it,
+    std::vector<double> excess;     // and that above the baseline
+};
+
+// Where the log stood at a point in it, as the events up to there left it
+struct LogState {
+    size_t  next;           // entry
+    int     state;
+    bool    in_burst;
+    int     last_code;
+    long    last_bin;
+};
+
+//----------------------------------------------------------------------------------------
+// Inputs
+//
+
+static bool readLog(const char* path, double clock_hz, std::vector<LogEntry>& entries) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    char line[128];
+    uint64_t time = 0;
+    uint32_t last = 0;
+    bool first = true;
+    int overflows = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        // Other serial output is interleaved with the log
+        if (line[0] != '@' || strlen(line) < 9) {
+            continue;
+        }
+
+        char* end;
+        uint32_t value = strtoul(line + 1, &end, 16);
+        if (end != line + 9) {
+            continue;
+        }
+
+        uint32_t stamp = value & EVENT_TIME_MASK;
+        time += first ? 0 : (stamp - last) & EVENT_TIME_MASK;
+        last = stamp;
+        first = false;
+
+        LogEntry entry;
+        entry.code = value >> EVENT_CODE_SHIFT;
+        entry.seconds = time * (1 << EVENT_TIME_SHIFT) / clock_hz;
+        entries.push_back(entry);
+
+        if (entry.code == EVENT_OVERFLOW) {
+            overflows++;
+        }
+    }
+
+    fclose(file);
+
+    if (overflows) {
+        fprintf(stderr, "%s: events lost %d times; the buffer was drained too slowly\n", path, overflows);
+    }
+
+    return true;
+}
+
+// "hh:mm:ss" as seconds into the day, or -1
+static double parseStamp(const char* stamp) {
+    int hours, minutes, seconds;
+    
+    if (sscanf(stamp, "%d:%d:%d", &hours, &minutes, &seconds) != 3) {
+        return -1;
+    }
+    
+    return (hours * 60 + minutes) * 60 + seconds;
+}
+
+// Each trace of the type, binned
+static bool readCapture(const char* path, int type, double sense_ohms, double bin_s, std::vector<Capture>& captures) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    TraceReader reader(file);
+    Trace trace;
+    double first_stamp = -1;
+
+    while (reader.Next(trace)) {
+        if (trace.type != type || trace.samples.empty() || trace.rate_hz <= 0) {
+            continue;
+        }
+
+        double stamp = parseStamp(trace.stamp);
+        if (first_stamp < 0) {
+            first_stamp = stamp;
+        }
+
+        captures.push_back(Capture());
+        Capture& capture = captures.back();
+        capture.trigger = trace.trigger;
+        capture.stamp_s = stamp < 0 || first_stamp < 0 ? -1 : stamp - first_stamp;
+
+        // Past midnight
+        if (stamp >= 0 && capture.stamp_s < 0) {
+            capture.stamp_s += SECONDS_PER_DAY;
+        }
+
+        double dt = 1.0 / trace.rate_hz;
+        double baseline_a = traceMedian(trace.samples) / sense_ohms;
+        double time = 0;
+
+        for (size_t i = 0; i < trace.samples.size(); i++, time += dt) {
+            size_t bin = (size_t)(time / bin_s);
+            if (bin >= capture.charge.size()) {
+                capture.charge.resize(bin + 1);
+                capture.excess.resize(bin + 1);
+            }
+
+            double current_a = trace.samples[i] / sense_ohms;
+            capture.charge[bin] += current_a * dt;
+            if (current_a > baseline_a) {
+                capture.excess[bin] += (current_a - baseline_a) * dt;
+            }
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+//----------------------------------------------------------------------------------------
+// Alignment and attribution
+//
+
+static bool isMarker(int code) {
+    return code == EVENT_OVERFLOW || code == EVENT_I2C_END;
+}
+
+// The log bin at the capture's first, from first to last, where events line
+// up best with its charge; false if no event came within reach of it
+static bool bestStart(const std::vector<LogEntry>& entries, const std::vector<double>& excess, double bin_s,
+                      long first, long last, long& start) {
+    std::vector<double> score(last - first + 1);
+    long length = (long)excess.size();
+
+    for (size_t e = 0; e < entries.size(); e++) {
+        if (isMarker(entries[e].code)) {
+            continue;
+        }
+
+        // Starts that put this event in the capture
+        long bin = (long)(entries[e].seconds / bin_s);
+        long from = bin - length + 1 > first ? bin - length + 1 : first;
+        long to = bin < last ? bin : last;
+
+        for (long s = from; s <= to; s++) {
+            score[s - first] += excess[bin - s];
+        }
+    }
+
+    long best = first;
+    for (long s = first; s <= last; s++) {
+        if (score[s - first] > score[best - first]) {
+            best = s;
+        }
+    }
+
+    start = best;
+    return score[best - first] > 0;
+}
+
+// Take in the entries up to log_bin; with counts, count the events
+static void advanceLog(const std::vector<LogEntry>& entries, double bin_s, long log_bin, LogState& log, long* counts) {
+    while (log.next < entries.size() && (long)(entries[log.next].seconds / bin_s) <= log_bin) {
+        int code = entries[log.next].code;
+
+        switch (code) {
+            case EVENT_I2C_START:   log.in_burst = true; break;
+            case EVENT_I2C_END:     log.in_burst = false; break;
+            case EVENT_SLEEP:       log.state = STATE_SLEEP; break;
+            case EVENT_DEEP_SLEEP:  log.state = STATE_DEEP_SLEEP; break;
+            case EVENT_POWER_DOWN:  log.state = STATE_POWER_DOWN; break;
+            case EVENT_WAKE:        log.state = STATE_ACTIVE; break;
+        }
+
+        if (!isMarker(code)) {
+            if (counts) {
+                counts[code]++;
+            }
+            log.last_code = code;
+            log.last_bin = (long)(entries[log.next].seconds / bin_s);
+        }
+
+        log.next++;
+    }
+}
+
+int main(int argc, char** argv) {
+    double sense_ohms   = DEFAULT_SENSE_OHMS;
+    int type            = DEFAULT_TRACE_TYPE;
+    double clock_hz     = DEFAULT_CLOCK_HZ;
+    double bin_us       = DEFAULT_BIN_US;
+    double max_lag_ms   = DEFAULT_MAX_LAG_MS;
+    double window_us    = DEFAULT_WINDOW_US;
+    double offset_s     = DEFAULT_OFFSET_S;
+    const char* paths[2] = { NULL, NULL };
+    int path_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] && !argv[i][2] && i + 1 < argc) {
+            double value = atof(argv[++i]);
+            switch (argv[i - 1][1]) {
+                case 'r': sense_ohms = value; break;
+                case 't': type = (int)value; break;
+                case 'f': clock_hz = value; break;
+                case 'b': bin_us = value; break;
+                case 'l': max_lag_ms = value; break;
+                case 'w': window_us = value; break;
+                case 'o': offset_s = value; break;
+                default: path_count = 3; break;
+            }
+        }
+        else if (path_count < 2) {
+            paths[path_count++] = argv[i];
+        }
+        else {
+            path_count = 3;
+        }
+    }
+
+    if (path_count != 2 || sense_ohms <= 0 || clock_hz <= 0 || bin_us <= 0) {
+        fprintf(stderr, "usage: event_correlate [-r ohms] [-t type] [-f clock_hz] [-b bin_us] [-l max_lag_ms] [-w window_us] [-o offset_s] log.txt capture.csv\n");
+        return 1;
+    }
+
+    double bin_s = bin_us / 1e6;
+    std::vector<LogEntry> entries;
+    std::vector<Capture> captures;
+
+    if (!readLog(paths[0], clock_hz, entries) || !readCapture(paths[1], type, sense_ohms, bin_s, captures)) {
+        return 1;
+    }
+
+    if (entries.empty() || captures.empty()) {
+        fprintf(stderr, "nothing to correlate\n");
+        return 1;
+    }
+
+    long max_lag = (long)(max_lag_ms * 1e3 / bin_us);
+    long window = (long)(window_us / bin_us);
+
+    // Walk each capture placed in the log, keeping track of the log's state at each bin
+    double event_charge[EVENT_CODES] = {};
+    long event_count[EVENT_CODES] = {};
+    double state_charge[STATE_COUNT] = {};
+    double state_seconds[STATE_COUNT] = {};
+    double unattributed = 0;
+    double seconds = 0;
+    long placed = 0;
+    long first_start = 0;
+
+    for (size_t c = 0; c < captures.size(); c++) {
+        const Capture& capture = captures[c];
+        long first = -max_lag;
+        long last = max_lag;
+
+        if (captures.size() > 1) {
+            if (capture.stamp_s < 0) {
+                fprintf(stderr, "%s: trigger %ld has no stamp to place it by\n", paths[1], capture.trigger);
+                return 1;
+            }
+
+            first += (long)((offset_s + capture.stamp_s) / bin_s);
+            last += (long)((offset_s + capture.stamp_s + STAMP_RESOLUTION_S) / bin_s);
+        }
+
+        long start;
+        if (!bestStart(entries, capture.excess, bin_s, first, last, start)) {
+            continue;
+        }
+
+        if (!placed++) {
+            first_start = start;
+        }
+
+        LogState log = { 0, STATE_ACTIVE, false, 0, 0 };
+        advanceLog(entries, bin_s, start - 1, log, NULL);
+
+        for (long n = 0; n < (long)capture.charge.size(); n++) {
+            long log_bin = start + n;
+
+            advanceLog(entries, bin_s, log_bin, log, event_count);
+
+            state_charge[log.state] += capture.charge[n];
+            state_seconds[log.state] += bin_s;
+
+            if (log.in_burst) {
+                event_charge[EVENT_I2C_START] += capture.excess[n];
+            }
+            else if (log.last_code && log_bin - log.last_bin <= window) {
+                event_charge[log.last_code] += capture.excess[n];
+            }
+            else {
+                unattributed += capture.excess[n];
+            }
+        }
+
+        seconds += capture.charge.size() * bin_s;
+    }
+
+    if (!placed) {
+        fprintf(stderr, "no capture lined up with any event; check the offset and clock\n");
+        return 1;
+    }
+
+    if (captures.size() == 1) {
+        printf("alignment:      capture = log %+.1fus, over %.3fms of capture\n", -first_start * bin_us, seconds * 1e3);
+    }
+    else {
+        printf("alignment:      %ld of %ld triggers placed by their stamps, over %.3fms of capture\n",
+               placed, (long)captures.size(), seconds * 1e3);
+    }
+
+    printf("\n%-12s %8s %12s %12s %12s\n", "event", "count", "nC each", "nC total", "uC/hour");
+
+    for (int code = 1; code < EVENT_CODES; code++) {
+        if (event_count[code]) {
+            double per_event = event_charge[code] / event_count[code];
+            printf("%-12s %8ld %12.3f %12.3f %12.3f\n", event_names[code], event_count[code],
+                   per_event * 1e9, event_charge[code] * 1e9, event_charge[code] / seconds * 3600 * 1e6);
+        }
+    }
+
+    printf("%-12s %8s %12s %12.3f %12.3f\n", "unattributed", "", "", unattributed * 1e9, unattributed / seconds * 3600 * 1e6);
+
+    printf("\n%-12s %12s %12s\n", "state", "ms", "average mA");
+    for (int s = 0; s < STATE_COUNT; s++) {
+        if (state_seconds[s] > 0) {
+            printf("%-12s %12.3f %12.3f\n", state_names[s], state_seconds[s] * 1e3, state_charge[s] / state_seconds[s] * 1e3);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Power trace analyser - host tool
+ *
+ * Reads scope captures of the voltage across a current sense resistor (see
+ * trace_reader.h), streamed a row at a time. Each trace is split into its idle
+ * baseline (the median) and events, where current rises above the baseline
+ * by more than a threshold, and the charge, current and projected battery
+ * life are reported.
+ *
+ * Usage: trace_analyser [-r ohms] [-t type] [-e threshold_ma] [-c capacity_mah] [-v] file.csv
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "trace_reader.h"
+
+#define DEFAULT_SENSE_OHMS      100.0
+#define DEFAULT_TRACE_TYPE      0
+#define DEFAULT_THRESHOLD_MA    0.05
+#define DEFAULT_CAPACITY_MAH    2000.0
+//----------------------------------------------------------------------------------------
+// Analysis
+//
+
+struct Totals {
+    long    traces;
+    long    samples;
+    double  seconds;
+    double  charge_c;               // all charge
+    double  baseline_charge_c;      // charge at the baseline current
+    long    events;
+    double  event_charge_c;         // charge above the baseline, within events
+    double  event_seconds;
+    double  max_event_charge_c;
+    double  peak_a;
+};
+
+static void analyseTrace(const Trace& trace, double sense_ohms, double threshold_a, bool verbose, Totals& totals) {
+    if (trace.samples.empty() || trace.rate_hz <= 0) {
+        return;
+    }
+
+    double dt = 1.0 / trace.rate_hz;
+    double baseline_a = traceMedian(trace.samples) / sense_ohms;
+
+    if (verbose) {
+        printf("trace %ld %s: baseline %.3fmA\n", trace.trigger, trace.stamp, baseline_a * 1e3);
+    }
+
+    double charge_c = 0;
+    bool in_event = false;
+    double event_charge_c = 0;
+    long event_samples = 0;
+    double event_peak_a = 0;
+    int events = 0;
+
+    for (size_t i = 0; i <= trace.samples.size(); i++) {
+        bool end = i == trace.samples.size();
+        double current_a = end ? baseline_a : trace.samples[i] / sense_ohms;
+
+        if (!end) {
+            charge_c += current_a * dt;
+            if (current_a > totals.peak_a) {
+                totals.peak_a = current_a;
+            }
+        }
+
+        if (!end && current_a > baseline_a + threshold_a) {
+            in_event = true;
+            event_charge_c += (current_a - baseline_a) * dt;
+            event_samples++;
+            event_peak_a = std::max(event_peak_a, current_a);
+        }
+        else if (in_event) {
+            if (verbose) {
+                printf("  event at %.1fus: %.1fus, %.3fnC above baseline, peak %.3fmA\n",
+                       (i - event_samples) * dt * 1e6, event_samples * dt * 1e6, event_charge_c * 1e9, event_peak_a * 1e3);
+            }
+
+            totals.events++;
+            totals.event_charge_c += event_charge_c;
+            totals.event_seconds += event_samples * dt;
+            totals.max_event_charge_c = std::max(totals.max_event_charge_c, event_charge_c);
+            events++;
+
+            in_event = false;
+            event_charge_c = 0;
+            event_samples = 0;
+            event_peak_a = 0;
+        }
+    }
+
+    double seconds = trace.samples.size() * dt;
+
+    if (verbose) {
+        printf("  average %.3fmA, %d events\n", charge_c / seconds * 1e3, events);
+    }
+
+    totals.traces++;
+    totals.samples += trace.samples.size();
+    totals.seconds += seconds;
+    totals.charge_c += charge_c;
+    totals.baseline_charge_c += baseline_a * seconds;
+}
+
+static void report(const Totals& totals, double capacity_mah) {
+    if (!totals.traces) {
+        printf("no traces\n");
+        return;
+    }
+
+    double average_ma = totals.charge_c / totals.seconds * 1e3;
+
+    printf("traces:             %ld (%ld samples, %.3fms)\n", totals.traces, totals.samples, totals.seconds * 1e3);
+    printf("average current:    %.3fmA\n", average_ma);
+    printf("baseline current:   %.3fmA\n", totals.baseline_charge_c / totals.seconds * 1e3);
+    printf("peak current:       %.3fmA\n", totals.peak_a * 1e3);
+    printf("events:             %ld (%.1f per trace)\n", totals.events, (double)totals.events / totals.traces);
+
+    if (totals.events) {
+        printf("event charge:       %.3fnC mean, %.3fnC max, %.1f%% of all charge\n",
+               totals.event_charge_c / totals.events * 1e9, totals.max_event_charge_c * 1e9,
+               totals.event_charge_c / totals.charge_c * 100);
+        printf("event duration:     %.1fus mean\n", totals.event_seconds / totals.events * 1e6);
+    }
+
+    double hours = capacity_mah / average_ma;
+    printf("battery life:       %.0fh (%.1f days) from %.0fmAh\n", hours, hours / 24, capacity_mah);
+}
+
+//----------------------------------------------------------------------------------------
+// Main
+//
+
+static void usage() {
+    fprintf(stderr, "usage: trace_analyser [-r ohms] [-t type] [-e threshold_ma] [-c capacity_mah] [-v] file.csv\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    double sense_ohms   = DEFAULT_SENSE_OHMS;
+    int type            = DEFAULT_TRACE_TYPE;
+    double threshold_ma = DEFAULT_THRESHOLD_MA;
+    double capacity_mah = DEFAULT_CAPACITY_MAH;
+    bool verbose        = false;
+    const char* path    = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] && !argv[i][2] && i + 1 < argc) {
+            double value = atof(argv[++i]);
+            switch (argv[i - 1][1]) {
+                case 'r': sense_ohms = value; break;
+                case 't': type = (int)value; break;
+                case 'e': threshold_ma = value; break;
+                case 'c': capacity_mah = value; break;
+                default: usage();
+            }
+        }
+        else if (!path) {
+            path = argv[i];
+        }
+        else {
+            usage();
+        }
+    }
+
+    if (!path || sense_ohms <= 0 || capacity_mah <= 0) {
+        usage();
+    }
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+
+    TraceReader reader(file);
+    Trace trace;
+    Totals totals = {};
+
+    while (reader.Next(trace)) {
+        if (trace.type == type) {
+            analyseTrace(trace, sense_ohms, threshold_ma / 1e3, verbose, totals);
+        }
+    }
+
+    fclose(file);
+    report(totals, capacity_mah);
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Streaming reader for scope capture CSV files
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "trace_reader.h"
+
+int TraceReader::ReadField(char* buffer) {
+    int len = 0;
+    int c;
+
+    while ((c = getc(file_)) != EOF && c != ',' && c != '\n') {
+        if (c != '\r' && len < FIELD_BUFFER_LEN - 1) {
+            buffer[len++] = c;
+        }
+    }
+
+    buffer[len] = 0;
+    return c;
+}
+
+void TraceReader::SkipLine() {
+    int c;
+    while ((c = getc(file_)) != EOF && c != '\n') {
+    }
+    line_++;
+}
+
+bool TraceReader::Next(Trace& trace) {
+    char field[FIELD_BUFFER_LEN];
+
+    while (true) {
+        int end = ReadField(field);
+
+        if (end == EOF && !field[0]) {
+            return false;
+        }
+
+        if (field[0] < '0' || field[0] > '9') {
+            // Header or blank line
+            if (end != '\n') {
+                SkipLine();
+            }
+            else {
+                line_++;
+            }
+            continue;
+        }
+
+        double metadata[METADATA_FIELDS];
+        metadata[0] = atof(field);
+
+        for (int i = 1; i < METADATA_FIELDS && end == ','; i++) {
+            end = ReadField(field);
+            if (i == 1) {
+                strcpy(trace.stamp, field);
+            }
+            metadata[i] = atof(field);
+        }
+
+        if (end != ',') {
+            fprintf(stderr, "line %ld: incomplete metadata, skipped\n", line_);
+            line_++;
+            continue;
+        }
+
+        trace.trigger   = (long)metadata[0];
+        trace.channel   = (int)metadata[2];
+        trace.type      = (int)metadata[4];
+        trace.rate_hz   = metadata[7];
+
+        size_t count = (size_t)metadata[8];
+        trace.samples.clear();
+        trace.samples.reserve(count);
+
+        while (end == ',') {
+            end = ReadField(field);
+            if (field[0]) {
+                trace.samples.push_back(atof(field));
+            }
+        }
+
+        if (trace.samples.size() != count) {
+            fprintf(stderr, "line %ld: expected %zu samples, found %zu\n", line_, count, trace.samples.size());
+        }
+
+        line_++;
+        return true;
+    }
+}
+
+double traceMedian(std::vector<double> values) {
+    size_t mid = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + mid, values.end());
+    return values[mid];
+}
@@ -0,0 +1,55 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Streaming reader for scope capture CSV files, as in
+ * hardware/traces/R100_power_in.csv: one capture per row, with metadata
+ *   trigger,stamp,channel,index,type,delay,factor,rate,count
+ * followed by count samples in volts. Each trigger has a row per capture type;
+ * type 0 is the sampled trace, 1 and 2 its minimum and maximum envelopes.
+ */
+
+#if !defined(__TRACE_READER_H__)
+#define __TRACE_READER_H__
+
+#include <stdio.h>
+
+#include <vector>
+
+#define FIELD_BUFFER_LEN        64
+#define METADATA_FIELDS         9
+
+struct Trace {
+    long                trigger;
+    char                stamp[FIELD_BUFFER_LEN];
+    int                 channel;
+    int                 type;
+    double              rate_hz;
+    std::vector<double> samples;    // in volts
+};
+
+class TraceReader {
+    public:
+        TraceReader(FILE* file) : file_(file), line_(1) {}
+
+        // Read the next trace, skipping the header; false at end of file
+        bool Next(Trace& trace);
+
+        long Line() { return line_; }
+
+    private:
+        // Read one field into buffer; returns the character that ended it
+        int ReadField(char* buffer);
+        void SkipLine();
+
+        FILE*   file_;
+        long    line_;
+};
+
+extern double traceMedian(std::vector<double> values);
+
+#endif // #if !defined(__TRACE_READER_H__)
@@ -0,0 +1,81 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Event log module - compact timestamped firmware events
+ *
+ * Events are packed into a word each, code in the top 4 bits, and queued in
+ * a ring buffer that interrupt handlers can add to. When it is full new
+ * events are dropped, and the next one recorded is preceded by an overflow
+ * event.
+ */
+
+#include "stdio.h"
+
+#include "hal/hal.h"
+#include "event_log.h"
+#include "timers.h"
+#include "power.h"
+
+#if defined(EVENT_LOG)
+
+#define EVENT_LOG_SIZE      32      // power of 2
+#define EVENT_CODE_SHIFT    28
+#define EVENT_TIME_SHIFT    3
+#define EVENT_TIME_MASK     0x0fffffff
+
+static uint32_t         events[EVENT_LOG_SIZE];
+static volatile uint8_t head = 0;   // next to write
+static volatile uint8_t tail = 0;   // next to read
+static bool             overflowed = false;
+
+static bool push(LogEvent event, uint32_t now) {
+    uint8_t next = (head + 1) & (EVENT_LOG_SIZE - 1);
+    
+    if (next == tail) {
+        return false;
+    }
+    
+    events[head] = ((uint32_t)event << EVENT_CODE_SHIFT) | ((now >> EVENT_TIME_SHIFT) & EVENT_TIME_MASK);
+    head = next;
+    return true;
+}
+
+void eventLogRecord(LogEvent event) {
+    // The clock stops in the deep modes; their time is added back
+    uint32_t now = timersNow() + powerGetDeepTicks();
+    
+    halIrqDisable();
+    if (overflowed && push(EVENT_OVERFLOW, now)) {
+        overflowed = false;
+    }
+    if (overflowed || !push(event, now)) {
+        overflowed = true;
+    }
+    halIrqEnable();
+}
+
+void eventLogDrain(bool all) {
+    static const char hex[] = "0123456789abcdef";
+    
+    if (!all && ((head - tail) & (EVENT_LOG_SIZE - 1)) < EVENT_LOG_SIZE / 2) {
+        return;
+    }
+    
+    while (tail != head) {
+        uint32_t entry = events[tail];
+        tail = (tail + 1) & (EVENT_LOG_SIZE - 1);
+        
+        putchar('@');
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            putchar(hex[(entry >> shift) & 0x0f]);
+        }
+        putchar('\n');
+    }
+}
+
+#endif // #if defined(EVENT_LOG)
@@ -0,0 +1,47 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* Event log module header - compact timestamped firmware events */
+
+#if !defined(__EVENT_LOG_H__)
+#define __EVENT_LOG_H__
+
+#include "lpc_types.h"
+
+// Define EVENT_LOG in the Makefile to record these into a small buffer,
+// drained over serial as lines of "@" and 8 hex digits: the event code, then
+// bits 3-30 of the timers module clock plus the time spent in the deep modes,
+// so stamps keep counting through every mode. Without it the macros compile
+// to nothing.
+enum LogEvent {
+    EVENT_TICK          = 1,
+    EVENT_I2C_START,
+    EVENT_I2C_END,
+    EVENT_SLEEP,
+    EVENT_DEEP_SLEEP,
+    EVENT_POWER_DOWN,
+    EVENT_WAKE,
+    EVENT_BUZZER_ON,
+    EVENT_BUZZER_OFF,
+    EVENT_OVERFLOW      = 15    // events were lost before this one
+};
+
+#if defined(EVENT_LOG)
+#define EVENT_LOG_RECORD(event)     eventLogRecord(event)
+#define EVENT_LOG_DRAIN(all)        eventLogDrain(all)
+#else
+#define EVENT_LOG_RECORD(event)
+#define EVENT_LOG_DRAIN(all)
+#endif
+
+extern void eventLogRecord(LogEvent event);
+
+// Send buffered events over serial; unless all is set, only once the buffer
+// is half full, so the UART isn't busy after every event
+extern void eventLogDrain(bool all);
+
+#endif // #if !defined(__EVENT_LOG_H__)
@@ -25,17 +25,16 @@
 
 #include "stdio.h"
 
-#include "lpc_types.h"
-#include "romapi_8xx.h"
-
+#include "hal/hal.h"
 #include "timers.h"
 #include "lcd.h"
+#include "event_log.h"
+#include "profile.h"
 
 // ---------------------------------------------------------------------------
 // External functions in other modules
 //
 
-extern I2C_HANDLE_T* ih;
 extern void error(const char* msg);
 extern void errorWithCode(const char* msg, int code);
 
@@ -58,28 +57,51 @@ extern void errorWithCode(const char* msg, int code);
 #define __RS            (1 << PIN_RS)
 #define __BL            (1 << PIN_BACKLIGHT)
 
+// Total time spent in I2C transfers, in clock ticks
+static uint32_t bus_ticks = 0;
+
+// Set while the LCD is unpowered: writes are dropped until the next lcdInit
+static bool suspended = false;
+
 static void i2cWrite(uint8_t addr, uint8_t value) {
-    uint8_t buf [4];
+    if (suspended) {
+        return;
+    }
     
-    I2C_PARAM_T param;
-    I2C_RESULT_T result;
-
-    buf[0] = (addr << 1) | 0;
-    buf[1] = value;
+    uint32_t start = timersNow();
     
-    /* Setup parameters for transfer */
-    param.num_bytes_send  = 2;
-    param.num_bytes_rec   = 0;
-    param.buffer_ptr_send = buf;
-    param.buffer_ptr_rec  = NULL;
-    param.stop_flag       = 1;
-
-    ErrorCode_t err = LPC_I2CD_API->i2c_master_transmit_poll(ih, &param, &result);
-    if (err != LPC_OK)
-        errorWithCode("lcd:i2c_master_transmit_poll", err);
+    int err = halI2cWrite(addr, &value, 1);
+    if (err != 0)
+        errorWithCode("lcd:i2c write", err);
     
+    bus_ticks += timersSince(start);
 } 
 
+uint32_t lcdGetBusTicks() {
+    return bus_ticks;
+}
+
+// Bracket each LCD operation as one I2C burst in the event log; nested
+// operations, e.g. within lcdInit, stay part of the outer burst
+#if defined(EVENT_LOG)
+static uint8_t burst_depth = 0;
+
+static void burstStart() {
+    if (!burst_depth++) {
+        EVENT_LOG_RECORD(EVENT_I2C_START);
+    }
+}
+
+static void burstEnd() {
+    if (!--burst_depth) {
+        EVENT_LOG_RECORD(EVENT_I2C_END);
+    }
+}
+#else
+static void burstStart() {}
+static void burstEnd() {}
+#endif
+
 // ---------------------------------------------------------------------------
 // LCD control
 //
@@ -127,9 +149,56 @@ static void i2cWrite(uint8_t addr, uint8_t value) {
 
 #define LCD_CLEAR_TIME_US       2000
 
+#define LCD_COLUMNS             16
+#define LCD_ROWS                2
+#define LCD_CELLS               (LCD_COLUMNS * LCD_ROWS)
+#define CELL_NONE               0xff
+
+// Shadow of the display contents. Text output only updates the shadow and
+// marks changed cells dirty; lcdFlushStep sends one dirty cell at a time so
+// the caller can service input in between.
+static char     shadow[LCD_CELLS];
+static uint32_t dirty_cells = 0;                // bit per cell
+static uint8_t  write_cell  = 0;                // next cell for lcdPutchar
+static uint8_t  lcd_cell    = CELL_NONE;        // the LCD's own address counter, when known
+
+#define LCD_GLYPHS              8
+#define GLYPH_ROWS              8
+#define GLYPH_ROWS_PER_STEP     4       // with its address command, ~2.5ms on the bus at 100kHz
+#define GLYPH_NONE              0xff
+
+// Custom glyphs are shadowed too, and a changed glyph is sent a few rows per
+// lcdFlushStep, so a blink doesn't hold up input for the whole glyph
+static uint8_t  glyphs[LCD_GLYPHS];
+static uint8_t  dirty_glyphs  = 0;              // bit per glyph
+static uint8_t  glyph_sending = GLYPH_NONE;     // glyph part sent, if any
+static uint8_t  glyph_row     = 0;              // its next row
+
+// Initialisation is a sequence of stages sent by lcdFlushStep, each once the
+// wait before it has passed, so restarting the LCD doesn't hold up input for
+// the 100ms+ it takes
+enum InitStage {
+    INIT_DONE,
+    INIT_PINS,
+    INIT_RESET,
+    INIT_MODE,
+    INIT_CONFIG,
+    INIT_ENTRY
+};
+
+#define LCD_POWER_UP_MS         10
+
+static uint8_t  init_stage      = INIT_DONE;
+static uint32_t init_wait_start = 0;
+static uint32_t init_wait_ticks = 0;
+static bool     display_enabled = true;
+
+static void shadowClear();
+
 static uint8_t backlight_state = __BL;
 
 void lcdSetBacklight(int value) {
+    burstStart();
     if (value) {
         backlight_state = __BL;
     }
@@ -138,6 +207,7 @@ void lcdSetBacklight(int value) {
     }
     
     i2cWrite(I2C_ADDR, backlight_state);
+    burstEnd();
 }
 
 bool lcdIsBacklightOn() {
@@ -171,10 +241,15 @@ void lcdWriteNybble(uint8_t value, uint8_t mode) {
       mode = __RS;
     }
 
+    // The HAL masks interrupts within each transfer, not across the pair:
+    // the backlight times out from an interrupt, writing the backpack with
+    // EN low, and between these two writes that would strobe in its nybble
+    uint32_t irq_state = halIrqSave();
     backpack_value |= mode | backlight_state;
 
     i2cWrite(I2C_ADDR, backpack_value | __EN);
     i2cWrite(I2C_ADDR, backpack_value & ~__EN);   
+    halIrqRestore(irq_state);
 }
 
 void lcdWriteByte(uint8_t value, uint8_t mode) {
@@ -182,74 +257,256 @@ void lcdWriteByte(uint8_t value, uint8_t mode) {
     lcdWriteNybble(value & 0x0f, mode);
 }
 
+void lcdSuspend() {
+    suspended  = true;
+    init_stage = INIT_DONE;
+}
+
+static void initWait(uint8_t next_stage, uint32_t ticks) {
+    init_stage      = next_stage;
+    init_wait_start = timersNow();
+    init_wait_ticks = ticks;
+}
+
 void lcdInit() {
-    // Bring all pins to 0 via I2C apart from backlight (defaults to on)
-    i2cWrite(I2C_ADDR, backlight_state);
+    PROFILE_ENTER(PROFILE_LCD_INIT);
+    suspended       = false;
+    display_enabled = true;
+    
+    // The display is cleared as part of the sequence
+    shadowClear();
+    lcd_cell = CELL_NONE;
+    
+    // Glyphs 0-4 are bar segments 1-5 columns wide; glyph 5 is a second
+    // full block that can be blanked to blink whatever uses it
+    uint8_t b = 0;
+    glyph_sending = GLYPH_NONE;
+    for (int i = 0; i < 6; i++) {
+        b >>= 1;
+        b |= 0x10;
+        lcdSetCustomChar(i, b);
+    }
+    
+    // Give the backpack time to come up if just powered
+    initWait(INIT_PINS, LCD_POWER_UP_MS * TIMERS_TICKS_PER_MS);
+}
+
+static void initStep() {
+    if (timersSince(init_wait_start) < init_wait_ticks) {
+        return;
+    }
+    
+    burstStart();
+    
+    switch (init_stage) {
+    case INIT_PINS:
+        // Bring all pins to 0 via I2C apart from backlight (defaults to on)
+        i2cWrite(I2C_ADDR, backlight_state);
+        
+        // Ensure we meet minimum 40ms wait between power crossing 2.7V and
+        // sending of first command
+        initWait(INIT_RESET, 100 * TIMERS_TICKS_PER_MS);
+        break;
         
-    // Ensure we meet minimum 40ms wait between power crossing 2.7V and
-    // sending of first command
-    delayMs(100);
+    case INIT_RESET:
+        lcdWriteNybble(0x03, WRITE_MODE_CMD);
+        initWait(INIT_MODE, 5 * TIMERS_TICKS_PER_MS);
+        break;
+        
+    case INIT_MODE:
+        // second try
+        lcdWriteNybble(0x03, WRITE_MODE_CMD);
+        delayUs(150);
+
+        // third go!
+        lcdWriteNybble(0x03, WRITE_MODE_CMD);
+        delayUs(150);
+
+        // finally, set to 4-bit interface and display mode (fixed at 2 line, 5x8 dots)
+        lcdWriteNybble(0x02, WRITE_MODE_CMD);
+        initWait(INIT_CONFIG, 150 * (TIMERS_TICKS_PER_MS / 1000));
+        break;
+        
+    case INIT_CONFIG: {
+        // Set up display mode
+        uint8_t display_function = LCD_2LINE | LCD_5x8DOTS;    
+        lcdWriteByte(LCD_FUNCTIONSET | display_function, WRITE_MODE_CMD);
+        delayUs(60);
+        
+        uint8_t display_control = (display_enabled ? LCD_DISPLAYON : LCD_DISPLAYOFF) | LCD_CURSOROFF | LCD_BLINKOFF;
+        lcdWriteByte(LCD_DISPLAYCONTROL | display_control, WRITE_MODE_CMD);
+        
+        lcdWriteByte(LCD_CLEARDISPLAY, WRITE_MODE_CMD);
+        initWait(INIT_ENTRY, LCD_CLEAR_TIME_US * (TIMERS_TICKS_PER_MS / 1000));
+        break;
+    }
+        
+    case INIT_ENTRY: {
+        uint8_t display_mode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
+        lcdWriteByte(LCD_ENTRYMODESET | display_mode, WRITE_MODE_CMD);
+        lcd_cell    = 0;
+        init_stage  = INIT_DONE;
+        PROFILE_EXIT(PROFILE_LCD_INIT);
+        break;
+    }
+    }
     
-    lcdWriteNybble(0x03, WRITE_MODE_CMD);
-    delayMs(5);
+    burstEnd();
+}
 
-    // second try
-    lcdWriteNybble(0x03, WRITE_MODE_CMD);
-    delayUs(150);
+void lcdSetCustomChar(int index, uint8_t row_bits) {
+    index &= LCD_GLYPHS - 1;
+    
+    glyphs[index]    = row_bits;
+    dirty_glyphs    |= 1 << index;
+    
+    // A glyph part sent starts again
+    if (index == glyph_sending) {
+        glyph_row = 0;
+    }
+}
 
-    // third go!
-    lcdWriteNybble(0x03, WRITE_MODE_CMD);
-    delayUs(150);
+// ---------------------------------------------------------------------------
+// Shadow buffer
+//
 
-    // finally, set to 4-bit interface and display mode (fixed at 2 line, 5x8 dots)
-    lcdWriteNybble(0x02, WRITE_MODE_CMD);
-    delayUs(150);
+static void shadowClear() {
+    for (int i = 0; i < LCD_CELLS; i++) {
+        shadow[i] = ' ';
+    }
     
-    // Set up display mode
-    uint8_t display_function = LCD_2LINE | LCD_5x8DOTS;    
-    lcdWriteByte(LCD_FUNCTIONSET | display_function, WRITE_MODE_CMD);
-    delayUs(60);
-        
-    uint8_t display_control = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
-    lcdWriteByte(LCD_DISPLAYCONTROL | display_control, WRITE_MODE_CMD);
+    dirty_cells = 0;
+    write_cell  = 0;
+}
 
-    lcdClear();    
+// Send up to rows rows of the next dirty glyph
+static void glyphFlushStep(uint8_t rows) {
+    if (glyph_sending == GLYPH_NONE) {
+        glyph_sending = 0;
+        while (!(dirty_glyphs & (1 << glyph_sending))) {
+            glyph_sending++;
+        }
+        glyph_row = 0;
+    }
     
-    uint8_t display_mode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
-    lcdWriteByte(LCD_ENTRYMODESET | display_mode, WRITE_MODE_CMD);
+    burstStart();
     
-    lcdWriteByte(LCD_SETCGRAMADDR, WRITE_MODE_CMD);
-    uint8_t b = 0;
-    for (int i = 0; i < 5; i++) {
-        b >>= 1;
-        b |= 0x10;
-        for (int j = 0; j < 8; j++) {
-            lcdWriteByte(b, WRITE_MODE_DATA);
-        }
+    lcdWriteByte(LCD_SETCGRAMADDR | (glyph_sending << 3) | glyph_row, WRITE_MODE_CMD);
+    for (; rows && glyph_row < GLYPH_ROWS; rows--, glyph_row++) {
+        lcdWriteByte(glyphs[glyph_sending], WRITE_MODE_DATA);
     }
+    
+    if (glyph_row >= GLYPH_ROWS) {
+        dirty_glyphs &= ~(1 << glyph_sending);
+        glyph_sending = GLYPH_NONE;
+    }
+    
+    lcd_cell = CELL_NONE;
+    burstEnd();
 }
 
+bool lcdFlushStep() {
+    if (init_stage != INIT_DONE) {
+        initStep();
+        return true;
+    }
+    
+    if (dirty_glyphs) {
+        glyphFlushStep(GLYPH_ROWS_PER_STEP);
+        return true;
+    }
+    
+    if (!dirty_cells) {
+        return false;
+    }
+    
+    uint8_t cell = 0;
+    while (!(dirty_cells & (1UL << cell))) {
+        cell++;
+    }
+    
+    burstStart();
+    
+    if (cell != lcd_cell) {
+        uint8_t addr = (cell & (LCD_COLUMNS - 1)) + (cell >= LCD_COLUMNS ? 0x40 : 0);
+        lcdWriteByte(LCD_SETDDRAMADDR | addr, WRITE_MODE_CMD);
+    }
+    
+    lcdWriteByte(shadow[cell], WRITE_MODE_DATA);
+    dirty_cells &= ~(1UL << cell);
+    
+    burstEnd();
+    
+    // The address counter runs on past the end of the first row into
+    // memory that is not displayed
+    lcd_cell = cell + 1 == LCD_COLUMNS ? CELL_NONE : cell + 1;
+    
+    return dirty_cells != 0;
+}
+
+bool lcdIsFlushPending() {
+    return init_stage != INIT_DONE || dirty_cells || dirty_glyphs;
+}
+
+void lcdFlush() {
+    // Nothing waits on a blocking flush, so glyphs go whole
+    while (dirty_glyphs) {
+        glyphFlushStep(GLYPH_ROWS);
+    }
+    
+    while (lcdFlushStep()) {
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Output
+//
+
 void lcdClear() {
+    // Initialisation clears the display itself
+    if (init_stage != INIT_DONE) {
+        shadowClear();
+        return;
+    }
+    
+    burstStart();
     lcdWriteByte(LCD_CLEARDISPLAY, WRITE_MODE_CMD);
     delayUs(LCD_CLEAR_TIME_US);
+    shadowClear();
+    lcd_cell = 0;
+    burstEnd();
 }
 
 void lcdPuts(const char* s) {
     while (*s) {
-        lcdWriteByte(*s++, WRITE_MODE_DATA);
+        lcdPutchar(*s++);
     }
 }
 
 void lcdPutchar(const char c) {
-    lcdWriteByte(c, WRITE_MODE_DATA);
+    if (write_cell < LCD_CELLS) {
+        if (shadow[write_cell] != c) {
+            shadow[write_cell] = c;
+            dirty_cells |= 1UL << write_cell;
+        }
+        
+        // Like the LCD, output past the end of a row is lost
+        write_cell = (write_cell & (LCD_COLUMNS - 1)) == LCD_COLUMNS - 1 ? CELL_NONE : write_cell + 1;
+    }
 }
 
 void lcdMoveTo(int x, int y) {
-    uint8_t addr = (x & 0x0f) + (y & 0x01) * 0x40;
-    lcdWriteByte(LCD_SETDDRAMADDR | addr, WRITE_MODE_CMD);
+    write_cell = (x & (LCD_COLUMNS - 1)) + (y & (LCD_ROWS - 1)) * LCD_COLUMNS;
 }
 
 void lcdDisplayEnable(int value) {
+    // Until initialised, kept for the display control command
+    display_enabled = value;
+    if (init_stage != INIT_DONE) {
+        return;
+    }
+    
+    burstStart();
     uint8_t display_control = 0;
     
     if (value) {
@@ -257,5 +514,6 @@ void lcdDisplayEnable(int value) {
     }
 
     lcdWriteByte(LCD_DISPLAYCONTROL | display_control, WRITE_MODE_CMD);
+    burstEnd();
 }
 
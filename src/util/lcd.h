@@ -10,8 +10,11 @@
 #if !defined(__LCD_H__)
 #define __LCD_H__
 
+#include "lpc_types.h"
+
 extern void lcdInit();
-extern void lcdClear();
+extern void lcdSuspend();        // drop all output until the next lcdInit, e.g. while unpowered
+extern void lcdClear();          // immediate; also empties the shadow
 extern void lcdSetBacklight(int value);
 extern bool lcdIsBacklightOn();
 extern void lcdMoveTo(int x, int y);
@@ -19,5 +22,19 @@ extern void lcdPuts(const char* s);
 extern void lcdPutchar(const char c);
 extern void lcdDisplayEnable(int value);
 
+// Text from lcdPuts/lcdPutchar goes to a shadow of the display, and only cells
+// that changed are sent, one per lcdFlushStep. Returns true while more remain.
+extern bool lcdFlushStep();
+extern bool lcdIsFlushPending();
+extern void lcdFlush();
+
+// Set every row of custom character glyph 0-7 (char codes 0x08-0x0f) to
+// row_bits; cells showing it change without being rewritten. Shadowed like
+// text, and sent a few rows per lcdFlushStep.
+extern void lcdSetCustomChar(int index, uint8_t row_bits);
+
+// Total clock ticks spent on the I2C bus writing to the LCD
+extern uint32_t lcdGetBusTicks();
+
 #endif
 
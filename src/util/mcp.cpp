@@ -11,50 +11,34 @@
  
 #include "stdio.h"
 #include "mcp.h"
-#include "romapi_8xx.h"
+#include "hal/hal.h"
+#include "event_log.h"
+#include "profile.h"
 
 extern void error(const char*);
 
-extern I2C_HANDLE_T* ih;
-
 uint8_t mcpReadRegister (uint8_t addr, uint8_t reg) {
-    uint8_t buf [4];
-
-    I2C_PARAM_T param;
-    I2C_RESULT_T result;
-
-    buf[0] = (addr << 1) | 1;
-    buf[1] = reg;
+    uint8_t value;
 
-    param.num_bytes_send  = 2;
-    param.num_bytes_rec   = 2;
-    param.buffer_ptr_send = param.buffer_ptr_rec = buf;
-    param.stop_flag       = 1;
+    PROFILE_ENTER(PROFILE_MCP_READ);
+    EVENT_LOG_RECORD(EVENT_I2C_START);
+    if (halI2cWriteRead(addr, &reg, 1, &value, 1) != 0)
+        error("mcp:i2c read");
+    EVENT_LOG_RECORD(EVENT_I2C_END);
+    PROFILE_EXIT(PROFILE_MCP_READ);
 
-    if (LPC_I2CD_API->i2c_master_tx_rx_poll(ih, &param, &result) != LPC_OK)
-        error("i2c_master_tx_rx_poll");
-
-    return buf[1];
+    return value;
 }
 
 void mcpWriteRegister(uint8_t addr, uint8_t reg, uint8_t val) {
-    uint8_t buf [4];
-    
-    I2C_PARAM_T param;
-    I2C_RESULT_T result;
-
-    buf[0] = (addr << 1) | 1;
-    buf[1] = reg;
-    buf[2] = val;
-
-    /* Setup parameters for transfer */
-    param.num_bytes_send  = 3;
-    param.num_bytes_rec   = 0;
-    param.buffer_ptr_send = buf;
-    param.buffer_ptr_rec  = NULL;
-    param.stop_flag       = 1;
-
-    if (LPC_I2CD_API->i2c_master_transmit_poll(ih, &param, &result) != LPC_OK)
-        error("i2c_master_transmit_poll");
+    uint8_t buf [2];
+
+    buf[0] = reg;
+    buf[1] = val;
+
+    EVENT_LOG_RECORD(EVENT_I2C_START);
+    if (halI2cWrite(addr, buf, 2) != 0)
+        error("mcp:i2c write");
+    EVENT_LOG_RECORD(EVENT_I2C_END);
 }
 
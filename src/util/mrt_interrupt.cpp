@@ -11,19 +11,16 @@
  
 #include "mrt_interrupt.h"
 
-#include "LPC8xx.h"
+#include "hal/hal.h"
+#include "power.h"
+#include "profile.h"
 
-#define MRT_CHANNEL_COUNT   4
+#define MRT_CHANNEL_COUNT   HAL_MRT_CHANNEL_COUNT
 
 static void (*mrt_callbacks[MRT_CHANNEL_COUNT])() = { 0, 0, 0, 0 };
 
 void mrt_interrupt_control(bool enable) {
-    if (enable) {
-        NVIC_EnableIRQ(MRT_IRQn);
-    }
-    else {
-        NVIC_DisableIRQ(MRT_IRQn);
-    }
+    halMrtIrqEnable(enable);
 }
 
 void mrt_interrupt_set_timer_callback(int channel, void (*callback)()) {
@@ -31,13 +28,16 @@ void mrt_interrupt_set_timer_callback(int channel, void (*callback)()) {
 }
 
 extern "C" void MRT_IRQHandler(void) {
+    PROFILE_ENTER(PROFILE_MRT_IRQ);
+    powerNoteWake(POWER_WAKE_MRT);
+    
     for (int i = 0; i < MRT_CHANNEL_COUNT; i++) {
-        if (LPC_MRT->Channel[i].STAT & 0x1) {
-            LPC_MRT->Channel[i].STAT = 0x1 ; /* clr interrupt request */
+        if (halMrtTakeInterrupt(i)) {
             if (mrt_callbacks[i]) {
                 mrt_callbacks[i]();
             }
         }
     }
+    PROFILE_EXIT(PROFILE_MRT_IRQ);
 }
 
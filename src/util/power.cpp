@@ -0,0 +1,232 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Power module - low power modes and choosing between them
+ *
+ * Active time and time in sleep are measured on the timers module clock. That stops in the
+ * deeper modes, so those are timed by the self-wake timer (WKT) running
+ * from the 10kHz low power oscillator, which also bounds a deep-sleep.
+ */
+
+#include "hal/hal.h"
+#include "power.h"
+#include "timers.h"
+#include "event_log.h"
+
+#define CLOCK_MRT_TIMER         3
+
+#define WKT_COUNTS_PER_MS       (HAL_WKT_CLOCK_HZ / 1000)
+#define TICKS_PER_WKT_COUNT     (FIXED_CLOCK_RATE_HZ / HAL_WKT_CLOCK_HZ)
+
+// The chip's own draw in each mode, in uA: the datasheet's at 12MHz from
+// the IRC, except deep-sleep, which was measured (as in the simulator's
+// energy.conf)
+static const uint16_t mode_ua[POWER_MODE_COUNT] = { 1400, 800, 240, 1 };
+
+// Idle periods are averaged with this weight for the latest, as a shift,
+// and capped so a long one can't swamp the rest
+#define IDLE_WEIGHT_SHIFT       2
+#define IDLE_CAP_MS             (60UL * 60 * 1000)
+#define IDLE_UNKNOWN            0xffffffff
+
+static uint32_t residency_ms[POWER_MODE_COUNT];
+static uint32_t residency_part[POWER_MODE_COUNT];       // in ticks or WKT counts
+static uint32_t entries[POWER_MODE_COUNT];
+static uint32_t expected_idle_ms = IDLE_UNKNOWN;        // until one is seen, taken as long
+static uint32_t idle_ms = 0;                            // in the deep modes since the last wake with a cause
+static uint32_t deep_sleep_bound_ms = 0;
+static uint32_t deep_ticks = 0;
+static uint32_t last_wake = 0;
+static uint32_t wakes[POWER_WAKE_COUNT];
+static volatile bool asleep = false;
+static volatile PowerWake wake_source = POWER_WAKE_OTHER;
+
+// Move whole milliseconds out of count into the mode's residency, without
+// division, leaving the remainder for next time; returns them
+static uint32_t addResidency(PowerMode mode, uint32_t count, uint32_t per_ms) {
+    count += residency_part[mode];
+    
+    uint32_t ms = 0;
+    for (uint32_t chunk = 1024; chunk; chunk >>= 5) {
+        while (count >= chunk * per_ms) {
+            count -= chunk * per_ms;
+            ms += chunk;
+        }
+    }
+    
+    residency_ms[mode]  += ms;
+    residency_part[mode] = count;
+    
+    return ms;
+}
+
+static void noteIdle(uint32_t ms) {
+    if (ms > IDLE_CAP_MS) {
+        ms = IDLE_CAP_MS;
+    }
+    
+    if (expected_idle_ms == IDLE_UNKNOWN) {
+        expected_idle_ms = ms;
+    }
+    else {
+        expected_idle_ms += (ms >> IDLE_WEIGHT_SHIFT) - (expected_idle_ms >> IDLE_WEIGHT_SHIFT);
+    }
+}
+
+extern "C" void WKT_IRQHandler(void) {
+    if (halWktTakeInterrupt()) {
+        powerNoteWake(POWER_WAKE_WKT);
+    }
+}
+
+void powerInit() {
+    halWktInit();
+    last_wake = timersNow();
+    entries[POWER_ACTIVE] = 1;
+}
+
+uint32_t powerNextDeadline() {
+    uint32_t next = POWER_NO_DEADLINE;
+    
+    for (int i = 0; i < HAL_MRT_CHANNEL_COUNT; i++) {
+        if (i != CLOCK_MRT_TIMER && halMrtIsRunning(i)) {
+            uint32_t remaining = halMrtRemaining(i);
+            if (remaining < next) {
+                next = remaining;
+            }
+        }
+    }
+    
+    if (halSysTickIsRunning()) {
+        if (halSysTickRemaining() < next) {
+            next = halSysTickRemaining();
+        }
+    }
+    
+    return next;
+}
+
+PowerMode powerSelectMode(uint32_t power_down_exit_ms, uint32_t power_down_saving_ua) {
+    if (powerNextDeadline() != POWER_NO_DEADLINE) {
+        return POWER_SLEEP;
+    }
+    
+    // Restoring costs the exit time awake with the caller's load back on;
+    // every millisecond idle in power-down saves the difference in draw
+    uint32_t saving_ua = power_down_saving_ua + mode_ua[POWER_DEEP_SLEEP] - mode_ua[POWER_DOWN];
+    uint32_t break_even_ms = power_down_exit_ms * (mode_ua[POWER_ACTIVE] + power_down_saving_ua) / saving_ua;
+    
+    // A deep-sleep that ran out has already idled to the break even point
+    if (wake_source == POWER_WAKE_WKT || expected_idle_ms >= break_even_ms) {
+        return POWER_DOWN;
+    }
+    
+    // Bounded there, an idle that runs on costs at most twice the best choice
+    deep_sleep_bound_ms = break_even_ms;
+    return POWER_DEEP_SLEEP;
+}
+
+void powerNoteWake(PowerWake source) {
+    if (asleep) {
+        asleep = false;
+        wakes[source]++;
+        wake_source = source;
+    }
+}
+
+PowerWake powerGetWakeSource() {
+    return wake_source;
+}
+
+// The flag is set with interrupts masked, so one that ran before the WFI
+// isn't taken as the wake source; a masked interrupt still wakes the chip,
+// and its handler runs once they're restored
+static void waitForWake(PowerMode mode) {
+    uint32_t irq = halIrqSave();
+    asleep = true;
+    
+    if (mode == POWER_SLEEP) {
+        halSleep();
+    }
+    else {
+        halDeepSleep(mode == POWER_DOWN);
+    }
+    
+    halIrqRestore(irq);
+}
+
+static void wakeUp() {
+    if (asleep) {
+        asleep = false;
+        wakes[POWER_WAKE_OTHER]++;
+        wake_source = POWER_WAKE_OTHER;
+    }
+    
+    entries[POWER_ACTIVE]++;
+    last_wake = timersNow();
+}
+
+void powerEnter(PowerMode mode) {
+    entries[mode]++;
+    addResidency(POWER_ACTIVE, timersSince(last_wake), TIMERS_TICKS_PER_MS);
+    EVENT_LOG_RECORD((LogEvent)(EVENT_SLEEP + mode - POWER_SLEEP));
+    
+    if (mode == POWER_SLEEP) {
+        uint32_t start = timersNow();
+        waitForWake(mode);
+        addResidency(mode, timersSince(start), TIMERS_TICKS_PER_MS);
+        wakeUp();
+        EVENT_LOG_RECORD(EVENT_WAKE);
+        return;
+    }
+    
+    halWktStart(mode == POWER_DEEP_SLEEP ? deep_sleep_bound_ms * WKT_COUNTS_PER_MS : 0);
+    waitForWake(mode);
+    uint32_t counts = halWktElapsed();
+    deep_ticks += counts * TICKS_PER_WKT_COUNT;
+    idle_ms += addResidency(mode, counts, WKT_COUNTS_PER_MS);
+    wakeUp();
+    EVENT_LOG_RECORD(EVENT_WAKE);
+    
+    // An idle period runs across a deep-sleep that ran out into the
+    // power-down that follows
+    if (wake_source != POWER_WAKE_WKT) {
+        noteIdle(idle_ms);
+        idle_ms = 0;
+    }
+}
+
+uint32_t powerGetResidencyMs(PowerMode mode) {
+    return residency_ms[mode];
+}
+
+uint32_t powerGetEntries(PowerMode mode) {
+    return entries[mode];
+}
+
+uint32_t powerGetWakes(PowerWake source) {
+    return wakes[source];
+}
+
+uint32_t powerGetModeUa(PowerMode mode) {
+    return mode_ua[mode];
+}
+
+uint32_t powerGetDeepTicks() {
+    return deep_ticks;
+}
+
+uint32_t powerGetUptimeMs() {
+    uint32_t ms = timersSince(last_wake) / TIMERS_TICKS_PER_MS;
+    
+    for (int i = 0; i < POWER_MODE_COUNT; i++) {
+        ms += residency_ms[i];
+    }
+    
+    return ms;
+}
@@ -0,0 +1,79 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/* Power module header - low power modes and choosing between them */
+
+#if !defined(__POWER_H__)
+#define __POWER_H__
+
+#include "lpc_types.h"
+
+enum PowerMode {
+    POWER_ACTIVE,           // running; only used for accounting
+    POWER_SLEEP,            // core stopped; peripherals and clocks run
+    POWER_DEEP_SLEEP,       // clocks stopped; woken by pin interrupt 0
+    POWER_DOWN,             // as deep-sleep, with flash and more powered off
+    POWER_MODE_COUNT
+};
+
+enum PowerWake {
+    POWER_WAKE_PIN,
+    POWER_WAKE_MRT,
+    POWER_WAKE_SYSTICK,
+    POWER_WAKE_WKT,         // a deep-sleep ran out
+    POWER_WAKE_OTHER,
+    POWER_WAKE_COUNT
+};
+
+#define POWER_NO_DEADLINE   0xffffffff
+
+extern void powerInit();
+
+// Clock ticks until the next MRT channel or SysTick interrupt, or
+// POWER_NO_DEADLINE if only a pin interrupt can wake the chip.
+// The clock channel of the timers module never interrupts, so isn't counted.
+extern uint32_t powerNextDeadline();
+
+// Pick the cheapest mode that is safe now. The MRT and SysTick stop in
+// deep-sleep and power-down, so any deadline means sleep. Otherwise the
+// choice is by expected energy: power-down saves power_down_saving_ua, the
+// draw of whatever the caller turns off for it, on top of the chip's own
+// saving, but costs power_down_exit_ms awake to restore it. Power-down is
+// chosen when idle periods are expected to last past the point where the two
+// break even; deep-sleep is otherwise chosen, bounded by the WKT at that
+// point, and power-down follows if the bound is reached.
+extern PowerMode powerSelectMode(uint32_t power_down_exit_ms, uint32_t power_down_saving_ua);
+
+extern void powerEnter(PowerMode mode);
+
+// Called by interrupt handlers; counts the first after each sleep as its wake source
+extern void powerNoteWake(PowerWake source);
+
+// What ended the last sleep: POWER_WAKE_WKT means a bounded deep-sleep ran
+// out with nothing to do, rather than anything needing a response
+extern PowerWake powerGetWakeSource();
+
+// Time spent in, and number of entries to, each mode; active is entered
+// at powerInit and on every wake
+extern uint32_t powerGetResidencyMs(PowerMode mode);
+extern uint32_t powerGetEntries(PowerMode mode);
+extern uint32_t powerGetWakes(PowerWake source);
+
+// The chip's own typical draw in each mode, in uA, as the choice of mode
+// weighs them up
+extern uint32_t powerGetModeUa(PowerMode mode);
+
+// Core clock ticks spent in deep-sleep and power-down, as timed by the WKT;
+// wraps. Added to the timers module clock, which stops in those modes, it
+// gives a clock that keeps counting through every mode.
+extern uint32_t powerGetDeepTicks();
+
+// Milliseconds since powerInit, in every mode: the residencies so far plus
+// the time awake since the last wake
+extern uint32_t powerGetUptimeMs();
+
+#endif // #if !defined(__POWER_H__)
@@ -0,0 +1,106 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Profiling zones implementation
+ *
+ * Each zone keeps its entry time and its stats. The cost of the timing
+ * itself, measured once on an empty zone, is taken off every time.
+ */
+
+#include "profile.h"
+
+#if defined(PROFILE)
+
+#include "hal/hal.h"
+#include "timers.h"
+
+struct ProfileStats {
+    uint32_t    min;
+    uint32_t    max;
+    uint32_t    total;              // saturating
+    uint16_t    count;              // saturating
+};
+
+static ProfileStats stats[PROFILE_ZONE_COUNT];
+static uint32_t     entry_time[PROFILE_ZONE_COUNT];
+static uint32_t     overhead = 0;
+
+void profileInit() {
+    for (int i = 0; i < PROFILE_ZONE_COUNT; i++) {
+        stats[i].min = 0xffffffff;
+    }
+    
+    // Calibrate on the first zone, then start it afresh
+    halIrqDisable();
+    profileEnter(PROFILE_LCD_INIT);
+    profileExit(PROFILE_LCD_INIT);
+    halIrqEnable();
+    
+    overhead = stats[PROFILE_LCD_INIT].min;
+    stats[PROFILE_LCD_INIT].min     = 0xffffffff;
+    stats[PROFILE_LCD_INIT].max     = 0;
+    stats[PROFILE_LCD_INIT].total   = 0;
+    stats[PROFILE_LCD_INIT].count   = 0;
+}
+
+void profileEnter(ProfileZone zone) {
+    entry_time[zone] = timersNow();
+}
+
+void profileExit(ProfileZone zone) {
+    uint32_t cycles = timersSince(entry_time[zone]);
+    ProfileStats& s = stats[zone];
+    
+    cycles = cycles > overhead ? cycles - overhead : 0;
+    
+    if (cycles < s.min) {
+        s.min = cycles;
+    }
+    if (cycles > s.max) {
+        s.max = cycles;
+    }
+    s.total = s.total + cycles < s.total ? 0xffffffff : s.total + cycles;
+    if (s.count < 0xffff) {
+        s.count++;
+    }
+}
+
+#if defined(DEBUG)
+#include "stdio.h"
+
+extern void reportValue(const char* msg, uint32_t value);
+
+static const char* const zone_names[PROFILE_ZONE_COUNT] = {
+    "lcdInit",
+    "Timer::Update",
+    "MRT_IRQHandler",
+    "mcpReadRegister",
+    "wake",
+};
+#endif
+
+void profileReport() {
+#if defined(DEBUG)
+    reportValue("profile overhead cycles", overhead);
+    
+    for (int i = 0; i < PROFILE_ZONE_COUNT; i++) {
+        ProfileStats& s = stats[i];
+        
+        if (s.count) {
+            puts(zone_names[i]);
+            reportValue(" count", s.count);
+            reportValue(" min cycles", s.min);
+            reportValue(" avg cycles", s.total / s.count);
+            reportValue(" max cycles", s.max);
+            reportValue(" total cycles", s.total);
+        }
+    }
+#endif
+}
+
+#endif // #if defined(PROFILE)
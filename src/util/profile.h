@@ -0,0 +1,51 @@
+//=======================================================================
+// Copyright Nicholas Tuckett 2015.
+// Distributed under the MIT License.
+// (See accompanying file license.txt or copy at
+//  http://opensource.org/licenses/MIT)
+//=======================================================================
+
+/*
+ * Profiling zones
+ *
+ * Define PROFILE in the Makefile to time each zone from entry to exit in
+ * core clock cycles, keeping min/max/total per zone. The M0+ has no cycle
+ * counter, so times come from the timers module clock, a free-running MRT
+ * channel on the core clock. Without it the macros below compile to nothing.
+ *
+ * Zones don't nest within themselves; any interrupt taken inside one is
+ * counted in its time.
+ */
+
+#if !defined(__PROFILE_H__)
+#define __PROFILE_H__
+
+#include "lpc_types.h"
+
+enum ProfileZone {
+    PROFILE_LCD_INIT,       // from lcdInit to the last step of the sequence it starts
+    PROFILE_TIMER_UPDATE,
+    PROFILE_MRT_IRQ,
+    PROFILE_MCP_READ,
+    PROFILE_WAKE,           // main loop, from leaving a deeper sleep to being ready to draw
+    PROFILE_ZONE_COUNT
+};
+
+#if defined(PROFILE)
+#define PROFILE_INIT()          profileInit()
+#define PROFILE_ENTER(zone)     profileEnter(zone)
+#define PROFILE_EXIT(zone)      profileExit(zone)
+#define PROFILE_REPORT()        profileReport()
+#else
+#define PROFILE_INIT()
+#define PROFILE_ENTER(zone)
+#define PROFILE_EXIT(zone)
+#define PROFILE_REPORT()
+#endif
+
+extern void profileInit();
+extern void profileEnter(ProfileZone zone);
+extern void profileExit(ProfileZone zone);
+extern void profileReport();                // over serial, with DEBUG
+
+#endif // #if !defined(__PROFILE_H__)
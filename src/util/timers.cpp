@@ -7,30 +7,110 @@
 
 /* Timers module - various useful timers for LPC8xx using Multi-Rate timer */
 
-#include "LPC8xx.h"
 #include "stdio.h"
 
+#include "hal/hal.h"
+#include "timers.h"
+#include "mrt_interrupt.h"
+
+#define ALARM_MRT_TIMER     2
+#define CLOCK_MRT_TIMER     3
+#define CLOCK_MASK          0x7fffffff
+
+//----------------------------------------------------------------------------------------
+// Alarms
+//
+
+static uint32_t         alarm_deadlines[TIMERS_ALARM_COUNT];
+static uint8_t          alarms_set = 0;
+static volatile uint8_t alarms_expired = 0;
+
+// Expire any alarms now due, and run the MRT channel until the next one.
+// Must be called with interrupts disabled.
+static void scheduleAlarms() {
+    uint32_t now = timersNow();
+    uint32_t next = 0;
+    
+    for (int i = 0; i < TIMERS_ALARM_COUNT; i++) {
+        if (alarms_set & (1 << i)) {
+            uint32_t remaining = (alarm_deadlines[i] - now) & CLOCK_MASK;
+            
+            if (remaining == 0 || remaining > (CLOCK_MASK >> 1)) {
+                alarms_set      &= ~(1 << i);
+                alarms_expired  |= 1 << i;
+            }
+            else if (!next || remaining < next) {
+                next = remaining;
+            }
+        }
+    }
+    
+    // Loading zero stops the timer when no alarm remains
+    halMrtLoad(ALARM_MRT_TIMER, next);
+}
+
+void AlarmInterruptHandler() {
+    scheduleAlarms();
+}
+
+void timersSetAlarm(int alarm, uint32_t delay_ms) {
+    timersSetAlarmAt(alarm, timersNow() + TIMERS_TICKS_PER_MS * delay_ms);
+}
+
+void timersSetAlarmAt(int alarm, uint32_t deadline) {
+    halIrqDisable();
+    alarm_deadlines[alarm]  = deadline & CLOCK_MASK;
+    alarms_set             |= 1 << alarm;
+    alarms_expired         &= ~(1 << alarm);
+    scheduleAlarms();
+    halIrqEnable();
+}
+
+void timersCancelAlarm(int alarm) {
+    halIrqDisable();
+    alarms_set      &= ~(1 << alarm);
+    alarms_expired  &= ~(1 << alarm);
+    scheduleAlarms();
+    halIrqEnable();
+}
+
+bool timersAlarmExpired(int alarm) {
+    return alarms_expired & (1 << alarm);
+}
+
+//----------------------------------------------------------------------------------------
+// Clock & delays
+//
+
 void timersInit() {
-    LPC_SYSCON->SYSAHBCLKCTRL |= (1<<10);    // enable MRT clock
-    LPC_SYSCON->PRESETCTRL &= ~(1<<7);       // reset MRT
-    LPC_SYSCON->PRESETCTRL |=  (1<<7);
+    halMrtInit();
+    
+    halMrtSetMode(CLOCK_MRT_TIMER, HAL_MRT_REPEAT);                     //MRT3 repeat mode, no interrupts
+    halMrtLoad(CLOCK_MRT_TIMER, CLOCK_MASK);                            //MRT3 free-running over full range
     
-    LPC_MRT->Channel[2].CTRL = (0x01 << 1); //MRT2 one-shot mode
-    LPC_MRT->Channel[3].CTRL = (0x02 << 1); //MRT3 bus stall mode , no interrupts
+    halMrtSetMode(ALARM_MRT_TIMER, HAL_MRT_ONE_SHOT | HAL_MRT_INTERRUPT);   //MRT2 one-shot with interrupt
+    mrt_interrupt_set_timer_callback(ALARM_MRT_TIMER, AlarmInterruptHandler);
 }
 
-void delayMs(int milliseconds) {
-    LPC_MRT->Channel[2].INTVAL = (((FIXED_CLOCK_RATE_HZ / 250L) * milliseconds) >> 2) - 286;
+uint32_t timersNow() {
+    return CLOCK_MASK - halMrtRemaining(CLOCK_MRT_TIMER);
+}
 
-    while (LPC_MRT->Channel[2].STAT & 0x02)
-        ; //wait while running
+uint32_t timersSince(uint32_t start) {
+    return (timersNow() - start) & CLOCK_MASK;
 }
 
-void delayUs(int microseconds) {
-    int clk = (FIXED_CLOCK_RATE_HZ / 1000000) * microseconds;
+static void delayTicks(uint32_t ticks) {
+    uint32_t start = timersNow();
     
-    if (clk > 3) {
-        LPC_MRT->Channel[3].INTVAL = (clk-3);
-    }
+    while (timersSince(start) < ticks)
+        ; //wait for clock to advance
 }
 
+void delayMs(int milliseconds) {
+    delayTicks(TIMERS_TICKS_PER_MS * milliseconds);
+}
+
+void delayUs(int microseconds) {
+    delayTicks((FIXED_CLOCK_RATE_HZ / 1000000) * microseconds);
+}
@@ -10,9 +10,27 @@
 #if !defined(__TIMERS_H__)
 #define __TIMERS_H__
 
+#include "lpc_types.h"
+
+#define TIMERS_TICKS_PER_MS     (FIXED_CLOCK_RATE_HZ / 1000)
+
 extern void timersInit();
 
-// Delay via stall - will block interrupts
+// Free-running clock in core clock ticks; wraps every 2^31 ticks (~178s at 12MHz)
+extern uint32_t timersNow();
+extern uint32_t timersSince(uint32_t start);
+
+// One-shot alarms sharing a single MRT channel; each interrupts (so wakes
+// the CPU) when due and stays expired until set again or cancelled.
+// Delays are limited to half the clock range.
+#define TIMERS_ALARM_COUNT      2
+
+extern void timersSetAlarm(int alarm, uint32_t delay_ms);
+extern void timersSetAlarmAt(int alarm, uint32_t deadline);     // in clock ticks
+extern void timersCancelAlarm(int alarm);
+extern bool timersAlarmExpired(int alarm);
+
+// Delay via loop - will allow interrupts
 extern void delayUs(int microseconds);
 
 // Delay via loop - will allow interrupts